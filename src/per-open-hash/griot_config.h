@@ -17,6 +17,43 @@
 #define GRIOT_IGNORE_NODE "kiwi0"
 #define GRIOT_IGNORE_NODE_STRLEN (6)
 
+/** Number of per-thread model shards when thread sharding is enabled. Threads past that limit share a locked shard */
+#define GRIOT_MAX_THREAD_SHARDS 1024
+
+/** Asynchronous pipeline: default per-thread ring size (in I/Os), how many times a full ring is waited on before
+ * dropping an I/O, and how long the model thread sleeps when every ring is empty */
+#define GRIOT_ASYNC_DEFAULT_QUEUE_SIZE 4096
+#define GRIOT_ASYNC_MAX_BACKPRESSURE_SPINS 1024
+#define GRIOT_ASYNC_IDLE_SLEEP_NS 50000
+
+/** Smallest memory budget of the model nodes, in bytes. Lower budgets passed through GRIOT_MAX_MODEL_BYTES are raised to it */
+#define GRIOT_MIN_MODEL_BYTES (16*1024)
+
+/** One event out of GRIOT_PREDICTION_TIME_SAMPLING is timed, and its time counts for all of them. griot-replay feeds
+ * the events back to back, where reading the clock twice per event would cost about as much as the model itself. */
+#ifdef GRIOT_REPLAY
+#define GRIOT_PREDICTION_TIME_SAMPLING 64
+#else
+#define GRIOT_PREDICTION_TIME_SAMPLING 1
+#endif
+
+/** The state of closed files is kept for reuse by the next opens: at most GRIOT_PER_FD_POOL_SIZE of them per shard,
+ * and only if their arena holds less than GRIOT_PER_FD_POOL_MAX_BYTES when the file is closed */
+#define GRIOT_PER_FD_POOL_SIZE 64
+#define GRIOT_PER_FD_POOL_MAX_BYTES (64*1024)
+
+/** Number of nodes of the closed files merged into their open hash graph after each I/O event */
+#define GRIOT_MERGED_NODES_PER_EVENT 16
+
+/** Largest number of context sizes evaluated in a single run, see GRIOT_ENV_CONTEXT_SIZES */
+#define GRIOT_MAX_CONTEXT_SIZES 16
+
+/** Recording mode: frames recorded per I/O when GRIOT_RECORD_DEPTH is not set, and at most, and the size of the
+ * chunks the record logs are mapped and grown by */
+#define GRIOT_RECORD_DEFAULT_DEPTH 32
+#define GRIOT_RECORD_MAX_DEPTH 256
+#define GRIOT_RECORD_CHUNK_SIZE (4*1024*1024)
+
 #undef GRIOT_DEBUG
 #undef GRIOT_DEBUG_VERBOSE
 
@@ -27,6 +64,16 @@
 
 /** Name of the environment variable used to change the default GrIOt output folder. */
 #define GRIOT_ENV_DUMP_FOLDER "GRIOT_DUMP_FOLDER"
+#define GRIOT_ENV_GRANULARITY "GRIOT_GRANULARITY"
 #define GRIOT_ENV_EXPERIMENT_NAME "GRIOT_EXPERIMENT_NAME"
 #define GRIOT_ENV_CONTEXT_SIZE "GRIOT_CONTEXT_SIZE"
-#define GRIOT_ENV_CALL_STACK_DEPTH "GRIOT_CALL_STACK_DEPTH"
\ No newline at end of file
+#define GRIOT_ENV_CONTEXT_SIZES "GRIOT_CONTEXT_SIZES"
+#define GRIOT_ENV_CALL_STACK_DEPTH "GRIOT_CALL_STACK_DEPTH"
+#define GRIOT_ENV_THREAD_SHARDED "GRIOT_THREAD_SHARDED"
+#define GRIOT_ENV_ASYNC "GRIOT_ASYNC"
+#define GRIOT_ENV_ASYNC_QUEUE_SIZE "GRIOT_ASYNC_QUEUE_SIZE"
+#define GRIOT_ENV_UNWINDER "GRIOT_UNWINDER"
+#define GRIOT_ENV_MAX_MODEL_BYTES "GRIOT_MAX_MODEL_BYTES"
+#define GRIOT_ENV_PER_THREAD_CONTEXT "GRIOT_PER_THREAD_CONTEXT"
+#define GRIOT_ENV_RECORD "GRIOT_RECORD"
+#define GRIOT_ENV_RECORD_DEPTH "GRIOT_RECORD_DEPTH"
\ No newline at end of file
@@ -1,10 +1,17 @@
 #include <string.h> // memset
 #include <stdlib.h> // malloc
 #include <time.h> // clock_gettime and CLOCK_MONOTONIC
+#include <stdatomic.h>
 #include "../shared/griot_model.h"
+#include "../shared/griot_granularity.h"
 #include "../shared/hashmap.h"
 #include "../shared/backtrace.h"
 #include "../shared/log.h"
+#include "../shared/griot_shard.h"
+#include "../shared/griot_context.h"
+#include "../shared/griot_node.h"
+#include "../shared/griot_arena.h"
+#include "../shared/griot_fd_table.h"
 #include "griot_config.h"
 
 /*
@@ -14,20 +21,30 @@
  * Each opened file has a copy of its open hash graph, and its own context.
  * When closing a file, its open hash graph is updated with the file's graph
  *
- * We have an hashmap<fd, file_data> used to store per file data,
+ * We have a table<fd, file_data> used to store per file data,
  * an hashmap<open_context, pred_data> used to store a graph per unique open_context,
  * a result struct, as well as a struct storing prediction and previous node pred_data.
+ *
+ * When thread sharding is enabled, every thread gets its own copy of all of the above (a shard), so that
+ * on_io can run concurrently without any lock. Shards are only merged when dumping the results.
+ *
+ * Every file gets its own arena, holding its per_fd_data, context and prediction table, so that closing it just
+ * drops the arena. The rest of a shard lives in the shard's arena. Small enough per_fd_data are not dropped but
+ * emptied and pooled instead, so that opening the next file does not allocate anything.
+ *
+ * With a memory budget, every shard gets an even share of it (see griot_shard_budget), and a file that needs room for a
+ * new node while its shard is over its share evicts nodes from the largest prediction tables of the shard, its own or
+ * not (see griot_node_evict_tables).
  */
 
 /*****************************
  * GrIOt main data structures
  */
 
-struct
+typedef struct
 {
     uint64_t io_count;
 
-    struct timespec app_start;
     uint64_t io_time;
 
     uint64_t read_volume;
@@ -46,38 +63,31 @@ struct
     uint64_t call_stack_instrumentation_time;
     uint64_t model_prediction_time;
 
-    uint64_t highest_recorded_memory_footprint;
-} griot_results;
+    uint64_t evicted_node_count;
+    uint64_t evicted_edge_count;
+
+    // Files closed by another thread than the one that opened them, see griot_shard_fd_close
+    uint64_t cross_shard_close_count;
+} griot_results_data;
 
-struct
+typedef struct
 {
-    // Has one reference prediction_table per unique open hash
-    hashmap *per_fd_data;
-} griot_model;
+    // Has one griot_per_fd_data per open file, indexed by fd
+    griot_fd_table per_fd_data;
+
+    // Emptied griot_per_fd_data of closed files, ready to be reused
+    struct griot_per_fd_data *per_fd_pool;
+    uint32_t per_fd_pool_size;
+
+    // The fd whose prediction table is the next one to evict nodes from
+    size_t eviction_hand;
+} griot_model_data;
 
 /**********************************
  * GrIOt secondary data structures
  */
 
-typedef struct
-{
-    // The context hash of the most recent next I/O
-    uint64_t mru_context_hash;
-
-    // one weight per outgoing edge. Used for MFU.
-    uint64_t *mfu_context_hash_list;
-    uint64_t *mfu_weight_list;
-    uint64_t mfu_lists_length;
-} griot_prediction_data;
-
-typedef struct{
-    uint64_t *context;
-    uint64_t context_hash;
-    unsigned int context_size;
-    int index;
-} griot_context;
-
-typedef struct
+typedef struct griot_per_fd_data
 {
     // The file's prediction data
     hashmap *prediction_table;
@@ -93,35 +103,59 @@ typedef struct
     uint64_t previous_call_stack;
 
     // The prediction data of the previous I/O is kept from one I/O to another so it can be updated
-    griot_prediction_data *previous_pred_data;
+    griot_node_handle previous_pred_data;
+
+    // Bytes used by the nodes of the prediction table, and position of the eviction hand in it
+    uint64_t model_bytes;
+    uint64_t clock_hand;
+
+    // Next per_fd_data of the pool, while pooled
+    struct griot_per_fd_data *next_pooled;
+
+    // Where everything above is allocated
+    griot_arena *arena;
 } griot_per_fd_data;
 
 /**********************************
- * GrIOt hash maps data structures
+ * GrIOt shards
  */
 
 typedef struct
 {
-    griot_prediction_data *data;
-    uint64_t call_stack_hash;
-} griot_prediction_table_map_entry;
+    griot_results_data results;
+    griot_model_data model;
 
-typedef struct
-{
-    griot_per_fd_data *data;
-    uint64_t fd_hash;
-} griot_per_fd_data_map_entry;
+    // Bytes used by the nodes of the prediction tables of the shard, and the most they reached since the last reset
+    uint64_t model_bytes;
+    uint64_t model_bytes_high_water;
+
+    // The shard is allocated from its arena. It and the arenas of the files report their blocks to usage.
+    griot_arena *arena;
+    griot_arena_usage usage;
+} griot_shard;
+
+static griot_shard_registry griot_shards;
+static bool thread_sharded = false;
+static struct timespec app_start;
+
+static void griot_results_merge(griot_results_data *into, const griot_results_data *from);
+static void *griot_shard_new();
+static void griot_shard_free(void *shard);
 
 // And the hashmap functions associated with the above...
 static uint64_t griot_hashmap_hash(const void *pred_data, uint64_t seed0, uint64_t seed1);
 static int griot_hashmap_compare(const void *pred_data_1, const void *pred_data_2, void *udata);
-static void griot_prediction_table_free(void *pred_data);
-static void griot_per_fd_data_free(void *pred_data);
+static void griot_per_fd_data_free(griot_shard *shard, griot_per_fd_data *per_fd_data);
+
+/**
+ * Account for bytes newly used by the nodes of a file, evicting nodes of the shard if the budget is exceeded
+ */
+static void griot_model_reserve(griot_shard *shard, griot_per_fd_data *per_fd_data, uint64_t bytes);
 
 /**
- * Function used to compute the instantaneous memory footprint of griot
+ * Enumerate the prediction tables of the open files of a shard, see griot_node_evict_tables
  */
-static uint64_t griot_get_memory_footprint();
+static bool griot_model_next_table(void *shard, size_t *hand, griot_node_table_ref *table);
 
 /***********************
  * GrIOt implementation
@@ -130,36 +164,50 @@ static uint64_t griot_get_memory_footprint();
 static uint32_t context_size;
 static uint32_t call_stack_depth;
 
+// Memory budget of the nodes of all the files (0 if unlimited), and the bytes they currently use
+static uint64_t max_model_bytes = 0;
+static _Atomic uint64_t model_bytes;
+
+/**
+ * Called by GrIOt tracer before griot_init when thread sharding is requested
+ */
+static void griot_model_enable_thread_sharding()
+{
+    thread_sharded = true;
+}
+
+/**
+ * Called by GrIOt tracer before griot_init when a memory budget is requested
+ */
+static void griot_model_set_max_model_bytes(uint64_t bytes)
+{
+    max_model_bytes = bytes!=0 && bytes<GRIOT_MIN_MODEL_BYTES ? GRIOT_MIN_MODEL_BYTES : bytes;
+}
+
 /**
  * Called by GrIOt tracer when a process is created
  * This function should init all primary data structures
  */
-void griot_init(uint32_t griot_context_size, uint32_t griot_call_stack_depth)
+static void griot_model_init(uint32_t griot_context_size, uint32_t griot_call_stack_depth)
 {
-    // Init griot_results
-    memset(&griot_results, 0, sizeof(griot_results));
-    clock_gettime(CLOCK_MONOTONIC, &griot_results.app_start);
-
-    // Init griot_model
-    griot_model.per_fd_data = hashmap_new(sizeof(griot_per_fd_data_map_entry), 0, 0, 0, griot_hashmap_hash,
-        griot_hashmap_compare, griot_per_fd_data_free, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &app_start);
 
     // Saving context size for future use
     context_size = griot_context_size;
     call_stack_depth = griot_call_stack_depth;
+
+    // Init the shards, each with its own griot_results and griot_model
+    griot_shard_registry_init(&griot_shards, thread_sharded, griot_shard_new);
 }
 
 /**
  * Called by GrIOt tracer when a process is finished, just after printing the results
  */
-void griot_finalize()
+static void griot_model_finalize()
 {
-    // Updating memory footprint stat
-    uint64_t memory_footprint = griot_get_memory_footprint();
-    if(memory_footprint>griot_results.highest_recorded_memory_footprint)griot_results.highest_recorded_memory_footprint=memory_footprint;
-
-    // Free griot model hash maps
-    hashmap_free(griot_model.per_fd_data);
+    // Free the shards, and the griot model hash maps they hold
+    griot_shard_registry_free(&griot_shards, griot_shard_free);
+    atomic_store(&model_bytes, 0);
 }
 
 /**
@@ -167,114 +215,117 @@ void griot_finalize()
  * The initialization value is obtained from the per_open_hash_data hash map.
  * If there is no value in that hashmap, we juste create an empty pred table and context.
  */
-void on_open(uint64_t timestamp, int32_t thread_id, int fd)
+static griot_per_fd_data *on_open(griot_shard *shard, uint64_t timestamp, int32_t thread_id, int fd)
 {
-    // Let's create a new per_fd_data
-    griot_per_fd_data *per_fd_data = (griot_per_fd_data *)malloc(sizeof(griot_per_fd_data));
-    if(!per_fd_data) FATAL("Out of memory");
+    // Let's reuse a pooled per_fd_data. It's already empty.
+    griot_per_fd_data *per_fd_data = shard->model.per_fd_pool;
+    if(per_fd_data!=NULL){
+        shard->model.per_fd_pool = per_fd_data->next_pooled;
+        shard->model.per_fd_pool_size -= 1;
+        per_fd_data->next_pooled = NULL;
+    }else{
+        // Else, let's create a new per_fd_data, in its own arena
+        griot_arena *arena = griot_arena_new();
+        griot_arena_set_usage(arena, &shard->usage);
+        per_fd_data = (griot_per_fd_data *)griot_arena_malloc(arena, sizeof(griot_per_fd_data));
 
-    // Filling it with zeros
-    memset(per_fd_data, 0, sizeof(griot_per_fd_data));
+        // Filling it with zeros
+        memset(per_fd_data, 0, sizeof(griot_per_fd_data));
+        per_fd_data->arena = arena;
 
-    // Setting up the context
-    per_fd_data->context.context = (uint64_t *)malloc(sizeof(uint64_t) * context_size);
-    memset(per_fd_data->context.context, 0, sizeof(uint64_t) * context_size);
-    per_fd_data->context.context_size = context_size;
+        // Setting up the context
+        griot_context_init(&per_fd_data->context, context_size, arena);
 
-    // Creating the file's prediction hashmap
-    per_fd_data->prediction_table = hashmap_new(sizeof(griot_prediction_table_map_entry), 0, 0, 0, griot_hashmap_hash,
-        griot_hashmap_compare, griot_prediction_table_free, NULL);
+        // Creating the file's prediction hashmap
+        per_fd_data->prediction_table = griot_arena_hashmap_new(arena, sizeof(griot_prediction_table_map_entry), griot_hashmap_hash,
+            griot_hashmap_compare, NULL);
+    }
 
-    // Placing the new per_fd_data in the fd hashmap
-    hashmap_set(griot_model.per_fd_data, &(griot_per_fd_data_map_entry){.data=per_fd_data, .fd_hash=fd});
+    // Placing the new per_fd_data in the fd table. If the fd was already there, its close was missed (e.g. dup2)
+    griot_per_fd_data *previous_per_fd_data = griot_fd_table_set(&shard->model.per_fd_data, fd, per_fd_data);
+    if(previous_per_fd_data!=NULL) griot_per_fd_data_free(shard, previous_per_fd_data);
+    return per_fd_data;
 }
 
 /**
  * Called when a file is closed. per_fd_data should be freed here, and per_open_hash_data  hash map is updated with its value.
  */
-void on_close(uint64_t timestamp, int32_t thread_id, int fd)
+static void on_close(griot_shard *shard, uint64_t timestamp, int32_t thread_id, int fd)
 {
-    // Getting the per fd data
-    const griot_per_fd_data_map_entry *map_entry = hashmap_get(griot_model.per_fd_data, &(griot_per_fd_data_map_entry){.fd_hash=fd});
+    // The per fd data of a fd opened by another thread is in another shard, out of reach
+    if(griot_shard_fd_close(&griot_shards, thread_id, fd)) shard->results.cross_shard_close_count += 1;
+
+    // Getting the per fd data, and removing it from the fd table
+    griot_per_fd_data *per_fd_data = griot_fd_table_remove(&shard->model.per_fd_data, fd);
 
     // If it's null, the file was opened and used out of the scope of GrIOt. We can just return
-    if(map_entry==NULL)
+    if(per_fd_data==NULL)
     {
         #ifdef GRIOT_DEBUG
         WARN("File descriptor %d was created out of the scope of GrIOt and never used until now. Strange.", fd);
         #endif
         return;
     }
-    griot_per_fd_data *per_fd_data = map_entry->data;
-
-    // Updating memory footprint stat
-    uint64_t memory_footprint = griot_get_memory_footprint();
-    if(memory_footprint>griot_results.highest_recorded_memory_footprint)griot_results.highest_recorded_memory_footprint=memory_footprint;
-
-    // Freeing the per fd data's context
-    free(per_fd_data->context.context);
 
-    // Freeing the per fd data's prediction table
-    hashmap_free(per_fd_data->prediction_table);
-
-    // Yeah, I nearly forget about this one. Thx asan.
-    free(per_fd_data);
-
-    // Freeing the per fd data itself
-    hashmap_delete(griot_model.per_fd_data, &(griot_per_fd_data_map_entry){.fd_hash=fd});
+    griot_per_fd_data_free(shard, per_fd_data);
 }
 
 /**
- * Called by GrIOt tracer when an I/O is intercepted
+ * Called by GrIOt tracer when an I/O is intercepted, once its call stack is known
  */
-void on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, FILE *optional_debug_file)
+static void griot_model_on_io_event(const griot_io_event *event, FILE *optional_debug_file)
 {
+    uint64_t timestamp = event->timestamp;
+    int32_t thread_id = event->thread_id;
+    int fd = event->fd;
+    size_t length = event->length;
+    uint64_t duration_ns = event->duration_ns;
+    op_type op_type = event->op_type;
+
+    // I/Os without a file descriptor cannot be attached to a file
+    if(fd<0) return;
+
+    // Every piece of state touched below belongs to the calling thread's shard
+    griot_shard *shard = griot_shard_acquire(&griot_shards, thread_id);
+    griot_results_data *griot_results = &shard->results;
+    griot_model_data *griot_model = &shard->model;
+
     // (0) Ignore open/close. Only reads and writes are predicted.
-    if(op_type==GRIOT_OPEN) on_open(timestamp, thread_id, fd);
-    //if(op_type==GRIOT_CLOSE) on_close(timestamp, thread_id, fd);
+    if(op_type==GRIOT_OPEN){
+        on_open(shard, timestamp, thread_id, fd);
+        griot_shard_fd_open(&griot_shards, thread_id, fd);
+    }
+    //if(op_type==GRIOT_CLOSE) on_close(shard, timestamp, thread_id, fd);
     //if(op_type!=GRIOT_READ && op_type!=GRIOT_WRITE) return;
 
-    // (0) Get the call stack
+    // (0) Get the call stack. It was computed by the caller.
     struct timespec t0, t1;
-    clock_gettime(CLOCK_MONOTONIC, &t0);
-	uint64_t call_stack = get_hash_for_current_backtrace(call_stack_depth);
-    clock_gettime(CLOCK_MONOTONIC, &t1);
-    long dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
-    griot_results.call_stack_instrumentation_count += 1;
-    griot_results.call_stack_instrumentation_time += dt_ns;
-
-    // (1) Update the stats
-    clock_gettime(CLOCK_MONOTONIC, &t0);
-    griot_results.io_count+=1;
-    griot_results.io_time += duration_ns;
-    griot_results.total_volume += length;
-    if(op_type==GRIOT_READ) griot_results.read_volume += length;
-    else if(op_type==GRIOT_WRITE) griot_results.write_volume += length;
+    long dt_ns;
+    uint64_t call_stack = event->call_stack;
+    griot_results->call_stack_instrumentation_count += 1;
+    griot_results->call_stack_instrumentation_time += event->call_stack_time_ns;
+
+    // (1) Update the stats, see GRIOT_PREDICTION_TIME_SAMPLING for the timer
+    bool timed = griot_results->io_count%GRIOT_PREDICTION_TIME_SAMPLING==0;
+    if(timed) clock_gettime(CLOCK_MONOTONIC, &t0);
+    griot_results->io_count+=1;
+    griot_results->io_time += duration_ns;
+    griot_results->total_volume += length;
+    if(op_type==GRIOT_READ) griot_results->read_volume += length;
+    else if(op_type==GRIOT_WRITE) griot_results->write_volume += length;
 
     // (2) Get the per fd data
-    griot_per_fd_data *per_fd_data;
-    {
-        const griot_per_fd_data_map_entry *map_entry = hashmap_get(griot_model.per_fd_data, &(griot_per_fd_data_map_entry){.fd_hash=fd});
-        if(map_entry==NULL){
-            #ifdef GRIOT_DEBUG
-            ERROR("Intercepting an I/O to fd=%d we have never heard of before. It's either a fd inherited from a fork"
-                ", or the application is using dup or similar.\n", fd);
-            #endif
-            on_open(timestamp, thread_id, fd);
-            per_fd_data = ((const griot_per_fd_data_map_entry *)hashmap_get(griot_model.per_fd_data, &(griot_per_fd_data_map_entry){.fd_hash=fd}))->data;
-        }else{
-            per_fd_data = map_entry->data;
-        }
+    griot_per_fd_data *per_fd_data = griot_fd_table_get(&griot_model->per_fd_data, fd);
+    if(per_fd_data==NULL){
+        #ifdef GRIOT_DEBUG
+        ERROR("Intercepting an I/O to fd=%d we have never heard of before. It's either a fd inherited from a fork"
+            ", or the application is using dup or similar.\n", fd);
+        #endif
+        per_fd_data = on_open(shard, timestamp, thread_id, fd);
     }
 
     // (3) Compute the new context
-    per_fd_data->context.context[per_fd_data->context.index] = call_stack;
-    per_fd_data->context.index += 1;
-    if(per_fd_data->context.index>=per_fd_data->context.context_size) per_fd_data->context.index = 0;    
-    uint64_t ordered_context[per_fd_data->context.context_size];
-    for(int i=per_fd_data->context.index; i<per_fd_data->context.context_size; i++){ ordered_context[i-per_fd_data->context.index]=per_fd_data->context.context[i]; }
-    for(int i=0; i<per_fd_data->context.index; i++){ ordered_context[per_fd_data->context.context_size-per_fd_data->context.index+i]=per_fd_data->context.context[i]; }
-    per_fd_data->context.context_hash = MurmurHash64A(ordered_context, per_fd_data->context.context_size*sizeof(unsigned long), GRIOT_SEED);
+    griot_context_push(&per_fd_data->context, call_stack);
 
     // (?) Debug
     #ifdef GRIOT_DEBUG_VERBOSE
@@ -283,47 +334,22 @@ void on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t l
 
     // (4) Check if the previously made prediction was right. If it was, increment the stats again
     if(per_fd_data->mru_prediction == per_fd_data->context.context_hash || (per_fd_data->mfu_prediction == 0 && per_fd_data->previous_call_stack == call_stack)){
-        griot_results.mru_correct_prediction_count+=1;
-        griot_results.mru_correct_prediction_volume+=length;
-        griot_results.mru_correct_prediction_io_time+=duration_ns;
+        griot_results->mru_correct_prediction_count+=1;
+        griot_results->mru_correct_prediction_volume+=length;
+        griot_results->mru_correct_prediction_io_time+=duration_ns;
     }
     if(per_fd_data->mfu_prediction == per_fd_data->context.context_hash || (per_fd_data->mfu_prediction == 0 && per_fd_data->previous_call_stack == call_stack)){
-        griot_results.mfu_correct_prediction_count+=1;
-        griot_results.mfu_correct_prediction_volume+=length;
-        griot_results.mfu_correct_prediction_io_time+=duration_ns;
+        griot_results->mfu_correct_prediction_count+=1;
+        griot_results->mfu_correct_prediction_volume+=length;
+        griot_results->mfu_correct_prediction_io_time+=duration_ns;
     }
 
     // (5) Update the information of the previous node
-    if(per_fd_data->previous_pred_data!=NULL)
+    griot_prediction_data *previous_pred_data = griot_node_handle_get(per_fd_data->prediction_table, &per_fd_data->previous_pred_data);
+    if(previous_pred_data!=NULL)
     {
-        // For MRU, it's easy
-        per_fd_data->previous_pred_data->mru_context_hash = per_fd_data->context.context_hash;
-
-        // For MFU, it's harder. Either the node's pred data contains the new context hash and it's just an increment...
-        bool found = false;
-        for(int i = 0; i<per_fd_data->previous_pred_data->mfu_lists_length; i++){
-            if(per_fd_data->previous_pred_data->mfu_context_hash_list[i]==per_fd_data->context.context_hash){
-                per_fd_data->previous_pred_data->mfu_weight_list[i]+=1;
-                found = true;
-                break;
-            }
-        }
-
-        // ... or it doesn't and we must resize it.
-        if(!found){
-            // incrementing the length
-            per_fd_data->previous_pred_data->mfu_lists_length+=1;
-            
-            // new context hash
-            per_fd_data->previous_pred_data->mfu_context_hash_list = realloc(per_fd_data->previous_pred_data->mfu_context_hash_list,
-                sizeof(uint64_t)*per_fd_data->previous_pred_data->mfu_lists_length);
-            per_fd_data->previous_pred_data->mfu_context_hash_list[per_fd_data->previous_pred_data->mfu_lists_length-1] = per_fd_data->context.context_hash;
-
-            // new weight
-            per_fd_data->previous_pred_data->mfu_weight_list = realloc(per_fd_data->previous_pred_data->mfu_weight_list,
-                sizeof(uint64_t)*per_fd_data->previous_pred_data->mfu_lists_length);
-            per_fd_data->previous_pred_data->mfu_weight_list[per_fd_data->previous_pred_data->mfu_lists_length-1] = 1;
-        }
+        uint64_t grown_bytes = griot_node_add_successor(per_fd_data->arena, previous_pred_data, per_fd_data->context.context_hash);
+        if(grown_bytes) griot_model_reserve(shard, per_fd_data, grown_bytes);
     }
 
     // (6) Make a new prediction using the prediction table, eventually creating an entry for the new context value
@@ -332,78 +358,105 @@ void on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t l
         const griot_prediction_table_map_entry *map_entry = hashmap_get(per_fd_data->prediction_table, &(griot_prediction_table_map_entry){.call_stack_hash=per_fd_data->context.context_hash});
         if(map_entry==NULL){
             // If there is no map entry for this context, let's create it. We make our prediction using our default heuristic.
-            pred_data = (griot_prediction_data *)malloc(sizeof(griot_prediction_data));
-            memset(pred_data, 0, sizeof(griot_prediction_data));
-            hashmap_set(per_fd_data->prediction_table, &(griot_prediction_table_map_entry){.call_stack_hash=per_fd_data->context.context_hash, .data=pred_data});
+            griot_model_reserve(shard, per_fd_data, GRIOT_NODE_BUCKET_BYTES);
+            griot_prediction_table_map_entry new_map_entry = {.call_stack_hash=per_fd_data->context.context_hash};
+            griot_node_init(&new_map_entry.data);
+            griot_arena_hashmap_set(per_fd_data->arena, per_fd_data->prediction_table, &new_map_entry);
+            pred_data = (griot_prediction_data *)&((const griot_prediction_table_map_entry *)hashmap_get(per_fd_data->prediction_table, &new_map_entry))->data;
             pred_data->mru_context_hash = per_fd_data->context.context_hash;
         }else{
             // If there is a map entry already, making our prediction is easy.
-            pred_data = map_entry->data;
+            pred_data = (griot_prediction_data *)&map_entry->data;
         }
+        pred_data->referenced = 1;
     }
 
     // MRU
     per_fd_data->mru_prediction=pred_data->mru_context_hash;
 
     // MFU
-    // If we have no data, use fallback heuristics. Else, iterate over the weights, and keep the highest frequency context.
-    if(pred_data->mfu_lists_length==0){
-        per_fd_data->mfu_prediction=pred_data->mru_context_hash;
-    }else{
-        uint64_t best = 0;
-        uint64_t min_weight = 0; // starting weight is 1 for our implementation of MFU
-        for(int i = 0; i<pred_data->mfu_lists_length; i++){
-            if(pred_data->mfu_weight_list[i]>min_weight){
-                min_weight = pred_data->mfu_weight_list[i];
-                best = pred_data->mfu_context_hash_list[i];
-            }
-        }
-        per_fd_data->mfu_prediction = best;
-    }
+    per_fd_data->mfu_prediction = griot_node_mfu_prediction(pred_data);
 
     // Fallback heuristic
     per_fd_data->previous_call_stack = call_stack;
 
     // (7) Setting the new "previous pred data"
-    per_fd_data->previous_pred_data = pred_data;
+    per_fd_data->previous_pred_data = griot_node_handle_new(per_fd_data->prediction_table, per_fd_data->context.context_hash, pred_data);
 
     // (8) Updating timers
-    clock_gettime(CLOCK_MONOTONIC, &t1);
-    dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
-    griot_results.model_prediction_time += dt_ns;
+    if(timed){
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        griot_results->model_prediction_time += dt_ns*GRIOT_PREDICTION_TIME_SAMPLING;
+    }
 
     // (9) ...
-    if(op_type==GRIOT_CLOSE) on_close(timestamp, thread_id, fd);
+    if(op_type==GRIOT_CLOSE) on_close(shard, timestamp, thread_id, fd);
+
+    griot_shard_release(&griot_shards, thread_id);
 }
 
 /**
  * Called by GrIOt tracer in child processes in order to avoid counting any I/O more than once
  */
-void griot_results_reset()
+static void griot_model_results_reset()
+{
+    memset(&app_start, 0, sizeof(app_start));
+    size_t iter = 0;
+    void *shard;
+    while(griot_shard_iter(&griot_shards, &iter, &shard)){
+        memset(&((griot_shard *)shard)->results, 0, sizeof(griot_results_data));
+        griot_arena_usage_reset_high_water(&((griot_shard *)shard)->usage);
+        ((griot_shard *)shard)->model_bytes_high_water = ((griot_shard *)shard)->model_bytes;
+    }
+}
+
+/**
+ * Merge the results of the shards. The footprint and the bytes of the nodes are the sums of the highest ones of every
+ * shard.
+ *
+ * @return the number of shards
+ */
+static uint32_t griot_model_results_collect(griot_results_data *griot_results, uint64_t *highest_memory_footprint, uint64_t *highest_model_bytes)
 {
-    memset(&griot_results, 0, sizeof(griot_results));
+    memset(griot_results, 0, sizeof(griot_results_data));
+    *highest_memory_footprint = 0;
+    *highest_model_bytes = 0;
+    uint32_t shard_count = 0;
+    size_t iter = 0;
+    void *item;
+    while(griot_shard_iter(&griot_shards, &iter, &item)){
+        griot_shard *shard = item;
+        griot_results_merge(griot_results, &shard->results);
+        *highest_memory_footprint += shard->usage.used_bytes_high_water;
+        *highest_model_bytes += shard->model_bytes_high_water;
+        shard_count += 1;
+    }
+    return shard_count;
 }
 
 /**
  * Called by GrIOt tracer at the end of a process in order to print the results
  */
-void griot_results_dump(FILE *file)
+static void griot_model_results_dump(FILE *file)
 {
-    // Updating memory footprint stat
-    uint64_t memory_footprint = griot_get_memory_footprint();
-    if(memory_footprint>griot_results.highest_recorded_memory_footprint)griot_results.highest_recorded_memory_footprint=memory_footprint;
+    // Merging the shards
+    griot_results_data griot_results;
+    uint64_t highest_memory_footprint, highest_model_bytes;
+    uint32_t shard_count = griot_model_results_collect(&griot_results, &highest_memory_footprint, &highest_model_bytes);
 
     // Dumping...
     struct timespec current_time;
     clock_gettime(CLOCK_MONOTONIC, &current_time);
-    uint64_t app_duration_ns = (double)(current_time.tv_sec - griot_results.app_start.tv_sec) * 1.0e9 + (double)(current_time.tv_nsec - griot_results.app_start.tv_nsec); 
+    uint64_t app_duration_ns = (double)(current_time.tv_sec - app_start.tv_sec) * 1.0e9 + (double)(current_time.tv_nsec - app_start.tv_nsec); 
     
-    iolib_safe_fprintf(file, "context_size=%u\ncall_stack_depth=%u\ngranularity=%s\noverall_app_duration=%lu\nio_time_ns=%lu\nio_count=%lu\nio_volume=%lu\nread_volume=%lu\nwrite_volume=%lu\nmru_correct_prediction_count=%lu\n"
+    iolib_safe_fprintf(file, "context_size=%u\ncall_stack_depth=%u\ngranularity=griot-%s\noverall_app_duration=%lu\nio_time_ns=%lu\nio_count=%lu\nio_volume=%lu\nread_volume=%lu\nwrite_volume=%lu\nmru_correct_prediction_count=%lu\n"
             "mru_correct_prediction_volume=%lu\nmru_correct_prediction_io_time=%lu\nmfu_correct_prediction_count=%lu\nmfu_correct_prediction_volume=%lu\nmfu_correct_prediction_io_time=%lu\n"
-            "call_stack_instrumentation_count=%lu\ncall_stack_instrumentation_time_ns=%lu\nmodel_prediction_time_ns=%lu\nmodel_memory_footprint=%lu\n",
+            "call_stack_instrumentation_count=%lu\ncall_stack_instrumentation_time_ns=%lu\nmodel_prediction_time_ns=%lu\nmodel_memory_footprint=%lu\nthread_shards=%u\n"
+            "model_memory_budget=%lu\nmodel_node_bytes=%lu\nmodel_node_bytes_high_water=%lu\nevicted_node_count=%lu\nevicted_edge_count=%lu\ncross_shard_close_count=%lu\n",
             context_size,
             call_stack_depth,
-            MODULE_NAME,
+            griot_per_open_granularity.name,
             app_duration_ns,
             griot_results.io_time,
             griot_results.io_count,
@@ -419,10 +472,37 @@ void griot_results_dump(FILE *file)
             griot_results.call_stack_instrumentation_count,
             griot_results.call_stack_instrumentation_time,
             griot_results.model_prediction_time,
-            griot_results.highest_recorded_memory_footprint);
+            highest_memory_footprint,
+            shard_count,
+            max_model_bytes,
+            atomic_load(&model_bytes),
+            highest_model_bytes,
+            griot_results.evicted_node_count,
+            griot_results.evicted_edge_count,
+            griot_results.cross_shard_close_count);
     fflush(file);
 }
 
+/**
+ * Called by GrIOt replay when only the main figures of the results are needed, see griot_results_summarize
+ */
+static void griot_model_results_summarize(void (*on_summary)(const griot_results_summary *summary, void *arg), void *arg)
+{
+    griot_results_data griot_results;
+    uint64_t highest_memory_footprint, highest_model_bytes;
+    griot_model_results_collect(&griot_results, &highest_memory_footprint, &highest_model_bytes);
+
+    griot_results_summary summary = {.context_size=context_size, .call_stack_depth=call_stack_depth,
+        .io_count=griot_results.io_count, .io_volume=griot_results.read_volume+griot_results.write_volume,
+        .io_time=griot_results.io_time, .mru_correct_prediction_count=griot_results.mru_correct_prediction_count,
+        .mru_correct_prediction_volume=griot_results.mru_correct_prediction_volume,
+        .mfu_correct_prediction_count=griot_results.mfu_correct_prediction_count,
+        .mfu_correct_prediction_volume=griot_results.mfu_correct_prediction_volume,
+        .model_prediction_time=griot_results.model_prediction_time, .model_memory_footprint=highest_memory_footprint};
+    snprintf(summary.granularity, sizeof(summary.granularity), "griot-%s", griot_per_open_granularity.name);
+    on_summary(&summary, arg);
+}
+
 // ######################
 
 static uint64_t griot_hashmap_hash(const void *pred_data, uint64_t seed0, uint64_t seed1)
@@ -438,37 +518,110 @@ static int griot_hashmap_compare(const void *pred_data_1, const void *pred_data_
     return data_1->call_stack_hash==data_2->call_stack_hash?0:(data_1->call_stack_hash>data_2->call_stack_hash?1:-1);
 }
 
-static void griot_prediction_table_free(void *pred_data)
+static void griot_per_fd_data_free(griot_shard *shard, griot_per_fd_data *per_fd_data)
 {
-    const griot_prediction_table_map_entry *data = pred_data;
-    free(data->data->mfu_context_hash_list);
-    free(data->data->mfu_weight_list);
-    free(data->data);
+    shard->model_bytes -= per_fd_data->model_bytes;
+    atomic_fetch_sub_explicit(&model_bytes, per_fd_data->model_bytes, memory_order_relaxed);
+
+    // Unless the pool is full or the arena too large to be kept, emptying the prediction table and the context,
+    // keeping their memory
+    if(shard->model.per_fd_pool_size<GRIOT_PER_FD_POOL_SIZE && griot_arena_used_bytes(per_fd_data->arena)<=GRIOT_PER_FD_POOL_MAX_BYTES){
+        griot_node_table_clear(per_fd_data->prediction_table);
+        hashmap *prediction_table = per_fd_data->prediction_table;
+        griot_context context = per_fd_data->context;
+        griot_arena *arena = per_fd_data->arena;
+        memset(per_fd_data, 0, sizeof(griot_per_fd_data));
+        per_fd_data->prediction_table = prediction_table;
+        per_fd_data->context = context;
+        griot_context_reset(&per_fd_data->context);
+        per_fd_data->arena = arena;
+
+        // And pooling the per fd data
+        per_fd_data->next_pooled = shard->model.per_fd_pool;
+        shard->model.per_fd_pool = per_fd_data;
+        shard->model.per_fd_pool_size += 1;
+        return;
+    }
+
+    // Freeing the per fd data, its context and its prediction table at once
+    griot_arena_destroy(per_fd_data->arena);
 }
 
-static void griot_per_fd_data_free(void *pred_data)
+static void griot_results_merge(griot_results_data *into, const griot_results_data *from)
 {
-    const griot_per_fd_data_map_entry *data = pred_data;
-    hashmap_free(data->data->prediction_table);
-    free(data->data);
+    // griot_results_data only holds counters, so merging is a field by field sum
+    uint64_t *into_counters = (uint64_t *)into;
+    const uint64_t *from_counters = (const uint64_t *)from;
+    for(size_t i = 0; i<sizeof(griot_results_data)/sizeof(uint64_t); i++) into_counters[i] += from_counters[i];
 }
 
-static uint64_t griot_get_memory_footprint()
+static void *griot_shard_new()
 {
-    uint64_t size = 0;
+    griot_arena *arena = griot_arena_new();
+    griot_shard *shard = (griot_shard *)griot_arena_malloc(arena, sizeof(griot_shard));
+    memset(shard, 0, sizeof(griot_shard));
+    shard->arena = arena;
+    griot_arena_set_usage(arena, &shard->usage);
+    griot_fd_table_init(&shard->model.per_fd_data, arena);
+    return shard;
+}
 
-    // griot model
-    size += sizeof(griot_model);
+static void griot_shard_free(void *item)
+{
+    griot_shard *shard = item;
 
-    // iterating over the per fd data
+    // Files still open or pooled have their own arena, the rest of the shard is in the shard's arena
     size_t iter = 0;
-    void *item;
-    while (hashmap_iter(griot_model.per_fd_data, &iter, &item)) {
-        const griot_per_fd_data_map_entry *map_entry = item;
-        size += sizeof(griot_per_fd_data_map_entry);
-        size += sizeof(griot_per_fd_data);
-        size += (sizeof(griot_prediction_table_map_entry)+sizeof(griot_prediction_data))*hashmap_count(map_entry->data->prediction_table);
+    void *per_fd_data;
+    while(griot_fd_table_iter(&shard->model.per_fd_data, &iter, &per_fd_data)) griot_arena_destroy(((griot_per_fd_data *)per_fd_data)->arena);
+    griot_per_fd_data *pooled = shard->model.per_fd_pool;
+    while(pooled){
+        griot_per_fd_data *next = pooled->next_pooled;
+        griot_arena_destroy(pooled->arena);
+        pooled = next;
+    }
+    griot_arena_destroy(shard->arena);
+}
+
+static void griot_model_reserve(griot_shard *shard, griot_per_fd_data *per_fd_data, uint64_t bytes)
+{
+    per_fd_data->model_bytes += bytes;
+    shard->model_bytes += bytes;
+    atomic_fetch_add_explicit(&model_bytes, bytes, memory_order_relaxed);
+    uint64_t budget = griot_shard_budget(&griot_shards, max_model_bytes);
+    if(budget!=0 && shard->model_bytes>budget){
+        uint64_t released_bytes = griot_node_evict_tables(griot_model_next_table, shard, &shard->model.eviction_hand,
+            shard->model.per_fd_data.count, shard->model_bytes, shard->model_bytes-budget,
+            &shard->results.evicted_node_count, &shard->results.evicted_edge_count);
+        shard->model_bytes -= released_bytes;
+        atomic_fetch_sub_explicit(&model_bytes, released_bytes, memory_order_relaxed);
     }
+    if(shard->model_bytes>shard->model_bytes_high_water) shard->model_bytes_high_water = shard->model_bytes;
+}
 
-    return size;
-}
\ No newline at end of file
+static bool griot_model_next_table(void *shard, size_t *hand, griot_node_table_ref *table)
+{
+    void *item;
+    if(!griot_fd_table_iter(&((griot_shard *)shard)->model.per_fd_data, hand, &item)) return false;
+    griot_per_fd_data *per_fd_data = item;
+    *table = (griot_node_table_ref){.arena=per_fd_data->arena, .table=per_fd_data->prediction_table,
+        .model_bytes=&per_fd_data->model_bytes, .clock_hand=&per_fd_data->clock_hand};
+    return true;
+}
+
+/**
+ * The per-open granularity, see griot_granularity.h
+ */
+const griot_granularity griot_per_open_granularity = {
+    .name = "per-open",
+    .needs_path_hash = false,
+    .enable_thread_sharding = griot_model_enable_thread_sharding,
+    .enable_per_thread_context = NULL,
+    .set_max_model_bytes = griot_model_set_max_model_bytes,
+    .init = griot_model_init,
+    .finalize = griot_model_finalize,
+    .on_io_event = griot_model_on_io_event,
+    .results_reset = griot_model_results_reset,
+    .results_dump = griot_model_results_dump,
+    .results_summarize = griot_model_results_summarize,
+};
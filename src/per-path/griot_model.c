@@ -0,0 +1,784 @@
+#include <string.h> // memset
+#include <stdlib.h> // malloc
+#include <time.h> // clock_gettime and CLOCK_MONOTONIC
+#include <stdatomic.h>
+#include "../shared/griot_model.h"
+#include "../shared/griot_granularity.h"
+#include "../shared/hashmap.h"
+#include "../shared/backtrace.h"
+#include "../shared/log.h"
+#include "../shared/griot_shard.h"
+#include "../shared/griot_context.h"
+#include "../shared/griot_node.h"
+#include "../shared/griot_arena.h"
+#include "../shared/griot_fd_table.h"
+#include "griot_config.h"
+
+/*
+ * This file implements per-path I/O call stack prediction with GrIOt
+ *
+ * Each path has its own graph, that outlives the files opened from it.
+ * Each opened file has its own context, and uses and updates the graph of its path, so that reopening a file starts
+ * from everything learned the previous times. The path is hashed by the tracer once canonicalized, and optionally
+ * combined with the call stack of the open (see GRIOT_PATH_KEY_WITH_OPEN_CALL_STACK).
+ *
+ * We have a table<fd, file_data> used to store per file data,
+ * an hashmap<path, path_data> used to store a graph per path,
+ * a result struct, as well as a struct storing prediction and previous node pred_data.
+ *
+ * When thread sharding is enabled, every thread gets its own copy of all of the above (a shard), so that
+ * on_io can run concurrently without any lock. Shards are only merged when dumping the results.
+ *
+ * Every path gets its own arena, holding its path_data and prediction table, so that dropping it just drops the arena.
+ * The rest of a shard, files included, lives in the shard's arena.
+ *
+ * Paths with no open file are kept in least recently closed order. Past GRIOT_MAX_PATH_GRAPHS paths, or when a shard
+ * exceeds its share of the memory budget (see griot_shard_budget), the graphs of its least recently closed paths are
+ * dropped first. If only open paths are left, a file that needs room for a new node evicts nodes from the largest
+ * graphs of the open paths, its own or not (see griot_node_evict_tables).
+ */
+
+/*****************************
+ * GrIOt main data structures
+ */
+
+typedef struct
+{
+    uint64_t io_count;
+
+    uint64_t io_time;
+
+    uint64_t read_volume;
+    uint64_t write_volume;
+    uint64_t total_volume;
+
+    uint64_t mru_correct_prediction_count;
+    uint64_t mru_correct_prediction_volume;
+    uint64_t mru_correct_prediction_io_time;
+
+    uint64_t mfu_correct_prediction_count;
+    uint64_t mfu_correct_prediction_volume;
+    uint64_t mfu_correct_prediction_io_time;
+
+    uint64_t call_stack_instrumentation_count;
+    uint64_t call_stack_instrumentation_time;
+    uint64_t model_prediction_time;
+
+    uint64_t evicted_node_count;
+    uint64_t evicted_edge_count;
+
+    // Opens that found the graph of their path kept after its files were all closed, opens of an unknown path, and
+    // path graphs dropped
+    uint64_t reopened_path_count;
+    uint64_t unknown_path_open_count;
+    uint64_t evicted_path_count;
+
+    // Files closed by another thread than the one that opened them, see griot_shard_fd_close
+    uint64_t cross_shard_close_count;
+} griot_results_data;
+
+typedef struct
+{
+    // Has one griot_per_fd_data per open file, indexed by fd
+    griot_fd_table per_fd_data;
+
+    // Has one griot_path_data per path
+    hashmap *path_table;
+    uint64_t path_count;
+
+    // Paths with no open file, least recently closed first
+    struct griot_path_data *closed_paths_head;
+    struct griot_path_data *closed_paths_tail;
+
+    // The fd whose path graph is the next one to evict nodes from
+    size_t eviction_hand;
+} griot_model_data;
+
+/**********************************
+ * GrIOt secondary data structures
+ */
+
+typedef struct griot_path_data
+{
+    uint64_t path_key;
+
+    // The path's prediction data
+    hashmap *prediction_table;
+
+    // Bytes used by the nodes of the prediction table, and position of the eviction hand in it
+    uint64_t model_bytes;
+    uint64_t clock_hand;
+
+    // Number of files open from this path. When 0, the path is in the closed paths list.
+    uint32_t open_count;
+
+    // The path of the file is unknown: the graph is its own, out of the path table, and dropped on close
+    bool unknown;
+    struct griot_path_data *prev_closed;
+    struct griot_path_data *next_closed;
+
+    // Where everything above is allocated
+    griot_arena *arena;
+} griot_path_data;
+
+typedef struct
+{
+    uint64_t path_key;
+    griot_path_data *path_data;
+} griot_path_table_map_entry;
+
+typedef struct
+{
+    // The graph of the file's path
+    griot_path_data *path_data;
+
+    // The file's current context
+    griot_context context;
+
+    // When an I/O arrive, the next I/O is predicted here
+    uint64_t mru_prediction;
+    uint64_t mfu_prediction;
+
+    // Fallback heuristic
+    uint64_t previous_call_stack;
+
+    // The prediction data of the previous I/O is kept from one I/O to another so it can be updated
+    griot_node_handle previous_pred_data;
+} griot_per_fd_data;
+
+/**********************************
+ * GrIOt shards
+ */
+
+typedef struct
+{
+    griot_results_data results;
+    griot_model_data model;
+
+    // Bytes used by the nodes of the path graphs of the shard, and the most they reached since the last reset
+    uint64_t model_bytes;
+    uint64_t model_bytes_high_water;
+
+    // The shard is allocated from its arena. It and the arenas of the paths report their blocks to usage.
+    griot_arena *arena;
+    griot_arena_usage usage;
+} griot_shard;
+
+static griot_shard_registry griot_shards;
+static bool thread_sharded = false;
+static struct timespec app_start;
+
+static void griot_results_merge(griot_results_data *into, const griot_results_data *from);
+static void *griot_shard_new();
+static void griot_shard_free(void *shard);
+
+// And the hashmap functions associated with the above...
+static uint64_t griot_hashmap_hash(const void *pred_data, uint64_t seed0, uint64_t seed1);
+static int griot_hashmap_compare(const void *pred_data_1, const void *pred_data_2, void *udata);
+static uint64_t griot_path_hashmap_hash(const void *path_data, uint64_t seed0, uint64_t seed1);
+static int griot_path_hashmap_compare(const void *path_data_1, const void *path_data_2, void *udata);
+static void griot_per_fd_data_free(griot_shard *shard, griot_per_fd_data *per_fd_data);
+
+/**
+ * Find the graph of a path, creating it if needed, and count one more file open from it. A file whose path is unknown
+ * gets a graph of its own, like with per-open.
+ */
+static griot_path_data *griot_path_open(griot_shard *shard, uint64_t path_key, bool unknown);
+
+/**
+ * Count one less file open from a path. The path joins the closed paths once its last file is closed.
+ */
+static void griot_path_close(griot_shard *shard, griot_path_data *path_data);
+
+/**
+ * Drop the graph of a closed path
+ */
+static void griot_path_evict(griot_shard *shard, griot_path_data *path_data);
+
+/**
+ * Free a graph and its nodes
+ */
+static void griot_path_free(griot_shard *shard, griot_path_data *path_data);
+
+/**
+ * Account for bytes newly used by the nodes of a path, evicting closed paths, then nodes, if the budget is exceeded
+ */
+static void griot_model_reserve(griot_shard *shard, griot_path_data *path_data, uint64_t bytes);
+
+/**
+ * Bring the bytes used by the nodes of the shard back under budget
+ */
+static void griot_model_evict(griot_shard *shard, uint64_t budget);
+
+/**
+ * Enumerate the graphs of the open files of a shard, see griot_node_evict_tables
+ */
+static bool griot_model_next_table(void *shard, size_t *hand, griot_node_table_ref *table);
+
+/***********************
+ * GrIOt implementation
+ */
+
+static uint32_t context_size;
+static uint32_t call_stack_depth;
+
+// Memory budget of the nodes of all the paths (0 if unlimited), and the bytes they currently use
+static uint64_t max_model_bytes = 0;
+static _Atomic uint64_t model_bytes;
+
+/**
+ * Called by GrIOt tracer before griot_init when thread sharding is requested
+ */
+static void griot_model_enable_thread_sharding()
+{
+    thread_sharded = true;
+}
+
+/**
+ * Called by GrIOt tracer before griot_init when a memory budget is requested
+ */
+static void griot_model_set_max_model_bytes(uint64_t bytes)
+{
+    max_model_bytes = bytes!=0 && bytes<GRIOT_MIN_MODEL_BYTES ? GRIOT_MIN_MODEL_BYTES : bytes;
+}
+
+/**
+ * Called by GrIOt tracer when a process is created
+ * This function should init all primary data structures
+ */
+static void griot_model_init(uint32_t griot_context_size, uint32_t griot_call_stack_depth)
+{
+    clock_gettime(CLOCK_MONOTONIC, &app_start);
+
+    // Saving context size for future use
+    context_size = griot_context_size;
+    call_stack_depth = griot_call_stack_depth;
+
+    // Init the shards, each with its own griot_results and griot_model
+    griot_shard_registry_init(&griot_shards, thread_sharded, griot_shard_new);
+}
+
+/**
+ * Called by GrIOt tracer when a process is finished, just after printing the results
+ */
+static void griot_model_finalize()
+{
+    // Free the shards, and the griot model hash maps they hold
+    griot_shard_registry_free(&griot_shards, griot_shard_free);
+    atomic_store(&model_bytes, 0);
+}
+
+/**
+ * Called when a file is opened. per_fd_data (context, etc) should be initialized here, and attached to the graph of
+ * the file's path. If the path is new, its graph starts empty.
+ */
+static griot_per_fd_data *on_open(griot_shard *shard, uint64_t timestamp, int32_t thread_id, int fd, uint64_t path_hash, uint64_t call_stack)
+{
+    // The graph is keyed by the path, and optionally by the call stack of the open
+    uint64_t path_key = path_hash;
+    if(GRIOT_PATH_KEY_WITH_OPEN_CALL_STACK){
+        uint64_t key[2] = {path_hash, call_stack};
+        path_key = MurmurHash64A(key, sizeof(key), GRIOT_SEED);
+    }
+
+    // Let's create a new per_fd_data
+    griot_per_fd_data *per_fd_data = (griot_per_fd_data *)griot_arena_malloc(shard->arena, sizeof(griot_per_fd_data));
+
+    // Filling it with zeros
+    memset(per_fd_data, 0, sizeof(griot_per_fd_data));
+
+    // Setting up the context
+    griot_context_init(&per_fd_data->context, context_size, shard->arena);
+
+    // Attaching it to the graph of its path
+    per_fd_data->path_data = griot_path_open(shard, path_key, path_hash==0);
+
+    // Placing the new per_fd_data in the fd table. If the fd was already there, its close was missed (e.g. dup2)
+    griot_per_fd_data *previous_per_fd_data = griot_fd_table_set(&shard->model.per_fd_data, fd, per_fd_data);
+    if(previous_per_fd_data!=NULL) griot_per_fd_data_free(shard, previous_per_fd_data);
+    return per_fd_data;
+}
+
+/**
+ * Called when a file is closed. per_fd_data should be freed here. The graph of its path is kept.
+ */
+static void on_close(griot_shard *shard, uint64_t timestamp, int32_t thread_id, int fd)
+{
+    // The per fd data of a fd opened by another thread is in another shard, out of reach
+    if(griot_shard_fd_close(&griot_shards, thread_id, fd)) shard->results.cross_shard_close_count += 1;
+
+    // Getting the per fd data, and removing it from the fd table
+    griot_per_fd_data *per_fd_data = griot_fd_table_remove(&shard->model.per_fd_data, fd);
+
+    // If it's null, the file was opened and used out of the scope of GrIOt. We can just return
+    if(per_fd_data==NULL)
+    {
+        #ifdef GRIOT_DEBUG
+        WARN("File descriptor %d was created out of the scope of GrIOt and never used until now. Strange.", fd);
+        #endif
+        return;
+    }
+
+    griot_per_fd_data_free(shard, per_fd_data);
+}
+
+/**
+ * Called by GrIOt tracer when an I/O is intercepted, once its call stack is known
+ */
+static void griot_model_on_io_event(const griot_io_event *event, FILE *optional_debug_file)
+{
+    uint64_t timestamp = event->timestamp;
+    int32_t thread_id = event->thread_id;
+    int fd = event->fd;
+    size_t length = event->length;
+    uint64_t duration_ns = event->duration_ns;
+    op_type op_type = event->op_type;
+
+    // I/Os without a file descriptor cannot be attached to a file
+    if(fd<0) return;
+
+    // Every piece of state touched below belongs to the calling thread's shard
+    griot_shard *shard = griot_shard_acquire(&griot_shards, thread_id);
+    griot_results_data *griot_results = &shard->results;
+    griot_model_data *griot_model = &shard->model;
+
+    // (0) Ignore open/close. Only reads and writes are predicted.
+    if(op_type==GRIOT_OPEN){
+        on_open(shard, timestamp, thread_id, fd, event->path_hash, event->call_stack);
+        griot_shard_fd_open(&griot_shards, thread_id, fd);
+    }
+    //if(op_type==GRIOT_CLOSE) on_close(shard, timestamp, thread_id, fd);
+    //if(op_type!=GRIOT_READ && op_type!=GRIOT_WRITE) return;
+
+    // (0) Get the call stack. It was computed by the caller.
+    struct timespec t0, t1;
+    long dt_ns;
+    uint64_t call_stack = event->call_stack;
+    griot_results->call_stack_instrumentation_count += 1;
+    griot_results->call_stack_instrumentation_time += event->call_stack_time_ns;
+
+    // (1) Update the stats, see GRIOT_PREDICTION_TIME_SAMPLING for the timer
+    bool timed = griot_results->io_count%GRIOT_PREDICTION_TIME_SAMPLING==0;
+    if(timed) clock_gettime(CLOCK_MONOTONIC, &t0);
+    griot_results->io_count+=1;
+    griot_results->io_time += duration_ns;
+    griot_results->total_volume += length;
+    if(op_type==GRIOT_READ) griot_results->read_volume += length;
+    else if(op_type==GRIOT_WRITE) griot_results->write_volume += length;
+
+    // (2) Get the per fd data. Files whose open was missed have an unknown path.
+    griot_per_fd_data *per_fd_data = griot_fd_table_get(&griot_model->per_fd_data, fd);
+    if(per_fd_data==NULL){
+        #ifdef GRIOT_DEBUG
+        ERROR("Intercepting an I/O to fd=%d we have never heard of before. It's either a fd inherited from a fork"
+            ", or the application is using dup or similar.\n", fd);
+        #endif
+        per_fd_data = on_open(shard, timestamp, thread_id, fd, 0, 0);
+    }
+    griot_path_data *path_data = per_fd_data->path_data;
+
+    // (3) Compute the new context
+    griot_context_push(&per_fd_data->context, call_stack);
+
+    // (?) Debug
+    #ifdef GRIOT_DEBUG_VERBOSE
+    INFO("New context hash: %lu, predicted: %lu\n", per_fd_data->context.context_hash%0xFFFFFF, per_fd_data->mru_prediction%0xFFFFFF);
+    #endif
+
+    // (4) Check if the previously made prediction was right. If it was, increment the stats again
+    if(per_fd_data->mru_prediction == per_fd_data->context.context_hash || (per_fd_data->mru_prediction == 0 && per_fd_data->previous_call_stack == call_stack)){
+        griot_results->mru_correct_prediction_count+=1;
+        griot_results->mru_correct_prediction_volume+=length;
+        griot_results->mru_correct_prediction_io_time+=duration_ns;
+    }
+    if(per_fd_data->mfu_prediction == per_fd_data->context.context_hash || (per_fd_data->mfu_prediction == 0 && per_fd_data->previous_call_stack == call_stack)){
+        griot_results->mfu_correct_prediction_count+=1;
+        griot_results->mfu_correct_prediction_volume+=length;
+        griot_results->mfu_correct_prediction_io_time+=duration_ns;
+    }
+
+    // (5) Update the information of the previous node
+    griot_prediction_data *previous_pred_data = griot_node_handle_get(path_data->prediction_table, &per_fd_data->previous_pred_data);
+    if(previous_pred_data!=NULL)
+    {
+        uint64_t grown_bytes = griot_node_add_successor(path_data->arena, previous_pred_data, per_fd_data->context.context_hash);
+        if(grown_bytes) griot_model_reserve(shard, path_data, grown_bytes);
+    }
+
+    // (6) Make a new prediction using the prediction table, eventually creating an entry for the new context value
+    griot_prediction_data *pred_data;
+    {
+        const griot_prediction_table_map_entry *map_entry = hashmap_get(path_data->prediction_table, &(griot_prediction_table_map_entry){.call_stack_hash=per_fd_data->context.context_hash});
+        if(map_entry==NULL){
+            // If there is no map entry for this context, let's create it. We make our prediction using our default heuristic.
+            griot_model_reserve(shard, path_data, GRIOT_NODE_BUCKET_BYTES);
+            griot_prediction_table_map_entry new_map_entry = {.call_stack_hash=per_fd_data->context.context_hash};
+            griot_node_init(&new_map_entry.data);
+            griot_arena_hashmap_set(path_data->arena, path_data->prediction_table, &new_map_entry);
+            pred_data = (griot_prediction_data *)&((const griot_prediction_table_map_entry *)hashmap_get(path_data->prediction_table, &new_map_entry))->data;
+            pred_data->mru_context_hash = per_fd_data->context.context_hash;
+        }else{
+            // If there is a map entry already, making our prediction is easy.
+            pred_data = (griot_prediction_data *)&map_entry->data;
+        }
+        pred_data->referenced = 1;
+    }
+
+    // MRU
+    per_fd_data->mru_prediction=pred_data->mru_context_hash;
+
+    // MFU
+    per_fd_data->mfu_prediction = griot_node_mfu_prediction(pred_data);
+
+    // Fallback heuristic
+    per_fd_data->previous_call_stack = call_stack;
+
+    // (7) Setting the new "previous pred data"
+    per_fd_data->previous_pred_data = griot_node_handle_new(path_data->prediction_table, per_fd_data->context.context_hash, pred_data);
+
+    // (8) Updating timers
+    if(timed){
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        griot_results->model_prediction_time += dt_ns*GRIOT_PREDICTION_TIME_SAMPLING;
+    }
+
+    // (9) ...
+    if(op_type==GRIOT_CLOSE) on_close(shard, timestamp, thread_id, fd);
+
+    griot_shard_release(&griot_shards, thread_id);
+}
+
+/**
+ * Called by GrIOt tracer in child processes in order to avoid counting any I/O more than once
+ */
+static void griot_model_results_reset()
+{
+    memset(&app_start, 0, sizeof(app_start));
+    size_t iter = 0;
+    void *shard;
+    while(griot_shard_iter(&griot_shards, &iter, &shard)){
+        memset(&((griot_shard *)shard)->results, 0, sizeof(griot_results_data));
+        griot_arena_usage_reset_high_water(&((griot_shard *)shard)->usage);
+        ((griot_shard *)shard)->model_bytes_high_water = ((griot_shard *)shard)->model_bytes;
+    }
+}
+
+/**
+ * Merge the results of the shards. The footprint and the bytes of the nodes are the sums of the highest ones of every
+ * shard.
+ *
+ * @return the number of shards
+ */
+static uint32_t griot_model_results_collect(griot_results_data *griot_results, uint64_t *highest_memory_footprint, uint64_t *highest_model_bytes, uint64_t *path_count)
+{
+    memset(griot_results, 0, sizeof(griot_results_data));
+    *highest_memory_footprint = 0;
+    *highest_model_bytes = 0;
+    *path_count = 0;
+    uint32_t shard_count = 0;
+    size_t iter = 0;
+    void *item;
+    while(griot_shard_iter(&griot_shards, &iter, &item)){
+        griot_shard *shard = item;
+        griot_results_merge(griot_results, &shard->results);
+        *highest_memory_footprint += shard->usage.used_bytes_high_water;
+        *highest_model_bytes += shard->model_bytes_high_water;
+        *path_count += shard->model.path_count;
+        shard_count += 1;
+    }
+    return shard_count;
+}
+
+/**
+ * Called by GrIOt tracer at the end of a process in order to print the results
+ */
+static void griot_model_results_dump(FILE *file)
+{
+    // Merging the shards
+    griot_results_data griot_results;
+    uint64_t highest_memory_footprint, highest_model_bytes;
+    uint64_t path_count;
+    uint32_t shard_count = griot_model_results_collect(&griot_results, &highest_memory_footprint, &highest_model_bytes, &path_count);
+
+    // Dumping...
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
+    uint64_t app_duration_ns = (double)(current_time.tv_sec - app_start.tv_sec) * 1.0e9 + (double)(current_time.tv_nsec - app_start.tv_nsec);
+
+    iolib_safe_fprintf(file, "context_size=%u\ncall_stack_depth=%u\ngranularity=griot-%s\noverall_app_duration=%lu\nio_time_ns=%lu\nio_count=%lu\nio_volume=%lu\nread_volume=%lu\nwrite_volume=%lu\nmru_correct_prediction_count=%lu\n"
+            "mru_correct_prediction_volume=%lu\nmru_correct_prediction_io_time=%lu\nmfu_correct_prediction_count=%lu\nmfu_correct_prediction_volume=%lu\nmfu_correct_prediction_io_time=%lu\n"
+            "call_stack_instrumentation_count=%lu\ncall_stack_instrumentation_time_ns=%lu\nmodel_prediction_time_ns=%lu\nmodel_memory_footprint=%lu\nthread_shards=%u\n"
+            "model_memory_budget=%lu\nmodel_node_bytes=%lu\nmodel_node_bytes_high_water=%lu\nevicted_node_count=%lu\nevicted_edge_count=%lu\n"
+            "path_graph_count=%lu\nreopened_path_count=%lu\nunknown_path_open_count=%lu\nevicted_path_count=%lu\ncross_shard_close_count=%lu\n",
+            context_size,
+            call_stack_depth,
+            griot_per_path_granularity.name,
+            app_duration_ns,
+            griot_results.io_time,
+            griot_results.io_count,
+            griot_results.read_volume+griot_results.write_volume,
+            griot_results.read_volume,
+            griot_results.write_volume,
+            griot_results.mru_correct_prediction_count,
+            griot_results.mru_correct_prediction_volume,
+            griot_results.mru_correct_prediction_io_time,
+            griot_results.mfu_correct_prediction_count,
+            griot_results.mfu_correct_prediction_volume,
+            griot_results.mfu_correct_prediction_io_time,
+            griot_results.call_stack_instrumentation_count,
+            griot_results.call_stack_instrumentation_time,
+            griot_results.model_prediction_time,
+            highest_memory_footprint,
+            shard_count,
+            max_model_bytes,
+            atomic_load(&model_bytes),
+            highest_model_bytes,
+            griot_results.evicted_node_count,
+            griot_results.evicted_edge_count,
+            path_count,
+            griot_results.reopened_path_count,
+            griot_results.unknown_path_open_count,
+            griot_results.evicted_path_count,
+            griot_results.cross_shard_close_count);
+    fflush(file);
+}
+
+/**
+ * Called by GrIOt replay when only the main figures of the results are needed, see griot_results_summarize
+ */
+static void griot_model_results_summarize(void (*on_summary)(const griot_results_summary *summary, void *arg), void *arg)
+{
+    griot_results_data griot_results;
+    uint64_t highest_memory_footprint, highest_model_bytes;
+    uint64_t path_count;
+    griot_model_results_collect(&griot_results, &highest_memory_footprint, &highest_model_bytes, &path_count);
+
+    griot_results_summary summary = {.context_size=context_size, .call_stack_depth=call_stack_depth,
+        .io_count=griot_results.io_count, .io_volume=griot_results.read_volume+griot_results.write_volume,
+        .io_time=griot_results.io_time, .mru_correct_prediction_count=griot_results.mru_correct_prediction_count,
+        .mru_correct_prediction_volume=griot_results.mru_correct_prediction_volume,
+        .mfu_correct_prediction_count=griot_results.mfu_correct_prediction_count,
+        .mfu_correct_prediction_volume=griot_results.mfu_correct_prediction_volume,
+        .model_prediction_time=griot_results.model_prediction_time, .model_memory_footprint=highest_memory_footprint};
+    snprintf(summary.granularity, sizeof(summary.granularity), "griot-%s", griot_per_path_granularity.name);
+    on_summary(&summary, arg);
+}
+
+// ######################
+
+static uint64_t griot_hashmap_hash(const void *pred_data, uint64_t seed0, uint64_t seed1)
+{
+    const griot_prediction_table_map_entry *data = pred_data;
+    return data->call_stack_hash;
+}
+
+static int griot_hashmap_compare(const void *pred_data_1, const void *pred_data_2, void *udata)
+{
+    const griot_prediction_table_map_entry *data_1 = pred_data_1;
+    const griot_prediction_table_map_entry *data_2 = pred_data_2;
+    return data_1->call_stack_hash==data_2->call_stack_hash?0:(data_1->call_stack_hash>data_2->call_stack_hash?1:-1);
+}
+
+static uint64_t griot_path_hashmap_hash(const void *path_data, uint64_t seed0, uint64_t seed1)
+{
+    const griot_path_table_map_entry *data = path_data;
+    return data->path_key;
+}
+
+static int griot_path_hashmap_compare(const void *path_data_1, const void *path_data_2, void *udata)
+{
+    const griot_path_table_map_entry *data_1 = path_data_1;
+    const griot_path_table_map_entry *data_2 = path_data_2;
+    return data_1->path_key==data_2->path_key?0:(data_1->path_key>data_2->path_key?1:-1);
+}
+
+static void griot_per_fd_data_free(griot_shard *shard, griot_per_fd_data *per_fd_data)
+{
+    griot_path_close(shard, per_fd_data->path_data);
+    griot_context_free(&per_fd_data->context);
+    griot_arena_free(per_fd_data);
+}
+
+static griot_path_data *griot_path_open(griot_shard *shard, uint64_t path_key, bool unknown)
+{
+    griot_model_data *griot_model = &shard->model;
+    const griot_path_table_map_entry *map_entry = unknown ? NULL : hashmap_get(griot_model->path_table, &(griot_path_table_map_entry){.path_key=path_key});
+    griot_path_data *path_data;
+    if(map_entry!=NULL){
+        // The path is known. If no file is open from it, it leaves the closed paths.
+        path_data = map_entry->path_data;
+        if(path_data->open_count==0){
+            shard->results.reopened_path_count += 1;
+            if(path_data->prev_closed) path_data->prev_closed->next_closed = path_data->next_closed;
+            else griot_model->closed_paths_head = path_data->next_closed;
+            if(path_data->next_closed) path_data->next_closed->prev_closed = path_data->prev_closed;
+            else griot_model->closed_paths_tail = path_data->prev_closed;
+            path_data->prev_closed = NULL;
+            path_data->next_closed = NULL;
+        }
+    }else{
+        // The path is new or unknown. Making room for it if needed...
+        if(!unknown && griot_model->path_count>=GRIOT_MAX_PATH_GRAPHS && griot_model->closed_paths_head!=NULL){
+            griot_path_evict(shard, griot_model->closed_paths_head);
+        }
+
+        // ... and creating its graph, in its own arena
+        griot_arena *arena = griot_arena_new();
+        griot_arena_set_usage(arena, &shard->usage);
+        path_data = (griot_path_data *)griot_arena_malloc(arena, sizeof(griot_path_data));
+        memset(path_data, 0, sizeof(griot_path_data));
+        path_data->path_key = path_key;
+        path_data->arena = arena;
+        path_data->prediction_table = griot_arena_hashmap_new(arena, sizeof(griot_prediction_table_map_entry), griot_hashmap_hash,
+            griot_hashmap_compare, NULL);
+        path_data->unknown = unknown;
+        if(unknown){
+            shard->results.unknown_path_open_count += 1;
+        }else{
+            griot_arena_hashmap_set(shard->arena, griot_model->path_table, &(griot_path_table_map_entry){.path_key=path_key, .path_data=path_data});
+            griot_model->path_count += 1;
+        }
+    }
+    path_data->open_count += 1;
+    return path_data;
+}
+
+static void griot_path_close(griot_shard *shard, griot_path_data *path_data)
+{
+    path_data->open_count -= 1;
+    if(path_data->open_count>0) return;
+
+    // The graph of an unknown path cannot be found again
+    if(path_data->unknown){
+        griot_path_free(shard, path_data);
+        return;
+    }
+
+    // Appending the path to the closed paths, it's the most recently closed one
+    griot_model_data *griot_model = &shard->model;
+    path_data->prev_closed = griot_model->closed_paths_tail;
+    path_data->next_closed = NULL;
+    if(griot_model->closed_paths_tail) griot_model->closed_paths_tail->next_closed = path_data;
+    else griot_model->closed_paths_head = path_data;
+    griot_model->closed_paths_tail = path_data;
+}
+
+static void griot_path_evict(griot_shard *shard, griot_path_data *path_data)
+{
+    // Removing the path from the closed paths and from the path table
+    griot_model_data *griot_model = &shard->model;
+    if(path_data->prev_closed) path_data->prev_closed->next_closed = path_data->next_closed;
+    else griot_model->closed_paths_head = path_data->next_closed;
+    if(path_data->next_closed) path_data->next_closed->prev_closed = path_data->prev_closed;
+    else griot_model->closed_paths_tail = path_data->prev_closed;
+    griot_arena_hashmap_delete(shard->arena, griot_model->path_table, &(griot_path_table_map_entry){.path_key=path_data->path_key});
+    griot_model->path_count -= 1;
+
+    // Freeing the path data and its prediction table at once
+    shard->results.evicted_path_count += 1;
+    size_t iter = 0;
+    void *map_entry;
+    while(hashmap_iter(path_data->prediction_table, &iter, &map_entry)){
+        shard->results.evicted_node_count += 1;
+        shard->results.evicted_edge_count += ((griot_prediction_table_map_entry *)map_entry)->data.edge_count;
+    }
+    griot_path_free(shard, path_data);
+}
+
+static void griot_path_free(griot_shard *shard, griot_path_data *path_data)
+{
+    shard->model_bytes -= path_data->model_bytes;
+    atomic_fetch_sub_explicit(&model_bytes, path_data->model_bytes, memory_order_relaxed);
+    griot_arena_destroy(path_data->arena);
+}
+
+static void griot_results_merge(griot_results_data *into, const griot_results_data *from)
+{
+    // griot_results_data only holds counters, so merging is a field by field sum
+    uint64_t *into_counters = (uint64_t *)into;
+    const uint64_t *from_counters = (const uint64_t *)from;
+    for(size_t i = 0; i<sizeof(griot_results_data)/sizeof(uint64_t); i++) into_counters[i] += from_counters[i];
+}
+
+static void *griot_shard_new()
+{
+    griot_arena *arena = griot_arena_new();
+    griot_shard *shard = (griot_shard *)griot_arena_malloc(arena, sizeof(griot_shard));
+    memset(shard, 0, sizeof(griot_shard));
+    shard->arena = arena;
+    griot_arena_set_usage(arena, &shard->usage);
+    griot_fd_table_init(&shard->model.per_fd_data, arena);
+    shard->model.path_table = griot_arena_hashmap_new(arena, sizeof(griot_path_table_map_entry), griot_path_hashmap_hash,
+        griot_path_hashmap_compare, NULL);
+    return shard;
+}
+
+static void griot_shard_free(void *item)
+{
+    griot_shard *shard = item;
+
+    // Paths have their own arena, the rest of the shard (files included) is in the shard's arena. The unknown paths
+    // are only reachable from their open file.
+    size_t iter = 0;
+    void *map_entry;
+    while(hashmap_iter(shard->model.path_table, &iter, &map_entry)) griot_arena_destroy(((griot_path_table_map_entry *)map_entry)->path_data->arena);
+    iter = 0;
+    void *per_fd_data;
+    while(griot_fd_table_iter(&shard->model.per_fd_data, &iter, &per_fd_data)){
+        griot_path_data *path_data = ((griot_per_fd_data *)per_fd_data)->path_data;
+        if(path_data->unknown) griot_arena_destroy(path_data->arena);
+    }
+    griot_arena_destroy(shard->arena);
+}
+
+static void griot_model_reserve(griot_shard *shard, griot_path_data *path_data, uint64_t bytes)
+{
+    path_data->model_bytes += bytes;
+    shard->model_bytes += bytes;
+    atomic_fetch_add_explicit(&model_bytes, bytes, memory_order_relaxed);
+    uint64_t budget = griot_shard_budget(&griot_shards, max_model_bytes);
+    if(budget!=0 && shard->model_bytes>budget) griot_model_evict(shard, budget);
+    if(shard->model_bytes>shard->model_bytes_high_water) shard->model_bytes_high_water = shard->model_bytes;
+}
+
+static void griot_model_evict(griot_shard *shard, uint64_t budget)
+{
+    // Dropping the least recently closed paths first. path_data has an open file, so it is not one of them.
+    while(shard->model_bytes>budget && shard->model.closed_paths_head!=NULL) griot_path_evict(shard, shard->model.closed_paths_head);
+    if(shard->model_bytes<=budget) return;
+
+    // Then nodes of the open paths. A path open several times is seen once per file.
+    uint64_t released_bytes = griot_node_evict_tables(griot_model_next_table, shard, &shard->model.eviction_hand,
+        shard->model.per_fd_data.count, shard->model_bytes, shard->model_bytes-budget,
+        &shard->results.evicted_node_count, &shard->results.evicted_edge_count);
+    shard->model_bytes -= released_bytes;
+    atomic_fetch_sub_explicit(&model_bytes, released_bytes, memory_order_relaxed);
+}
+
+static bool griot_model_next_table(void *shard, size_t *hand, griot_node_table_ref *table)
+{
+    void *item;
+    if(!griot_fd_table_iter(&((griot_shard *)shard)->model.per_fd_data, hand, &item)) return false;
+    griot_path_data *path_data = ((griot_per_fd_data *)item)->path_data;
+    *table = (griot_node_table_ref){.arena=path_data->arena, .table=path_data->prediction_table,
+        .model_bytes=&path_data->model_bytes, .clock_hand=&path_data->clock_hand};
+    return true;
+}
+
+/**
+ * The per-path granularity, see griot_granularity.h
+ */
+const griot_granularity griot_per_path_granularity = {
+    .name = "per-path",
+    .needs_path_hash = true,
+    .enable_thread_sharding = griot_model_enable_thread_sharding,
+    .enable_per_thread_context = NULL,
+    .set_max_model_bytes = griot_model_set_max_model_bytes,
+    .init = griot_model_init,
+    .finalize = griot_model_finalize,
+    .on_io_event = griot_model_on_io_event,
+    .results_reset = griot_model_results_reset,
+    .results_dump = griot_model_results_dump,
+    .results_summarize = griot_model_results_summarize,
+};
@@ -1,23 +1,46 @@
 #include <string.h> // memset
 #include <stdlib.h> // malloc
 #include <time.h> // clock_gettime and CLOCK_MONOTONIC
+#include <stdatomic.h>
 #include "../shared/griot_model.h"
+#include "../shared/griot_granularity.h"
 #include "../shared/hashmap.h"
 #include "../shared/backtrace.h"
 #include "../shared/log.h"
+#include "../shared/griot_shard.h"
+#include "../shared/griot_context.h"
+#include "../shared/griot_node.h"
+#include "../shared/griot_arena.h"
+#include "../shared/griot_fd_table.h"
 #include "griot_config.h"
 
 /*
  * This file implements per-process I/O call stack prediction with GrIOt
  * We have a single hashmap<context, pred_data>, a result struct, as well as a struct storing
  * prediction and previous node pred_data.
+ *
+ * When thread sharding is enabled, every thread gets its own copy of all of the above (a shard), so that
+ * on_io can run concurrently without any lock. Shards are only merged when dumping the results.
+ *
+ * With per-thread contexts, every thread pushes its call stacks into its own context window, and keeps its own
+ * predictions and previous node, but every thread still feeds the same hashmap<context, pred_data>. Interleaved
+ * threads then stop creating contexts that mix the call stacks of several threads.
+ *
+ * In sweep mode, several context sizes are evaluated at once. Every stream of I/Os keeps a single history of call
+ * stacks, as long as the largest context size, and one context window per size over it. Each size has its own
+ * hashmap<context, pred_data> and results, and is dumped as if it had been evaluated alone.
+ *
+ * The prediction table of each context size is allocated from its own arena, so that its footprint is known. The rest
+ * of a shard is allocated from the shard's arena. Everything is released at once with them.
+ *
+ * With a memory budget, every shard gets an even share of it (see griot_shard_budget), and a shard that needs room for
+ * a new node evicts nodes of its own prediction table (see griot_node_evict). Each context size has its own budget.
  */
 
-struct
+typedef struct
 {
     uint64_t io_count;
 
-    struct timespec app_start;
     uint64_t io_time;
 
     uint64_t read_volume;
@@ -35,269 +58,413 @@ struct
     uint64_t call_stack_instrumentation_count;
     uint64_t call_stack_instrumentation_time;
     uint64_t model_prediction_time;
-} griot_results;
 
+    uint64_t evicted_node_count;
+    uint64_t evicted_edge_count;
+} griot_results_data;
+
+/**
+ * Context window and predictions of a stream of I/Os, for a single context size
+ */
 typedef struct
 {
-    // The context hash of the most recent next I/O
-    uint64_t mru_context_hash;
+    griot_context_window window;
+
+    // When an I/O arrive, the next I/O is predicted here
+    uint64_t mru_prediction;
+    uint64_t mfu_prediction;
 
-    // one weight per outgoing edge. Used for MFU.
-    uint64_t *mfu_context_hash_list;
-    uint64_t *mfu_weight_list;
-    uint64_t mfu_lists_length;
-} griot_prediction_data;
+    // The prediction data of the previous I/O is kept from one I/O to another so it can be updated
+    griot_node_handle previous_pred_data;
+} griot_window_data;
 
-struct
+/**
+ * A stream of I/Os: every I/O of the process, or of a single thread
+ */
+typedef struct
 {
-    // Host every prediction data
-    hashmap *prediction_table;
+    // The last call stacks, as many as the largest context size
+    griot_context history;
 
     // Used in the fallback heuristic
     uint64_t previous_call_stack;
 
-    // When an I/O arrive, the next I/O is predicted here
-    uint64_t mru_prediction;
-    uint64_t mfu_prediction;
+    // One window per context size
+    griot_window_data windows[];
+} griot_thread_data;
 
-    // The prediction data of the previous I/O is kept from one I/O to another so it can be updated
-    griot_prediction_data *previous_pred_data;
-} griot_model;
+/**
+ * Everything learned for a single context size
+ */
+typedef struct
+{
+    griot_results_data results;
+
+    // Host every prediction data
+    hashmap *prediction_table;
+
+    // Bytes used by the nodes of the prediction table, and position of the eviction hand in it
+    uint64_t model_bytes;
+    uint64_t clock_hand;
+
+    // The prediction table is allocated from the arena, that reports its blocks to usage
+    griot_arena *arena;
+    griot_arena_usage usage;
+} griot_graph_data;
+
+typedef struct
+{
+    // Without per-thread contexts, the single stream of I/Os
+    griot_thread_data *process_data;
 
-struct{
-    uint64_t *context;
-    uint64_t context_hash;
-    unsigned int context_size;
-    unsigned int call_stack_depth;
-    int index;
-} griot_context;
+    // With per-thread contexts, one griot_thread_data per thread, indexed by thread id like the fds of a fd table
+    griot_fd_table per_thread_data;
+} griot_model_data;
 
 typedef struct
 {
-    griot_prediction_data *data;
-    uint64_t call_stack_hash;
-} griot_prediction_table_map_entry;
+    griot_model_data model;
+
+    // Everything above is allocated from the arena, that reports its blocks to usage
+    griot_arena *arena;
+    griot_arena_usage usage;
+
+    // One graph per context size
+    griot_graph_data graphs[];
+} griot_shard;
+
+static struct timespec app_start;
+static uint32_t call_stack_depth;
+
+// The context sizes evaluated, and the largest one
+static uint32_t context_sizes[GRIOT_MAX_CONTEXT_SIZES];
+static uint32_t context_size_count = 0;
+static uint32_t max_context_size;
+static bool thread_sharded = false;
+static bool per_thread_context = false;
+static griot_shard_registry griot_shards;
+
+// Memory budget of the nodes of all the shards (0 if unlimited), and the bytes they currently use, per context size
+static uint64_t max_model_bytes = 0;
+static _Atomic uint64_t model_bytes[GRIOT_MAX_CONTEXT_SIZES];
 
 /**
  * Miscealenous function used in the prediction hashmap
  */
 static uint64_t griot_hashmap_hash(const void *pred_data, uint64_t seed0, uint64_t seed1);
 static int griot_hashmap_compare(const void *pred_data_1, const void *pred_data_2, void *udata);
-static void griot_prediction_table_free(void *pred_data);
 
 /**
- * Function used to compute the instantaneous memory footprint of griot
+ * Shard management, see griot_shard.h
+ */
+static void griot_results_merge(griot_results_data *into, const griot_results_data *from);
+static void *griot_shard_new();
+static void griot_shard_free(void *shard);
+
+/**
+ * Create a stream of I/Os, with one window per context size
+ */
+static griot_thread_data *griot_thread_data_new(griot_shard *shard);
+
+/**
+ * Get the stream of I/Os of a thread, creating it on its first I/O
+ */
+static griot_thread_data *griot_thread_data_get(griot_shard *shard, int32_t thread_id);
+
+/**
+ * Account for bytes newly used by the nodes of a graph, evicting nodes if the budget is exceeded
+ */
+static void griot_model_reserve(griot_shard *shard, uint32_t graph_index, uint64_t bytes);
+
+/**
+ * Called by GrIOt tracer before griot_init when thread sharding is requested
+ */
+static void griot_model_enable_thread_sharding()
+{
+    thread_sharded = true;
+}
+
+/**
+ * Called by GrIOt tracer before griot_init when per-thread contexts are requested
+ */
+static void griot_model_enable_per_thread_context()
+{
+    per_thread_context = true;
+}
+
+/**
+ * Called by GrIOt tracer before griot_init when a memory budget is requested
  */
-static uint64_t griot_get_memory_footprint();
+static void griot_model_set_max_model_bytes(uint64_t bytes)
+{
+    max_model_bytes = bytes!=0 && bytes<GRIOT_MIN_MODEL_BYTES ? GRIOT_MIN_MODEL_BYTES : bytes;
+}
+
+/**
+ * Called by GrIOt tracer before griot_init when a context size sweep is requested
+ */
+static void griot_model_set_context_sizes(const uint32_t *sizes, uint32_t count)
+{
+    context_size_count = 0;
+    for(uint32_t i = 0; i<count && context_size_count<GRIOT_MAX_CONTEXT_SIZES; i++){
+        if(sizes[i]>0) context_sizes[context_size_count++] = sizes[i];
+    }
+}
 
 /**
  * Called by GrIOt tracer when a process is created
  */
-void griot_init(uint32_t context_size, uint32_t call_stack_depth)
+static void griot_model_init(uint32_t griot_context_size, uint32_t griot_call_stack_depth)
 {
-    memset(&griot_results, 0, sizeof(griot_results));
-    griot_model.prediction_table = hashmap_new(sizeof(griot_prediction_table_map_entry), 0, 0, 0, griot_hashmap_hash,
-        griot_hashmap_compare, griot_prediction_table_free, NULL);
-    clock_gettime(CLOCK_MONOTONIC, &griot_results.app_start);
-
-    memset(&griot_context, 0, sizeof(griot_context));
-    griot_context.context = (uint64_t *)malloc(sizeof(uint64_t) * context_size);
-    memset(griot_context.context, 0, sizeof(uint64_t) * context_size);
-	griot_context.context_size = context_size;
-    griot_context.call_stack_depth = call_stack_depth;
+    clock_gettime(CLOCK_MONOTONIC, &app_start);
+    call_stack_depth = griot_call_stack_depth;
+
+    // Without a sweep, the only context size is the one of the tracer
+    if(context_size_count==0) context_sizes[context_size_count++] = griot_context_size;
+    max_context_size = 0;
+    for(uint32_t i = 0; i<context_size_count; i++) if(context_sizes[i]>max_context_size) max_context_size = context_sizes[i];
+
+    griot_shard_registry_init(&griot_shards, thread_sharded, griot_shard_new);
 }
 
 /**
  * Called by GrIOt tracer when a process is finished, just after printing the results
  */
-void griot_finalize()
+static void griot_model_finalize()
 {
-    hashmap_free(griot_model.prediction_table);
-    free(griot_context.context);
+    griot_shard_registry_free(&griot_shards, griot_shard_free);
+    for(uint32_t i = 0; i<GRIOT_MAX_CONTEXT_SIZES; i++) atomic_store(&model_bytes[i], 0);
 }
 
 /**
- * Called by GrIOt tracer when an I/O is intercepted
+ * Called by GrIOt tracer when an I/O is intercepted, once its call stack is known
  */
-void on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, FILE *optional_debug_file)
+static void griot_model_on_io_event(const griot_io_event *event, FILE *optional_debug_file)
 {
+    uint64_t timestamp = event->timestamp;
+    int32_t thread_id = event->thread_id;
+    size_t length = event->length;
+    uint64_t duration_ns = event->duration_ns;
+    op_type op_type = event->op_type;
+
     // (0) Ignore open/close. Only reads and writes are predicted.
     // if(op_type!=GRIOT_READ && op_type!=GRIOT_WRITE) return;
 
-    // (0) Get the call stack
-    struct timespec t0, t1;
-    clock_gettime(CLOCK_MONOTONIC, &t0);
-	uint64_t call_stack = get_hash_for_current_backtrace(griot_context.call_stack_depth);
-    clock_gettime(CLOCK_MONOTONIC, &t1);
-    long dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
-    griot_results.call_stack_instrumentation_count += 1;
-    griot_results.call_stack_instrumentation_time += dt_ns;
-
-    // (1) Update the stats
-    clock_gettime(CLOCK_MONOTONIC, &t0);
-    griot_results.io_count+=1;
-    griot_results.io_time += duration_ns;
-    griot_results.total_volume += length;
-    if(op_type==GRIOT_READ) griot_results.read_volume += length;
-    else if(op_type==GRIOT_WRITE) griot_results.write_volume += length;
-
-    // (2) Compute the new context
-    griot_context.context[griot_context.index] = call_stack;
-    griot_context.index += 1;
-    if(griot_context.index>=griot_context.context_size) griot_context.index = 0;    
-    uint64_t ordered_context[griot_context.context_size];
-    for(int i=griot_context.index; i<griot_context.context_size; i++){ ordered_context[i-griot_context.index]=griot_context.context[i]; }
-    for(int i=0; i<griot_context.index; i++){ ordered_context[griot_context.context_size-griot_context.index+i]=griot_context.context[i]; }
-    griot_context.context_hash = MurmurHash64A(ordered_context, griot_context.context_size*sizeof(unsigned long), GRIOT_SEED);
-
-    // (?) Debug
-    #ifdef GRIOT_DEBUG_VERBOSE
-    INFO("New context hash: %lu, predicted: %lu\n", griot_context.context_hash%0xFFFFFF, griot_model.mru_prediction%0xFFFFFF);
-    //iolib_safe_fprintf(stderr, "context=[");
-    //for(int i = 0; i<griot_context.context_size; i++){
-    //    if(i!=0) iolib_safe_fprintf(stderr, ", ");
-    //    iolib_safe_fprintf(stderr, "%lu", ordered_context[griot_context.context_size-i-1]%0xFFFF);
-    //}
-    //iolib_safe_fprintf(stderr, "]\n");
-    #endif
-
-    // (3) Check if the previously made prediction was right. If it was, increment the stats again
-    if(griot_model.mru_prediction == griot_context.context_hash || (griot_model.mru_prediction == 0 && griot_model.previous_call_stack == call_stack)){
-        griot_results.mru_correct_prediction_count+=1;
-        griot_results.mru_correct_prediction_volume+=length;
-        griot_results.mru_correct_prediction_io_time+=duration_ns;
-    }
-    if(griot_model.mfu_prediction == griot_context.context_hash || (griot_model.mfu_prediction == 0 && griot_model.previous_call_stack == call_stack)){
-        griot_results.mfu_correct_prediction_count+=1;
-        griot_results.mfu_correct_prediction_volume+=length;
-        griot_results.mfu_correct_prediction_io_time+=duration_ns;
-    }
-
-    // (4) Update the information of the previous node
-    if(griot_model.previous_pred_data!=NULL){
-
-        // For MRU, it's easy
-        griot_model.previous_pred_data->mru_context_hash = griot_context.context_hash;
+    // Every piece of state touched below belongs to the calling thread's shard
+    griot_shard *shard = griot_shard_acquire(&griot_shards, thread_id);
+    griot_model_data *griot_model = &shard->model;
+    griot_thread_data *thread_data = per_thread_context ? griot_thread_data_get(shard, thread_id) : griot_model->process_data;
+    uint64_t call_stack = event->call_stack;
+
+    // Every context size is evaluated on its own, with its own graph and results
+    for(uint32_t i = 0; i<context_size_count; i++){
+        griot_graph_data *graph = &shard->graphs[i];
+        griot_results_data *griot_results = &graph->results;
+        griot_window_data *window_data = &thread_data->windows[i];
+        griot_context_window *context = &window_data->window;
+
+        // (0) Get the call stack. It was computed by the caller.
+        struct timespec t0, t1;
+        long dt_ns;
+        griot_results->call_stack_instrumentation_count += 1;
+        griot_results->call_stack_instrumentation_time += event->call_stack_time_ns;
+
+        // (1) Update the stats, see GRIOT_PREDICTION_TIME_SAMPLING for the timer
+        bool timed = griot_results->io_count%GRIOT_PREDICTION_TIME_SAMPLING==0;
+        if(timed) clock_gettime(CLOCK_MONOTONIC, &t0);
+        griot_results->io_count+=1;
+        griot_results->io_time += duration_ns;
+        griot_results->total_volume += length;
+        if(op_type==GRIOT_READ) griot_results->read_volume += length;
+        else if(op_type==GRIOT_WRITE) griot_results->write_volume += length;
+
+        // (2) Compute the new context, from the history
+        griot_context_window_push(context, &thread_data->history, call_stack);
+
+        // (?) Debug
+        #ifdef GRIOT_DEBUG_VERBOSE
+        INFO("New context hash: %lu, predicted: %lu\n", context->context_hash%0xFFFFFF, window_data->mru_prediction%0xFFFFFF);
+        #endif
+
+        // (3) Check if the previously made prediction was right. If it was, increment the stats again
+        if(window_data->mru_prediction == context->context_hash || (window_data->mru_prediction == 0 && thread_data->previous_call_stack == call_stack)){
+            griot_results->mru_correct_prediction_count+=1;
+            griot_results->mru_correct_prediction_volume+=length;
+            griot_results->mru_correct_prediction_io_time+=duration_ns;
+        }
+        if(window_data->mfu_prediction == context->context_hash || (window_data->mfu_prediction == 0 && thread_data->previous_call_stack == call_stack)){
+            griot_results->mfu_correct_prediction_count+=1;
+            griot_results->mfu_correct_prediction_volume+=length;
+            griot_results->mfu_correct_prediction_io_time+=duration_ns;
+        }
 
-        // For MFU, it's harder. Either the node's pred data contains the new context hash and it's just an increment...
-        bool found = false;
-        for(int i = 0; i<griot_model.previous_pred_data->mfu_lists_length; i++){
-            if(griot_model.previous_pred_data->mfu_context_hash_list[i]==griot_context.context_hash){
-                griot_model.previous_pred_data->mfu_weight_list[i]+=1;
-                found = true;
-                break;
-            }
+        // (4) Update the information of the previous node
+        griot_prediction_data *previous_pred_data = griot_node_handle_get(graph->prediction_table, &window_data->previous_pred_data);
+        if(previous_pred_data!=NULL){
+            uint64_t grown_bytes = griot_node_add_successor(graph->arena, previous_pred_data, context->context_hash);
+            if(grown_bytes) griot_model_reserve(shard, i, grown_bytes);
         }
 
-        // ... or it doesn't and we must resize it.
-        if(!found){
-            // incrementing the length
-            griot_model.previous_pred_data->mfu_lists_length+=1;
-            
-            // new context hash
-            griot_model.previous_pred_data->mfu_context_hash_list = realloc(griot_model.previous_pred_data->mfu_context_hash_list,
-                sizeof(uint64_t)*griot_model.previous_pred_data->mfu_lists_length);
-            griot_model.previous_pred_data->mfu_context_hash_list[griot_model.previous_pred_data->mfu_lists_length-1] = griot_context.context_hash;
-
-            // new weight
-            griot_model.previous_pred_data->mfu_weight_list = realloc(griot_model.previous_pred_data->mfu_weight_list,
-                sizeof(uint64_t)*griot_model.previous_pred_data->mfu_lists_length);
-            griot_model.previous_pred_data->mfu_weight_list[griot_model.previous_pred_data->mfu_lists_length-1] = 1;
+        // (5) Make a new prediction using the prediction table, eventually creating an entry for the new context value
+        const griot_prediction_table_map_entry *map_entry = hashmap_get(graph->prediction_table, &(griot_prediction_table_map_entry){.call_stack_hash=context->context_hash});
+        griot_prediction_data *pred_data;
+        if(map_entry==NULL){
+            // If there is no map entry for this context, let's create it. We make our prediction using our default heuristic.
+            griot_model_reserve(shard, i, GRIOT_NODE_BUCKET_BYTES);
+            griot_prediction_table_map_entry new_map_entry = {.call_stack_hash=context->context_hash};
+            griot_node_init(&new_map_entry.data);
+            griot_arena_hashmap_set(graph->arena, graph->prediction_table, &new_map_entry);
+            pred_data = (griot_prediction_data *)&((const griot_prediction_table_map_entry *)hashmap_get(graph->prediction_table, &new_map_entry))->data;
+            // pred_data->mru_context_hash = context->context_hash;
+        }else{
+            // If there is a map entry already, use it.
+            pred_data = (griot_prediction_data *)&map_entry->data;
         }
-    }
+        pred_data->referenced = 1;
 
-    // (5) Make a new prediction using the prediction table, eventually creating an entry for the new context value
-    const griot_prediction_table_map_entry *map_entry = hashmap_get(griot_model.prediction_table, &(griot_prediction_table_map_entry){.call_stack_hash=griot_context.context_hash});
-    griot_prediction_data *pred_data;
-    if(map_entry==NULL){
-        // If there is no map entry for this context, let's create it. We make our prediction using our default heuristic.
-        pred_data = (griot_prediction_data *)malloc(sizeof(griot_prediction_data));
-        memset(pred_data, 0, sizeof(griot_prediction_data));
-        hashmap_set(griot_model.prediction_table, &(griot_prediction_table_map_entry){.call_stack_hash=griot_context.context_hash, .data=pred_data});
-        // pred_data->mru_context_hash = griot_context.context_hash;
-    }else{
-        // If there is a map entry already, use it.
-        pred_data = map_entry->data;
-    }
+        // MRU
+        window_data->mru_prediction=pred_data->mru_context_hash;
+
+        // MFU
+        window_data->mfu_prediction = griot_node_mfu_prediction(pred_data);
 
-    // MRU
-    griot_model.mru_prediction=pred_data->mru_context_hash;
-
-    // MFU
-    // If we have no data, use fallback heuristic. Else, iterate over the weights, and keep the highest frequency context.
-    if(pred_data->mfu_lists_length==0){
-        griot_model.mfu_prediction=pred_data->mru_context_hash;
-    }else{
-        uint64_t best = 0;
-        uint64_t min_weight = 0; // starting weight is 1 for our implementation of MFU
-        for(int i = 0; i<pred_data->mfu_lists_length; i++){
-            if(pred_data->mfu_weight_list[i]>min_weight){
-                min_weight = pred_data->mfu_weight_list[i];
-                best = pred_data->mfu_context_hash_list[i];
-            }
+        // (optional) Debug logs
+        if(optional_debug_file){
+            iolib_safe_fprintf(optional_debug_file, "timestamp=%lu, io_call_stack=%lu, io_context=%lu, mru_next_context=%lu, mfu_next_context=%lu\n", timestamp, call_stack, context->context_hash, window_data->mru_prediction, window_data->mfu_prediction);
         }
-        griot_model.mfu_prediction = best;
-    }
 
-    // Fallback heuristic
-    griot_model.previous_call_stack = call_stack;
+        // (6) Setting the new "previous pred data"
+        window_data->previous_pred_data = griot_node_handle_new(graph->prediction_table, context->context_hash, pred_data);
 
-    // (optional) Debug logs
-    if(optional_debug_file){
-        iolib_safe_fprintf(optional_debug_file, "timestamp=%lu, io_call_stack=%lu, io_context=%lu, mru_next_context=%lu, mfu_next_context=%lu\n", timestamp, call_stack, griot_context.context_hash, griot_model.mru_prediction, griot_model.mfu_prediction);
+        // (7) Updating timers
+        if(timed){
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+            griot_results->model_prediction_time += dt_ns*GRIOT_PREDICTION_TIME_SAMPLING;
+        }
     }
 
-    // (6) Setting the new "previous pred data"
-    griot_model.previous_pred_data = pred_data;
+    // (8) The call stack joins the history once every window is done with the call stack it forgets. Fallback heuristic.
+    griot_context_push(&thread_data->history, call_stack);
+    thread_data->previous_call_stack = call_stack;
 
-    // (7) Updating timers
-    clock_gettime(CLOCK_MONOTONIC, &t1);
-    dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
-    griot_results.model_prediction_time += dt_ns;
+    griot_shard_release(&griot_shards, thread_id);
 }
 
 /**
  * Called by GrIOt tracer in child processes in order to avoid counting any I/O more than once
  */
-void griot_results_reset()
+static void griot_model_results_reset()
+{
+    memset(&app_start, 0, sizeof(app_start));
+    size_t iter = 0;
+    void *shard;
+    while(griot_shard_iter(&griot_shards, &iter, &shard)){
+        for(uint32_t i = 0; i<context_size_count; i++) memset(&((griot_shard *)shard)->graphs[i].results, 0, sizeof(griot_results_data));
+    }
+}
+
+/**
+ * Merge the results of the shards for the i-th context size. The footprint of each context size includes the state
+ * they share (histories, shards).
+ *
+ * @return the number of shards
+ */
+static uint32_t griot_model_results_collect(uint32_t i, griot_results_data *griot_results, uint64_t *memory_footprint,
+    uint64_t *node_count, uint64_t *context_count)
 {
-    memset(&griot_results, 0, sizeof(griot_results));
+    memset(griot_results, 0, sizeof(griot_results_data));
+    *memory_footprint = 0;
+    *node_count = 0;
+    *context_count = 0;
+    uint32_t shard_count = 0;
+    size_t iter = 0;
+    void *item;
+    while(griot_shard_iter(&griot_shards, &iter, &item)){
+        griot_shard *shard = item;
+        griot_results_merge(griot_results, &shard->graphs[i].results);
+        *memory_footprint += shard->usage.used_bytes + shard->graphs[i].usage.used_bytes;
+        *node_count += hashmap_count(shard->graphs[i].prediction_table);
+        *context_count += per_thread_context ? shard->model.per_thread_data.count : 1;
+        shard_count += 1;
+    }
+    return shard_count;
 }
 
 /**
  * Called by GrIOt tracer at the end of a process in order to print the results
  */
-void griot_results_dump(FILE *file)
+static void griot_model_results_dump(FILE *file)
 {
     struct timespec current_time;
     clock_gettime(CLOCK_MONOTONIC, &current_time);
-    uint64_t app_duration_ns = (double)(current_time.tv_sec - griot_results.app_start.tv_sec) * 1.0e9 + (double)(current_time.tv_nsec - griot_results.app_start.tv_nsec); 
-    
-    iolib_safe_fprintf(file, "context_size=%u\ncall_stack_depth=%d\ngranularity=%s\noverall_app_duration=%lu\nio_time_ns=%lu\nio_count=%lu\nio_volume=%lu\nread_volume=%lu\nwrite_volume=%lu\nmru_correct_prediction_count=%lu\n"
-            "mru_correct_prediction_volume=%lu\nmru_correct_prediction_io_time=%lu\nmfu_correct_prediction_count=%lu\nmfu_correct_prediction_volume=%lu\nmfu_correct_prediction_io_time=%lu\n"
-            "call_stack_instrumentation_count=%lu\ncall_stack_instrumentation_time_ns=%lu\nmodel_prediction_time_ns=%lu\nmodel_memory_footprint=%lu\n",
-            griot_context.context_size,
-            griot_context.call_stack_depth,
-            MODULE_NAME,
-            app_duration_ns,
-            griot_results.io_time,
-            griot_results.io_count,
-            griot_results.read_volume+griot_results.write_volume,
-            griot_results.read_volume,
-            griot_results.write_volume,
-            griot_results.mru_correct_prediction_count,
-            griot_results.mru_correct_prediction_volume,
-            griot_results.mru_correct_prediction_io_time,
-            griot_results.mfu_correct_prediction_count,
-            griot_results.mfu_correct_prediction_volume,
-            griot_results.mfu_correct_prediction_io_time,
-            griot_results.call_stack_instrumentation_count,
-            griot_results.call_stack_instrumentation_time,
-            griot_results.model_prediction_time,
-            griot_get_memory_footprint());
+    uint64_t app_duration_ns = (double)(current_time.tv_sec - app_start.tv_sec) * 1.0e9 + (double)(current_time.tv_nsec - app_start.tv_nsec); 
+
+    // One set of results per context size
+    for(uint32_t i = 0; i<context_size_count; i++){
+        // Merging the shards
+        griot_results_data griot_results;
+        uint64_t memory_footprint, node_count, context_count;
+        uint32_t shard_count = griot_model_results_collect(i, &griot_results, &memory_footprint, &node_count, &context_count);
+
+        iolib_safe_fprintf(file, "context_size=%u\ncall_stack_depth=%d\ngranularity=griot-%s\noverall_app_duration=%lu\nio_time_ns=%lu\nio_count=%lu\nio_volume=%lu\nread_volume=%lu\nwrite_volume=%lu\nmru_correct_prediction_count=%lu\n"
+                "mru_correct_prediction_volume=%lu\nmru_correct_prediction_io_time=%lu\nmfu_correct_prediction_count=%lu\nmfu_correct_prediction_volume=%lu\nmfu_correct_prediction_io_time=%lu\n"
+                "call_stack_instrumentation_count=%lu\ncall_stack_instrumentation_time_ns=%lu\nmodel_prediction_time_ns=%lu\nmodel_memory_footprint=%lu\nthread_shards=%u\n"
+                "model_memory_budget=%lu\nmodel_node_bytes=%lu\nevicted_node_count=%lu\nevicted_edge_count=%lu\n"
+                "per_thread_context=%d\ncontext_count=%lu\nnode_count=%lu\n",
+                context_sizes[i],
+                call_stack_depth,
+                griot_per_process_granularity.name,
+                app_duration_ns,
+                griot_results.io_time,
+                griot_results.io_count,
+                griot_results.read_volume+griot_results.write_volume,
+                griot_results.read_volume,
+                griot_results.write_volume,
+                griot_results.mru_correct_prediction_count,
+                griot_results.mru_correct_prediction_volume,
+                griot_results.mru_correct_prediction_io_time,
+                griot_results.mfu_correct_prediction_count,
+                griot_results.mfu_correct_prediction_volume,
+                griot_results.mfu_correct_prediction_io_time,
+                griot_results.call_stack_instrumentation_count,
+                griot_results.call_stack_instrumentation_time,
+                griot_results.model_prediction_time,
+                memory_footprint,
+                shard_count,
+                max_model_bytes,
+                atomic_load(&model_bytes[i]),
+                griot_results.evicted_node_count,
+                griot_results.evicted_edge_count,
+                per_thread_context,
+                context_count,
+                node_count);
+    }
     fflush(file);
 }
 
+/**
+ * Called by GrIOt replay when only the main figures of the results are needed, see griot_results_summarize
+ */
+static void griot_model_results_summarize(void (*on_summary)(const griot_results_summary *summary, void *arg), void *arg)
+{
+    for(uint32_t i = 0; i<context_size_count; i++){
+        griot_results_data griot_results;
+        uint64_t memory_footprint, node_count, context_count;
+        griot_model_results_collect(i, &griot_results, &memory_footprint, &node_count, &context_count);
+
+        griot_results_summary summary = {.context_size=context_sizes[i], .call_stack_depth=call_stack_depth,
+            .io_count=griot_results.io_count, .io_volume=griot_results.read_volume+griot_results.write_volume,
+            .io_time=griot_results.io_time, .mru_correct_prediction_count=griot_results.mru_correct_prediction_count,
+            .mru_correct_prediction_volume=griot_results.mru_correct_prediction_volume,
+            .mfu_correct_prediction_count=griot_results.mfu_correct_prediction_count,
+            .mfu_correct_prediction_volume=griot_results.mfu_correct_prediction_volume,
+            .model_prediction_time=griot_results.model_prediction_time, .model_memory_footprint=memory_footprint};
+        snprintf(summary.granularity, sizeof(summary.granularity), "griot-%s", griot_per_process_granularity.name);
+        on_summary(&summary, arg);
+    }
+}
+
 // ######################
 
 static uint64_t griot_hashmap_hash(const void *pred_data, uint64_t seed0, uint64_t seed1)
@@ -313,21 +480,95 @@ static int griot_hashmap_compare(const void *pred_data_1, const void *pred_data_
     return data_1->call_stack_hash==data_2->call_stack_hash?0:(data_1->call_stack_hash>data_2->call_stack_hash?1:-1);
 }
 
-static void griot_prediction_table_free(void *pred_data)
+static void *griot_shard_new()
 {
-    const griot_prediction_table_map_entry *data = pred_data;
-    free(data->data->mfu_context_hash_list);
-    free(data->data->mfu_weight_list);
-    free(data->data);
+    griot_arena *arena = griot_arena_new();
+    size_t shard_size = sizeof(griot_shard) + sizeof(griot_graph_data)*context_size_count;
+    griot_shard *shard = (griot_shard *)griot_arena_malloc(arena, shard_size);
+    memset(shard, 0, shard_size);
+    shard->arena = arena;
+    griot_arena_set_usage(arena, &shard->usage);
+
+    for(uint32_t i = 0; i<context_size_count; i++){
+        griot_graph_data *graph = &shard->graphs[i];
+        graph->arena = griot_arena_new();
+        griot_arena_set_usage(graph->arena, &graph->usage);
+        graph->prediction_table = griot_arena_hashmap_new(graph->arena, sizeof(griot_prediction_table_map_entry), griot_hashmap_hash,
+            griot_hashmap_compare, NULL);
+    }
+
+    shard->model.process_data = griot_thread_data_new(shard);
+    griot_fd_table_init(&shard->model.per_thread_data, arena);
+    return shard;
+}
+
+static griot_thread_data *griot_thread_data_new(griot_shard *shard)
+{
+    size_t thread_data_size = sizeof(griot_thread_data) + sizeof(griot_window_data)*context_size_count;
+    griot_thread_data *thread_data = (griot_thread_data *)griot_arena_malloc(shard->arena, thread_data_size);
+    memset(thread_data, 0, thread_data_size);
+    griot_context_init(&thread_data->history, max_context_size, shard->arena);
+    for(uint32_t i = 0; i<context_size_count; i++) griot_context_window_init(&thread_data->windows[i].window, context_sizes[i]);
+    return thread_data;
+}
+
+static griot_thread_data *griot_thread_data_get(griot_shard *shard, int32_t thread_id)
+{
+    if(thread_id<0) return shard->model.process_data;
+    griot_thread_data *thread_data = griot_fd_table_get(&shard->model.per_thread_data, thread_id);
+    if(thread_data!=NULL) return thread_data;
+
+    thread_data = griot_thread_data_new(shard);
+    griot_fd_table_set(&shard->model.per_thread_data, thread_id, thread_data);
+    return thread_data;
+}
+
+static void griot_results_merge(griot_results_data *into, const griot_results_data *from)
+{
+    // griot_results_data only holds counters, so merging is a field by field sum
+    uint64_t *into_counters = (uint64_t *)into;
+    const uint64_t *from_counters = (const uint64_t *)from;
+    for(size_t i = 0; i<sizeof(griot_results_data)/sizeof(uint64_t); i++) into_counters[i] += from_counters[i];
 }
 
-static uint64_t griot_get_memory_footprint()
+static void griot_shard_free(void *item)
 {
-    // size of griot context
-    uint64_t size = sizeof(griot_context) +sizeof(uint64_t)*griot_context.context_size;
+    griot_shard *shard = item;
 
-    // size of griot model
-    size += sizeof(griot_model) + (sizeof(griot_prediction_table_map_entry)+sizeof(griot_prediction_data))*hashmap_count(griot_model.prediction_table);
+    // The prediction tables and their nodes live in the arenas of the graphs, the threads and the shard itself in
+    // the shard's arena
+    for(uint32_t i = 0; i<context_size_count; i++) griot_arena_destroy(shard->graphs[i].arena);
+    griot_arena_destroy(shard->arena);
+}
 
-    return size;
-}
\ No newline at end of file
+static void griot_model_reserve(griot_shard *shard, uint32_t graph_index, uint64_t bytes)
+{
+    griot_graph_data *graph = &shard->graphs[graph_index];
+    graph->model_bytes += bytes;
+    atomic_fetch_add_explicit(&model_bytes[graph_index], bytes, memory_order_relaxed);
+    uint64_t budget = griot_shard_budget(&griot_shards, max_model_bytes);
+    if(budget==0 || graph->model_bytes<=budget) return;
+
+    uint64_t released_bytes = griot_node_evict(graph->arena, graph->prediction_table, &graph->clock_hand,
+        graph->model_bytes-budget, &graph->results.evicted_node_count, &graph->results.evicted_edge_count);
+    graph->model_bytes -= released_bytes;
+    atomic_fetch_sub_explicit(&model_bytes[graph_index], released_bytes, memory_order_relaxed);
+}
+
+/**
+ * The per-process granularity, see griot_granularity.h
+ */
+const griot_granularity griot_per_process_granularity = {
+    .name = "per-process",
+    .needs_path_hash = false,
+    .enable_thread_sharding = griot_model_enable_thread_sharding,
+    .enable_per_thread_context = griot_model_enable_per_thread_context,
+    .set_max_model_bytes = griot_model_set_max_model_bytes,
+    .set_context_sizes = griot_model_set_context_sizes,
+    .init = griot_model_init,
+    .finalize = griot_model_finalize,
+    .on_io_event = griot_model_on_io_event,
+    .results_reset = griot_model_results_reset,
+    .results_dump = griot_model_results_dump,
+    .results_summarize = griot_model_results_summarize,
+};
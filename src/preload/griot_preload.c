@@ -0,0 +1,576 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+
+#include "backtrace.h"
+#include "griot_pipeline.h"
+#include "griot_record.h"
+#include "griot_arena.h"
+#include "griot_model.h"
+#include "griot_setup.h"
+#include "griot_config.h"
+#include "log.h"
+
+/*
+ * griot-preload: a capture backend that needs neither iolib nor libunwind, loaded with LD_PRELOAD.
+ *
+ * read, write, pread, pwrite, readv, writev, open, openat, close and fork are interposed, and the real functions are
+ * found with dlsym(RTLD_NEXT). Only the I/Os to the files opened through open and openat are traced, as with the
+ * iolib module: sockets, pipes and the standard streams are not. The model, its settings and its results are the same
+ * as the ones of the iolib module, see griot_tracer.c.
+ *
+ * GrIOt does I/O itself (results, record logs, libgcc_s loading...), so every interposed function goes straight to
+ * the real one while the calling thread is already within GrIOt.
+ *
+ * Not seen: the I/Os of stdio and of the fortified (_FORTIFY_SOURCE) wrappers, that glibc makes without going through
+ * the interposable symbols, and the files duplicated with dup or opened before the library was loaded.
+ */
+
+static void initialize_trace_file();
+static void get_record_path_prefix(char *path_prefix, int array_size);
+static unsigned long iotracerNow();
+static int thread_id();
+static void griot_preload_results_dump(FILE *file);
+
+/** The interposed functions, resolved on the first call to any of them */
+static ssize_t (*real_read)(int fd, void *buf, size_t count);
+static ssize_t (*real_write)(int fd, const void *buf, size_t count);
+static ssize_t (*real_pread)(int fd, void *buf, size_t count, off_t offset);
+static ssize_t (*real_pwrite)(int fd, const void *buf, size_t count, off_t offset);
+static ssize_t (*real_readv)(int fd, const struct iovec *iov, int iovcnt);
+static ssize_t (*real_writev)(int fd, const struct iovec *iov, int iovcnt);
+static int (*real_open)(const char *pathname, int flags, ...);
+static int (*real_openat)(int dirfd, const char *pathname, int flags, ...);
+static int (*real_close)(int fd);
+static pid_t (*real_fork)(void);
+static pthread_once_t real_functions_once = PTHREAD_ONCE_INIT;
+
+/** Counters in order to produce a unique id for every thread and operation */
+static _Atomic int thread_counter;
+static __thread unsigned long long tid;
+
+/** File handle for the log file that we don't want to trace*/
+static FILE *target_trace_file;
+static FILE *debug_trace_file = 0;
+
+/** Mutex to safeguard the model, unless it is sharded per thread */
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static bool griot_thread_sharded = false;
+
+/** See griot_tracer.c */
+static bool griot_async = false;
+static bool griot_recording = false;
+static bool griot_path_hashing = false;
+
+/** Variable used to store the target trace file path*/
+static char base_dump_name[PATH_MAX];
+
+/** Set once the model is initialized, and cleared before it is dumped. Calls go straight through when it is not. */
+static atomic_bool griot_preload_ready;
+
+/** How deep the calling thread is within GrIOt. Calls go straight through when it is. */
+static __thread int griot_preload_depth;
+
+/** Whether the I/Os to a fd are traced, i.e. it was opened through open or openat, not in direct mode */
+static atomic_uchar griot_preload_fds[GRIOT_PRELOAD_MAX_FDS];
+
+/**
+ * Per-thread interposition stats, by op type. Only their thread writes them, and they are all chained to be dumped.
+ */
+typedef struct griot_preload_stats
+{
+    // Calls to an interposed function on a traced file (every open), and the ones that went to the model
+    uint64_t call_count[4];
+    uint64_t traced_count[4];
+
+    // Time spent by the interposer around the real calls that were traced: clock reads, offset lookup, path hash and
+    // model update (or pipeline push, and record)
+    uint64_t overhead_ns[4];
+
+    struct griot_preload_stats *next;
+} griot_preload_stats;
+
+static _Atomic(griot_preload_stats *) griot_preload_all_stats;
+static __thread griot_preload_stats *thread_stats;
+static const char *griot_preload_op_names[] = {"read", "write", "open", "close"};
+
+static void griot_preload_resolve()
+{
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_write = dlsym(RTLD_NEXT, "write");
+    real_pread = dlsym(RTLD_NEXT, "pread");
+    real_pwrite = dlsym(RTLD_NEXT, "pwrite");
+    real_readv = dlsym(RTLD_NEXT, "readv");
+    real_writev = dlsym(RTLD_NEXT, "writev");
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_openat = dlsym(RTLD_NEXT, "openat");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_fork = dlsym(RTLD_NEXT, "fork");
+    if(!real_read || !real_write || !real_pread || !real_pwrite || !real_readv || !real_writev || !real_open
+            || !real_openat || !real_close || !real_fork){
+        FATAL("griot-preload failed to map the interposed symbols");
+    }
+}
+
+/**
+ * Other libraries may do I/O from their constructors, before ours
+ */
+static inline void griot_preload_resolve_once()
+{
+    if(__builtin_expect(real_fork==NULL, 0)) pthread_once(&real_functions_once, griot_preload_resolve);
+}
+
+/**
+ * @return whether a call is made by the application, once the model is ready, so that it may be traced
+ */
+static inline bool griot_preload_enabled()
+{
+    return griot_preload_depth==0 && atomic_load_explicit(&griot_preload_ready, memory_order_relaxed);
+}
+
+static inline bool griot_preload_traced(int fd)
+{
+    return griot_preload_enabled() && (unsigned int)fd<GRIOT_PRELOAD_MAX_FDS
+        && atomic_load_explicit(&griot_preload_fds[fd], memory_order_relaxed);
+}
+
+static inline uint64_t griot_preload_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ul + ts.tv_nsec;
+}
+
+static griot_preload_stats *griot_preload_stats_new()
+{
+    griot_preload_stats *stats = calloc(1, sizeof(griot_preload_stats));
+    if(!stats) FATAL("Out of memory");
+    griot_preload_stats *all_stats = atomic_load(&griot_preload_all_stats);
+    do {
+        stats->next = all_stats;
+    } while(!atomic_compare_exchange_weak(&griot_preload_all_stats, &all_stats, stats));
+    return stats;
+}
+
+/**
+ * Count a call to an interposed function made by the application
+ */
+static inline griot_preload_stats *griot_preload_count(op_type op_type)
+{
+    griot_preload_stats *stats = thread_stats;
+    if(__builtin_expect(stats==NULL, 0)){
+        griot_preload_depth++;
+        stats = thread_stats = griot_preload_stats_new();
+        griot_preload_depth--;
+    }
+    stats->call_count[op_type] += 1;
+    return stats;
+}
+
+/**
+ * Feed an intercepted I/O to the model, either directly or through the asynchronous pipeline.
+ * Always inlined so that the wrappers keep the same number of GrIOt frames in the captured call stacks.
+ */
+static inline __attribute__((always_inline)) void griot_trace_io(int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash){
+    if(griot_async){
+        griot_pipeline_push(iotracerNow(), thread_id(), fd, offset, length, duration_ns, op_type, path_hash);
+        return;
+    }
+
+    if(!griot_thread_sharded) pthread_mutex_lock(&mut);
+    if(griot_recording) griot_record_on_io(iotracerNow(), thread_id(), fd, offset, length, duration_ns, op_type, path_hash, debug_trace_file);
+    else on_io(iotracerNow(), thread_id(), fd, offset, length, duration_ns, op_type, path_hash, debug_trace_file);
+    if(!griot_thread_sharded) pthread_mutex_unlock(&mut);
+}
+
+/**
+ * Trace a read or a write that returned result, and that started at t0. The offset is the one given, or the current
+ * file offset before the I/O if offset is negative.
+ */
+static inline __attribute__((always_inline)) void griot_preload_io(griot_preload_stats *stats, int fd, off_t offset, ssize_t result, uint64_t t0, op_type op_type)
+{
+    uint64_t t1 = griot_preload_now_ns();
+    if(result<0) return;
+
+    int saved_errno = errno;
+    griot_preload_depth++;
+    if(offset<0){
+        off_t position = syscall(SYS_lseek, fd, 0, SEEK_CUR);
+        offset = position>=result ? position-result : 0;
+    }
+    griot_trace_io(fd, offset, result, t1-t0, op_type, 0);
+    griot_preload_depth--;
+    errno = saved_errno;
+
+    stats->traced_count[op_type] += 1;
+    stats->overhead_ns[op_type] += griot_preload_now_ns()-t1;
+}
+
+/**
+ * Start tracing a file opened by the application. Like with the iolib module, opens and closes are fed with no
+ * duration, and files in direct mode are not traced.
+ */
+static inline __attribute__((always_inline)) void griot_preload_open(int dirfd, const char *pathname, int flags, int fd)
+{
+    griot_preload_stats *stats = griot_preload_count(GRIOT_OPEN);
+    if(fd<0 || fd>=GRIOT_PRELOAD_MAX_FDS || (flags & O_DIRECT)) return;
+    uint64_t t1 = griot_preload_now_ns();
+
+    int saved_errno = errno;
+    griot_preload_depth++;
+    atomic_store_explicit(&griot_preload_fds[fd], 1, memory_order_relaxed);
+    // Paths relative to another directory than the current one are left unknown
+    bool known_path = pathname && (dirfd==AT_FDCWD || pathname[0]=='/');
+    uint64_t path_hash = griot_path_hashing && known_path ? griot_path_hash(pathname) : 0;
+    griot_trace_io(fd, 0ul, 0ul, 0ul, GRIOT_OPEN, path_hash);
+    griot_preload_depth--;
+    errno = saved_errno;
+
+    stats->traced_count[GRIOT_OPEN] += 1;
+    stats->overhead_ns[GRIOT_OPEN] += griot_preload_now_ns()-t1;
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    griot_preload_resolve_once();
+    if(!griot_preload_traced(fd)) return real_read(fd, buf, count);
+    griot_preload_stats *stats = griot_preload_count(GRIOT_READ);
+    uint64_t t0 = griot_preload_now_ns();
+    ssize_t result = real_read(fd, buf, count);
+    griot_preload_io(stats, fd, -1, result, t0, GRIOT_READ);
+    return result;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    griot_preload_resolve_once();
+    if(!griot_preload_traced(fd)) return real_write(fd, buf, count);
+    griot_preload_stats *stats = griot_preload_count(GRIOT_WRITE);
+    uint64_t t0 = griot_preload_now_ns();
+    ssize_t result = real_write(fd, buf, count);
+    griot_preload_io(stats, fd, -1, result, t0, GRIOT_WRITE);
+    return result;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    griot_preload_resolve_once();
+    if(!griot_preload_traced(fd) || offset<0) return real_pread(fd, buf, count, offset);
+    griot_preload_stats *stats = griot_preload_count(GRIOT_READ);
+    uint64_t t0 = griot_preload_now_ns();
+    ssize_t result = real_pread(fd, buf, count, offset);
+    griot_preload_io(stats, fd, offset, result, t0, GRIOT_READ);
+    return result;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    griot_preload_resolve_once();
+    if(!griot_preload_traced(fd) || offset<0) return real_pwrite(fd, buf, count, offset);
+    griot_preload_stats *stats = griot_preload_count(GRIOT_WRITE);
+    uint64_t t0 = griot_preload_now_ns();
+    ssize_t result = real_pwrite(fd, buf, count, offset);
+    griot_preload_io(stats, fd, offset, result, t0, GRIOT_WRITE);
+    return result;
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    griot_preload_resolve_once();
+    if(!griot_preload_traced(fd)) return real_readv(fd, iov, iovcnt);
+    griot_preload_stats *stats = griot_preload_count(GRIOT_READ);
+    uint64_t t0 = griot_preload_now_ns();
+    ssize_t result = real_readv(fd, iov, iovcnt);
+    griot_preload_io(stats, fd, -1, result, t0, GRIOT_READ);
+    return result;
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    griot_preload_resolve_once();
+    if(!griot_preload_traced(fd)) return real_writev(fd, iov, iovcnt);
+    griot_preload_stats *stats = griot_preload_count(GRIOT_WRITE);
+    uint64_t t0 = griot_preload_now_ns();
+    ssize_t result = real_writev(fd, iov, iovcnt);
+    griot_preload_io(stats, fd, -1, result, t0, GRIOT_WRITE);
+    return result;
+}
+
+int open(const char *pathname, int flags, ...)
+{
+    mode_t mode = 0;
+    if((flags & O_CREAT) || (flags & O_TMPFILE)==O_TMPFILE){
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    griot_preload_resolve_once();
+    int fd = real_open(pathname, flags, mode);
+    if(griot_preload_enabled()) griot_preload_open(AT_FDCWD, pathname, flags, fd);
+    return fd;
+}
+
+int openat(int dirfd, const char *pathname, int flags, ...)
+{
+    mode_t mode = 0;
+    if((flags & O_CREAT) || (flags & O_TMPFILE)==O_TMPFILE){
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    griot_preload_resolve_once();
+    int fd = real_openat(dirfd, pathname, flags, mode);
+    if(griot_preload_enabled()) griot_preload_open(dirfd, pathname, flags, fd);
+    return fd;
+}
+
+int close(int fd)
+{
+    griot_preload_resolve_once();
+
+    // The fd may be reused by another thread as soon as it is closed
+    bool traced = griot_preload_traced(fd);
+    if(traced) atomic_store_explicit(&griot_preload_fds[fd], 0, memory_order_relaxed);
+    int result = real_close(fd);
+    if(!traced) return result;
+
+    griot_preload_stats *stats = griot_preload_count(GRIOT_CLOSE);
+    uint64_t t1 = griot_preload_now_ns();
+    int saved_errno = errno;
+    griot_preload_depth++;
+    griot_trace_io(fd, 0ul, 0ul, 0ul, GRIOT_CLOSE, 0);
+    griot_preload_depth--;
+    errno = saved_errno;
+    stats->traced_count[GRIOT_CLOSE] += 1;
+    stats->overhead_ns[GRIOT_CLOSE] += griot_preload_now_ns()-t1;
+    return result;
+}
+
+/* The 64 bits offset variants are the same functions on 64 bits targets */
+#if defined(__LP64__)
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset) __attribute__((alias("pread")));
+ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset) __attribute__((alias("pwrite")));
+int open64(const char *pathname, int flags, ...) __attribute__((alias("open")));
+int openat64(int dirfd, const char *pathname, int flags, ...) __attribute__((alias("openat")));
+#endif
+
+/**
+ * In the child, the trace file of the parent is closed and a new one is opened, like in iotracerFollowFork
+ */
+pid_t fork(void)
+{
+    griot_preload_resolve_once();
+    pid_t pid = real_fork();
+    if(pid!=0 || !atomic_load(&griot_preload_ready)) return pid;
+
+    int saved_errno = errno;
+    griot_preload_depth++;
+    mut = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    if(debug_trace_file != 0){
+        fclose(debug_trace_file);
+        debug_trace_file = 0;
+    }
+    if(target_trace_file != 0){
+        fclose(target_trace_file);
+        target_trace_file = 0;
+    }
+    initialize_trace_file();
+    griot_results_reset();
+    for(griot_preload_stats *stats = atomic_load(&griot_preload_all_stats); stats; stats = stats->next){
+        memset(stats->call_count, 0, sizeof(stats->call_count));
+        memset(stats->traced_count, 0, sizeof(stats->traced_count));
+        memset(stats->overhead_ns, 0, sizeof(stats->overhead_ns));
+    }
+    if(griot_recording){
+        char record_path_prefix[PATH_MAX];
+        get_record_path_prefix(record_path_prefix, PATH_MAX);
+        griot_record_follow_fork(record_path_prefix);
+    }
+    if(griot_async) griot_pipeline_follow_fork(debug_trace_file);
+    griot_preload_depth--;
+    errno = saved_errno;
+    return pid;
+}
+
+/**
+ * Initialize the model when the library is loaded, from the same environment variables as the iolib module
+ */
+__attribute__((constructor)) static void griot_preload_init()
+{
+    griot_preload_resolve_once();
+    griot_preload_depth++;
+
+    /* Optionally, ignore all processes on a given node, for example here the login node */
+    char hostname[HOST_NAME_MAX];
+    if(gethostname(hostname, HOST_NAME_MAX)>=0 && strncmp(hostname, GRIOT_IGNORE_NODE, GRIOT_IGNORE_NODE_STRLEN)==0){
+        griot_preload_depth--;
+        return;
+    }
+
+    /* Initialize the backtrace table, and prepare the output file path */
+    initialize_trace_file();
+    iotracer_backtrace_table_init();
+
+    /* The model, configured from env */
+    griot_setup setup;
+    griot_setup_from_env(&setup);
+    griot_thread_sharded = setup.thread_sharded;
+    griot_path_hashing = setup.recording || griot_needs_path_hash();
+
+    /* Optionally, record every I/O for offline replay. Must be started before the pipeline, that captures more frames then. */
+    if(setup.recording){
+        char record_path_prefix[PATH_MAX];
+        get_record_path_prefix(record_path_prefix, PATH_MAX);
+        griot_recording = true;
+        griot_record_start(record_path_prefix, setup.record_depth, setup.call_stack_depth);
+    }
+
+    /* Optionally, take the model updates off the application threads */
+    if(setup.async){
+        griot_async = true;
+        griot_pipeline_start(setup.call_stack_depth, setup.async_queue_size, debug_trace_file);
+    }
+
+    atomic_store(&griot_preload_ready, true);
+    griot_preload_depth--;
+}
+
+/**
+ * Dump the results when the process exits, like griotTerminateTracer
+ */
+__attribute__((destructor)) static void griot_preload_terminate()
+{
+    if(!atomic_exchange(&griot_preload_ready, false)) return;
+    griot_preload_depth++;
+
+    if(griot_async) griot_pipeline_stop();
+    if(griot_recording) griot_record_stop();
+    griot_results_dump(target_trace_file);
+    if(griot_async) griot_pipeline_results_dump(target_trace_file);
+    if(griot_recording) griot_record_results_dump(target_trace_file);
+    griot_preload_results_dump(target_trace_file);
+    griot_arena_results_dump(target_trace_file);
+    iotracer_backtrace_stats_dump(target_trace_file);
+
+    if(debug_trace_file != 0){
+        fclose(debug_trace_file);
+        debug_trace_file = 0;
+    }
+
+    if(target_trace_file != 0){
+        fclose(target_trace_file);
+        target_trace_file = 0;
+    }
+
+    griot_finalize();
+    griot_preload_depth--;
+}
+
+/**
+ * Print how many calls were interposed and traced, and what the interposer cost per traced call, by op type
+ */
+static void griot_preload_results_dump(FILE *file)
+{
+    uint64_t call_count[4] = {0}, traced_count[4] = {0}, overhead_ns[4] = {0};
+    for(griot_preload_stats *stats = atomic_load(&griot_preload_all_stats); stats; stats = stats->next){
+        for(int i = 0; i<4; i++){
+            call_count[i] += stats->call_count[i];
+            traced_count[i] += stats->traced_count[i];
+            overhead_ns[i] += stats->overhead_ns[i];
+        }
+    }
+
+    for(int i = 0; i<4; i++){
+        iolib_safe_fprintf(file, "preload_%s_call_count=%lu\npreload_%s_traced_count=%lu\npreload_%s_overhead_ns=%lu\npreload_%s_overhead_ns_per_call=%.1f\n",
+                griot_preload_op_names[i], call_count[i],
+                griot_preload_op_names[i], traced_count[i],
+                griot_preload_op_names[i], overhead_ns[i],
+                griot_preload_op_names[i], traced_count[i]==0 ? 0.0 : (double)overhead_ns[i]/traced_count[i]);
+    }
+    fflush(file);
+}
+
+//###############################
+
+static void initialize_trace_file()
+{
+    char hostname[HOST_NAME_MAX];
+    if(gethostname(hostname, HOST_NAME_MAX)<0){
+        iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled through GRIOT_ENV_ENABLE_DUMP and GRIOT_ENV_DUMP_FOLDER but hostname was not found. Giving up.\n");
+        return;
+    }
+
+    griot_dump_folder(base_dump_name, PATH_MAX);
+
+    char griot_tracer_target_file[PATH_MAX];
+    if(snprintf(griot_tracer_target_file, PATH_MAX, "%s/%s_%s_pid%d.csv", base_dump_name, hostname, griot_process_name(), getpid())<0){
+        iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled but the dump path was too long. Giving up.\n");
+        exit(-1);
+    }
+
+    target_trace_file = fopen(griot_tracer_target_file, "w");
+    if(target_trace_file == 0){
+            iolib_safe_fprintf(stderr, "griot-preload initialization failed: trace target file at path \"%s\" could not be opened\n",
+                    griot_tracer_target_file);
+            exit(-1);
+    }
+
+    #ifdef GRIOT_DEBUG_MODEL
+    char griot_tracer_debug_file[PATH_MAX];
+    if(snprintf(griot_tracer_debug_file, PATH_MAX, "%s/%s_%s_pid%d.debug", base_dump_name, hostname, griot_process_name(), getpid())<0){
+        iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled but the dump path was too long. Giving up.\n");
+        exit(-1);
+    }
+
+    debug_trace_file = fopen(griot_tracer_debug_file, "w");
+    if(debug_trace_file == 0){
+            iolib_safe_fprintf(stderr, "griot-preload initialization failed: trace target file at path \"%s\" could not be opened\n",
+                    griot_tracer_debug_file);
+            exit(-1);
+    }
+    #endif
+}
+
+/**
+ * Prefix of the record logs of the current process, next to its trace file
+ */
+static void get_record_path_prefix(char *path_prefix, int array_size)
+{
+    char hostname[HOST_NAME_MAX];
+    if(gethostname(hostname, HOST_NAME_MAX)<0) hostname[0] = '\0';
+    if(snprintf(path_prefix, array_size, "%s/%s_%s_pid%d", base_dump_name, hostname, griot_process_name(), getpid())>=array_size){
+        iolib_safe_fprintf(stderr, "[GrIOt] Recording was enabled but the record path was too long. Giving up.\n");
+        exit(-1);
+    }
+}
+
+static int thread_id(){
+    if(tid==0){
+        tid = ++thread_counter;
+    }
+    return tid;
+}
+
+/**
+ * @return current time in milliseconds
+ */
+static unsigned long iotracerNow(){
+    struct timeval ts;
+    gettimeofday(&ts, NULL);
+    return ts.tv_sec * 1000 + ts.tv_usec / 1000;
+}
@@ -0,0 +1,742 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <ftw.h>
+
+#include "../shared/griot_model.h"
+#include "../shared/griot_hash.h"
+#include "../shared/hashmap.h"
+#include "../shared/griot_record_reader.h"
+#include "../shared/log.h"
+#include "griot_config.h"
+
+/*
+ * griot-replay: run the models on record logs (see griot_record.h), away from the traced application and from iolib.
+ *
+ * The logs of a process (one per recording thread) are merged back in capture order, and every I/O goes through on_io_event
+ * with the call stack hash recomputed from the recorded frames. The output is the one griot_results_dump writes at the
+ * end of a traced process, followed by the replay stats.
+ *
+ * The hash is computed at the call stack depth of the live model by default, or at any depth up to the record depth.
+ * Several depths are replayed in parallel, by forked workers: the models keep their state in globals, so each worker
+ * process owns a model instance, and every worker reads the logs mapped once by the parent.
+ *
+ * In batch mode, every process recorded under a folder (e.g. the folder of an experiment, with one process per rank) is
+ * replayed by its own worker, the largest first, and the results are aggregated per hostname and process name.
+ */
+
+static const char *usage =
+    "Usage: griot-replay [options] <log.griotrec>...\n"
+    "       griot-replay [options] -a <folder>\n"
+    "Replay the record logs of a single process through the GrIOt models, or of every process recorded under folder.\n"
+    "  -g <granularities>  granularities to feed, e.g. \"per-process,per-open\" or \"all\" (default: per-process)\n"
+    "  -c <size>           context size (default: 16)\n"
+    "  -s <sizes>          context sizes to sweep, e.g. \"1,2,4,8\"\n"
+    "  -d <depths>         call stack depths to replay, e.g. \"4,8,16,32\", up to the record depth (default: the\n"
+    "                      depth of the live model)\n"
+    "  -j <jobs>           depths or processes replayed in parallel (default: one per core)\n"
+    "  -a <folder>         replay every process recorded under folder, and aggregate the results per hostname and\n"
+    "                      process name\n"
+    "  -m <bytes>          memory budget of the model nodes (default: unlimited)\n"
+    "  -p                  give every thread its own context window\n"
+    "  -o <file>           write the results to file instead of stdout\n";
+
+/**
+ * A log being merged, with the hash of the call stack of its current record
+ */
+typedef struct
+{
+    griot_record_reader reader;
+    uint64_t call_stack;
+    uint32_t index;
+} griot_replay_log;
+
+/**
+ * Largest number of call stack depths replayed in a single run
+ */
+#define GRIOT_REPLAY_MAX_DEPTHS 64
+
+/**
+ * The options, the same for every depth
+ */
+static struct
+{
+    const char *granularities;
+    uint32_t context_size;
+    uint32_t context_sizes[GRIOT_MAX_CONTEXT_SIZES];
+    uint32_t context_size_count;
+    uint32_t depths[GRIOT_REPLAY_MAX_DEPTHS];
+    uint32_t depth_count;
+    uint32_t jobs;
+    uint64_t max_model_bytes;
+    bool per_thread_context;
+} griot_replay = {.context_size=16};
+
+/**
+ * Min-heap of the logs that still have records, by capture sequence of their current record. Version 1 logs have no
+ * sequence, and fall back to the timestamp, then the log index.
+ */
+static griot_replay_log **heap;
+static uint32_t heap_count;
+
+static bool griot_replay_log_before(const griot_replay_log *a, const griot_replay_log *b)
+{
+    if(a->reader.event.sequence!=b->reader.event.sequence) return a->reader.event.sequence<b->reader.event.sequence;
+    if(a->reader.event.timestamp!=b->reader.event.timestamp) return a->reader.event.timestamp<b->reader.event.timestamp;
+    return a->index<b->index;
+}
+
+static void griot_replay_heap_down(uint32_t i)
+{
+    while(true){
+        uint32_t smallest = i;
+        uint32_t left = 2*i+1, right = 2*i+2;
+        if(left<heap_count && griot_replay_log_before(heap[left], heap[smallest])) smallest = left;
+        if(right<heap_count && griot_replay_log_before(heap[right], heap[smallest])) smallest = right;
+        if(smallest==i) return;
+        griot_replay_log *log = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = log;
+        i = smallest;
+    }
+}
+
+/**
+ * Read the next record of a log, hashing the first call_stack_depth frames of its call stack unless they are the same
+ * as the previous ones
+ *
+ * @return false at the end of the log
+ */
+static bool griot_replay_log_next(griot_replay_log *log, uint32_t call_stack_depth, bool first)
+{
+    griot_record_reader *reader = &log->reader;
+    if(!griot_record_reader_next(reader)) return false;
+    if(first || reader->frames_changed){
+        uint32_t frame_count = reader->frame_count<call_stack_depth ? reader->frame_count : call_stack_depth;
+        log->call_stack = MurmurHash64A(reader->frames, frame_count * sizeof(unsigned long), reader->header.seed);
+    }
+    reader->event.call_stack = log->call_stack;
+    return true;
+}
+
+static void griot_replay_summary_write(const griot_results_summary *summary, void *arg)
+{
+    if(fwrite(summary, sizeof(griot_results_summary), 1, (FILE *)arg)!=1) FATAL("Could not write the results of a replay");
+}
+
+/**
+ * Replay every log from its start at a given call stack depth. The summaries of the results (see
+ * griot_results_summarize) are written to summaries as is, ended by a zeroed one, and the results are then dumped to
+ * output. Either may be NULL.
+ */
+static void griot_replay_run(griot_replay_log *logs, uint32_t log_count, uint32_t call_stack_depth, FILE *summaries, FILE *output)
+{
+    // (1) Same model setup as the tracer
+    if(griot_replay.granularities) griot_select_granularities(griot_replay.granularities);
+    if(griot_replay.max_model_bytes) griot_set_max_model_bytes(griot_replay.max_model_bytes);
+    if(griot_replay.per_thread_context) griot_enable_per_thread_context();
+    if(griot_replay.context_size_count) griot_set_context_sizes(griot_replay.context_sizes, griot_replay.context_size_count);
+    griot_init(griot_replay.context_size, call_stack_depth);
+
+    // (2) The first record of every log
+    heap_count = 0;
+    for(uint32_t i = 0; i<log_count; i++){
+        if(griot_replay_log_next(&logs[i], call_stack_depth, true)) heap[heap_count++] = &logs[i];
+    }
+    for(uint32_t i = heap_count; i-->0;) griot_replay_heap_down(i);
+
+    // (3) Feeding the I/Os, oldest first
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t event_count = 0;
+    while(heap_count>0){
+        griot_replay_log *log = heap[0];
+        on_io_event(&log->reader.event, NULL);
+        event_count += 1;
+        if(!griot_replay_log_next(log, call_stack_depth, false)) heap[0] = heap[--heap_count];
+        griot_replay_heap_down(0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t replay_time = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+
+    // (4) Results
+    if(summaries){
+        griot_results_summarize(griot_replay_summary_write, summaries);
+        griot_replay_summary_write(&(griot_results_summary){0}, summaries);
+        fflush(summaries);
+    }
+    if(output){
+        griot_results_dump(output);
+        iolib_safe_fprintf(output, "replay_logs=%u\nreplay_event_count=%lu\nreplay_time_ns=%lu\nreplay_events_per_second=%.0f\n",
+                log_count,
+                event_count,
+                replay_time,
+                replay_time==0 ? 0.0 : event_count*1.0e9/replay_time);
+        fflush(output);
+    }
+    griot_finalize();
+}
+
+/**
+ * Read back the summaries written by griot_replay_run, calling on_summary for each of them. The file is left at the
+ * start of the dump that follows them, if any.
+ */
+static void griot_replay_summaries_read(FILE *results, void (*on_summary)(const griot_results_summary *summary, void *arg), void *arg)
+{
+    griot_results_summary summary;
+    while(fread(&summary, sizeof(summary), 1, results)==1 && summary.granularity[0]!='\0'){
+        if(on_summary) on_summary(&summary, arg);
+    }
+}
+
+/**
+ * Run task_count tasks in forked workers, at most griot_replay.jobs at once, in the order of the task indices. Every
+ * worker calls run with its own temporary file to write its results to. Once a worker exited, the parent calls done
+ * with the same file, rewound, and the file is closed unless done returns true.
+ *
+ * @return 0 upon success, 1 if any worker failed
+ */
+static int griot_replay_workers(uint32_t task_count, void (*run)(uint32_t task, FILE *results),
+    bool (*done)(uint32_t task, FILE *results, bool failed))
+{
+    pid_t *workers = calloc(griot_replay.jobs, sizeof(pid_t));
+    uint32_t *tasks = calloc(griot_replay.jobs, sizeof(uint32_t));
+    FILE **results = calloc(griot_replay.jobs, sizeof(FILE *));
+    if(!workers || !tasks || !results) FATAL("Out of memory");
+
+    uint32_t started = 0, running = 0;
+    int rc = 0;
+    while(started<task_count || running>0){
+        // Start as many workers as allowed, each in a free slot
+        for(uint32_t slot = 0; slot<griot_replay.jobs && started<task_count; slot++){
+            if(workers[slot]!=0) continue;
+            results[slot] = tmpfile();
+            if(results[slot]==NULL) FATAL("Could not create a temporary file");
+            fflush(NULL);
+            pid_t pid = fork();
+            if(pid<0) FATAL("Could not start a replay worker");
+            if(pid==0){
+                run(started, results[slot]);
+                fflush(results[slot]);
+                _exit(0);
+            }
+            workers[slot] = pid;
+            tasks[slot] = started++;
+            running += 1;
+        }
+
+        // Wait for any of them. The worker is done with its file, the parent still shares its offset.
+        int status;
+        pid_t pid = wait(&status);
+        if(pid<0) break;
+        for(uint32_t slot = 0; slot<griot_replay.jobs; slot++){
+            if(workers[slot]!=pid) continue;
+            bool failed = !WIFEXITED(status) || WEXITSTATUS(status)!=0;
+            if(failed) rc = 1;
+            rewind(results[slot]);
+            if(!done(tasks[slot], results[slot], failed)) fclose(results[slot]);
+            workers[slot] = 0;
+            running -= 1;
+        }
+    }
+    free(workers);
+    free(tasks);
+    free(results);
+    return rc;
+}
+
+/**
+ * Depth sweep: the logs of a single process, mapped once, replayed by a worker per depth
+ */
+static struct
+{
+    griot_replay_log *logs;
+    uint32_t log_count;
+    FILE *results[GRIOT_REPLAY_MAX_DEPTHS];
+} griot_replay_sweep_state;
+
+static void griot_replay_sweep_run(uint32_t task, FILE *results)
+{
+    griot_replay_run(griot_replay_sweep_state.logs, griot_replay_sweep_state.log_count, griot_replay.depths[task], results, results);
+}
+
+static bool griot_replay_sweep_done(uint32_t task, FILE *results, bool failed)
+{
+    if(failed) fprintf(stderr, "griot-replay: the replay at depth %u failed\n", griot_replay.depths[task]);
+    griot_replay_sweep_state.results[task] = results;
+    return true;
+}
+
+static void griot_replay_sweep_summary(const griot_results_summary *summary, void *arg)
+{
+    iolib_safe_fprintf((FILE *)arg, "depth_sweep call_stack_depth=%u granularity=%s context_size=%u io_count=%lu mru_accuracy=%.4f mfu_accuracy=%.4f\n",
+            summary->call_stack_depth, summary->granularity, summary->context_size, summary->io_count,
+            summary->io_count==0 ? 0.0 : (double)summary->mru_correct_prediction_count/summary->io_count,
+            summary->io_count==0 ? 0.0 : (double)summary->mfu_correct_prediction_count/summary->io_count);
+}
+
+/**
+ * Replay every depth in its own worker process. The results are printed in the order of the depths, followed by one
+ * line per set of results, so that the accuracy of every depth can be compared at a glance.
+ */
+static int griot_replay_sweep(griot_replay_log *logs, uint32_t log_count, FILE *output)
+{
+    griot_replay_sweep_state.logs = logs;
+    griot_replay_sweep_state.log_count = log_count;
+    int rc = griot_replay_workers(griot_replay.depth_count, griot_replay_sweep_run, griot_replay_sweep_done);
+
+    // The dumps follow the summaries in the results of every worker
+    char buffer[65536];
+    for(uint32_t i = 0; i<griot_replay.depth_count; i++){
+        FILE *results = griot_replay_sweep_state.results[i];
+        griot_replay_summaries_read(results, NULL, NULL);
+        size_t size;
+        while((size = fread(buffer, 1, sizeof(buffer), results))>0) fwrite(buffer, 1, size, output);
+    }
+    fflush(output);
+    for(uint32_t i = 0; i<griot_replay.depth_count; i++){
+        rewind(griot_replay_sweep_state.results[i]);
+        griot_replay_summaries_read(griot_replay_sweep_state.results[i], griot_replay_sweep_summary, output);
+        fclose(griot_replay_sweep_state.results[i]);
+    }
+    fflush(output);
+    return rc;
+}
+
+/**
+ * A traced process, i.e. the logs named <hostname>_<process name>_pid<pid>_<log index>.griotrec, as written by the
+ * tracer in the GRIOT_DUMP_FOLDER layout
+ */
+typedef struct
+{
+    char hostname[64];
+    char process_name[128];
+
+    // Its logs, consecutive in the sorted list of logs
+    uint32_t first_log;
+    uint32_t log_count;
+    uint64_t bytes;
+} griot_replay_trace;
+
+/**
+ * Results of every trace of a hostname and process name, for a granularity, context size and depth. "*" aggregates
+ * every hostname and process name.
+ */
+typedef struct
+{
+    // The key comes first, see griot_replay_group_hash
+    struct
+    {
+        char hostname[64];
+        char process_name[128];
+        char granularity[64];
+        uint32_t context_size;
+        uint32_t call_stack_depth;
+    } key;
+
+    uint64_t trace_count;
+    griot_results_summary results;
+    uint64_t max_model_memory_footprint;
+} griot_replay_group;
+
+/**
+ * Batch mode: every trace found under a folder, replayed by a worker per trace and depth
+ */
+static struct
+{
+    char **paths;
+    uint32_t path_count;
+    uint32_t path_capacity;
+
+    griot_replay_trace *traces;
+    uint32_t trace_count;
+
+    // Traces by decreasing size, so that the largest ones do not end up last
+    uint32_t *order;
+
+    hashmap *groups;
+    uint32_t failed_count;
+} griot_replay_batch_state;
+
+static int griot_replay_batch_find(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    size_t length = strlen(path);
+    if(type!=FTW_F || length<9 || strcmp(path+length-9, ".griotrec")!=0) return 0;
+    if(griot_replay_batch_state.path_count==griot_replay_batch_state.path_capacity){
+        griot_replay_batch_state.path_capacity = griot_replay_batch_state.path_capacity ? griot_replay_batch_state.path_capacity*2 : 1024;
+        griot_replay_batch_state.paths = realloc(griot_replay_batch_state.paths, griot_replay_batch_state.path_capacity*sizeof(char *));
+        if(!griot_replay_batch_state.paths) FATAL("Out of memory");
+    }
+    griot_replay_batch_state.paths[griot_replay_batch_state.path_count] = strdup(path);
+    if(!griot_replay_batch_state.paths[griot_replay_batch_state.path_count]) FATAL("Out of memory");
+    griot_replay_batch_state.path_count += 1;
+    return 0;
+}
+
+static int griot_replay_path_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @return the length of the prefix shared by the logs of a process, i.e. the path without "_<log index>.griotrec"
+ */
+static size_t griot_replay_trace_prefix_length(const char *path)
+{
+    const char *index = strrchr(path, '_');
+    return index ? (size_t)(index-path) : strlen(path);
+}
+
+/**
+ * Group the sorted logs by process, and read the hostname and process name of each process from its file name
+ */
+static void griot_replay_batch_traces_new()
+{
+    griot_replay_batch_state.traces = calloc(griot_replay_batch_state.path_count, sizeof(griot_replay_trace));
+    griot_replay_batch_state.order = calloc(griot_replay_batch_state.path_count, sizeof(uint32_t));
+    if(!griot_replay_batch_state.traces || !griot_replay_batch_state.order) FATAL("Out of memory");
+
+    for(uint32_t i = 0; i<griot_replay_batch_state.path_count; i++){
+        const char *path = griot_replay_batch_state.paths[i];
+        size_t prefix_length = griot_replay_trace_prefix_length(path);
+        griot_replay_trace *trace = griot_replay_batch_state.trace_count ? &griot_replay_batch_state.traces[griot_replay_batch_state.trace_count-1] : NULL;
+        if(trace==NULL || griot_replay_trace_prefix_length(griot_replay_batch_state.paths[trace->first_log])!=prefix_length
+                || strncmp(griot_replay_batch_state.paths[trace->first_log], path, prefix_length)!=0){
+            trace = &griot_replay_batch_state.traces[griot_replay_batch_state.trace_count++];
+            trace->first_log = i;
+
+            // <hostname>_<process name>_pid<pid>. Hostnames have no "_", process names may.
+            const char *name = strrchr(path, '/');
+            name = name ? name+1 : path;
+            size_t name_length = path+prefix_length-name;
+            const char *hostname_end = memchr(name, '_', name_length);
+            const char *pid = NULL;
+            for(const char *c = name; c+4<=path+prefix_length; c++){
+                if(strncmp(c, "_pid", 4)==0) pid = c;
+            }
+            if(hostname_end && pid && pid>hostname_end){
+                snprintf(trace->hostname, sizeof(trace->hostname), "%.*s", (int)(hostname_end-name), name);
+                snprintf(trace->process_name, sizeof(trace->process_name), "%.*s", (int)(pid-hostname_end-1), hostname_end+1);
+            }else{
+                snprintf(trace->hostname, sizeof(trace->hostname), "?");
+                snprintf(trace->process_name, sizeof(trace->process_name), "%.*s", (int)name_length, name);
+            }
+        }
+        struct stat st;
+        if(stat(path, &st)==0) trace->bytes += st.st_size;
+        trace->log_count += 1;
+    }
+}
+
+static int griot_replay_trace_compare(const void *a, const void *b)
+{
+    uint64_t bytes_a = griot_replay_batch_state.traces[*(const uint32_t *)a].bytes;
+    uint64_t bytes_b = griot_replay_batch_state.traces[*(const uint32_t *)b].bytes;
+    return bytes_a==bytes_b ? 0 : (bytes_a>bytes_b ? -1 : 1);
+}
+
+static uint64_t griot_replay_group_hash(const void *item, uint64_t seed0, uint64_t seed1)
+{
+    const griot_replay_group *group = item;
+    return MurmurHash64A(&group->key, sizeof(group->key), seed0);
+}
+
+static int griot_replay_group_compare(const void *a, const void *b, void *udata)
+{
+    return memcmp(&((const griot_replay_group *)a)->key, &((const griot_replay_group *)b)->key, sizeof(((griot_replay_group *)NULL)->key));
+}
+
+static int griot_replay_group_sort(const void *a, const void *b)
+{
+    const griot_replay_group *group_a = *(griot_replay_group *const *)a;
+    const griot_replay_group *group_b = *(griot_replay_group *const *)b;
+    int cmp = strcmp(group_a->key.hostname, group_b->key.hostname);
+    if(cmp==0) cmp = strcmp(group_a->key.process_name, group_b->key.process_name);
+    if(cmp==0) cmp = strcmp(group_a->key.granularity, group_b->key.granularity);
+    if(cmp==0) cmp = (int)group_a->key.call_stack_depth-(int)group_b->key.call_stack_depth;
+    if(cmp==0) cmp = (int)group_a->key.context_size-(int)group_b->key.context_size;
+    return cmp;
+}
+
+static void griot_replay_batch_run(uint32_t task, FILE *results)
+{
+    griot_replay_trace *trace = &griot_replay_batch_state.traces[griot_replay_batch_state.order[task/griot_replay.depth_count]];
+    uint32_t depth = griot_replay.depths[task%griot_replay.depth_count];
+
+    griot_replay_log *logs = calloc(trace->log_count, sizeof(griot_replay_log));
+    heap = calloc(trace->log_count, sizeof(griot_replay_log *));
+    if(!logs || !heap) FATAL("Out of memory");
+    for(uint32_t i = 0; i<trace->log_count; i++){
+        const char *path = griot_replay_batch_state.paths[trace->first_log+i];
+        if(griot_record_reader_open(&logs[i].reader, path)<0){
+            fprintf(stderr, "griot-replay: \"%s\" is not a readable record log\n", path);
+            _exit(1);
+        }
+        if(depth>logs[i].reader.header.record_depth){
+            fprintf(stderr, "griot-replay: call stack depth %u is deeper than the record depth of \"%s\"\n", depth, path);
+            _exit(1);
+        }
+        logs[i].index = i;
+    }
+    griot_replay_run(logs, trace->log_count, depth==0 ? logs[0].reader.header.call_stack_depth : depth, results, NULL);
+}
+
+/**
+ * Add a set of results of a trace to its group, and to the group of every trace
+ */
+static void griot_replay_batch_aggregate(const griot_results_summary *summary, void *arg)
+{
+    const griot_replay_trace *trace = arg;
+    for(int all = 0; all<2; all++){
+        griot_replay_group key;
+        memset(&key, 0, sizeof(key));
+        snprintf(key.key.hostname, sizeof(key.key.hostname), "%s", all ? "*" : trace->hostname);
+        snprintf(key.key.process_name, sizeof(key.key.process_name), "%s", all ? "*" : trace->process_name);
+        snprintf(key.key.granularity, sizeof(key.key.granularity), "%s", summary->granularity);
+        key.key.context_size = summary->context_size;
+        key.key.call_stack_depth = summary->call_stack_depth;
+
+        griot_replay_group *group = (griot_replay_group *)hashmap_get(griot_replay_batch_state.groups, &key);
+        if(group==NULL){
+            hashmap_set(griot_replay_batch_state.groups, &key);
+            group = (griot_replay_group *)hashmap_get(griot_replay_batch_state.groups, &key);
+        }
+        group->trace_count += 1;
+        group->results.io_count += summary->io_count;
+        group->results.io_volume += summary->io_volume;
+        group->results.io_time += summary->io_time;
+        group->results.mru_correct_prediction_count += summary->mru_correct_prediction_count;
+        group->results.mru_correct_prediction_volume += summary->mru_correct_prediction_volume;
+        group->results.mfu_correct_prediction_count += summary->mfu_correct_prediction_count;
+        group->results.mfu_correct_prediction_volume += summary->mfu_correct_prediction_volume;
+        group->results.model_prediction_time += summary->model_prediction_time;
+        group->results.model_memory_footprint += summary->model_memory_footprint;
+        if(summary->model_memory_footprint>group->max_model_memory_footprint) group->max_model_memory_footprint = summary->model_memory_footprint;
+    }
+}
+
+static bool griot_replay_batch_done(uint32_t task, FILE *results, bool failed)
+{
+    griot_replay_trace *trace = &griot_replay_batch_state.traces[griot_replay_batch_state.order[task/griot_replay.depth_count]];
+    if(failed){
+        fprintf(stderr, "griot-replay: the replay of \"%s\" failed\n", griot_replay_batch_state.paths[trace->first_log]);
+        griot_replay_batch_state.failed_count += 1;
+        return false;
+    }
+    griot_replay_summaries_read(results, griot_replay_batch_aggregate, trace);
+    return false;
+}
+
+/**
+ * Replay every trace found under folder, one worker per trace and depth, and print one line per hostname, process
+ * name, granularity, depth and context size, "*" standing for every hostname and process name
+ */
+static int griot_replay_batch(const char *folder, FILE *output)
+{
+    // (1) Finding the logs, and grouping them by process
+    if(nftw(folder, griot_replay_batch_find, 64, FTW_PHYS)<0){
+        fprintf(stderr, "griot-replay: cannot walk \"%s\"\n", folder);
+        return 1;
+    }
+    if(griot_replay_batch_state.path_count==0){
+        fprintf(stderr, "griot-replay: no record log under \"%s\"\n", folder);
+        return 1;
+    }
+    qsort(griot_replay_batch_state.paths, griot_replay_batch_state.path_count, sizeof(char *), griot_replay_path_compare);
+    griot_replay_batch_traces_new();
+    for(uint32_t i = 0; i<griot_replay_batch_state.trace_count; i++) griot_replay_batch_state.order[i] = i;
+    qsort(griot_replay_batch_state.order, griot_replay_batch_state.trace_count, sizeof(uint32_t), griot_replay_trace_compare);
+
+    // (2) Replaying every trace at every depth. 0 is the depth of the live model.
+    if(griot_replay.depth_count==0){
+        griot_replay.depths[0] = 0;
+        griot_replay.depth_count = 1;
+    }
+    griot_replay_batch_state.groups = hashmap_new(sizeof(griot_replay_group), 0, GRIOT_SEED, 0, griot_replay_group_hash,
+        griot_replay_group_compare, NULL, NULL);
+    if(!griot_replay_batch_state.groups) FATAL("Out of memory");
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = griot_replay_workers(griot_replay_batch_state.trace_count*griot_replay.depth_count, griot_replay_batch_run, griot_replay_batch_done);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t batch_time = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+
+    // (3) One line per group, in a stable order
+    size_t group_count = hashmap_count(griot_replay_batch_state.groups);
+    griot_replay_group **groups = calloc(group_count+1, sizeof(griot_replay_group *));
+    if(!groups) FATAL("Out of memory");
+    size_t iter = 0, i = 0;
+    void *item;
+    while(hashmap_iter(griot_replay_batch_state.groups, &iter, &item)) groups[i++] = item;
+    qsort(groups, group_count, sizeof(griot_replay_group *), griot_replay_group_sort);
+    for(i = 0; i<group_count; i++){
+        const griot_replay_group *group = groups[i];
+        const griot_results_summary *results = &group->results;
+        iolib_safe_fprintf(output, "batch hostname=%s process_name=%s granularity=%s call_stack_depth=%u context_size=%u traces=%lu "
+                "io_count=%lu io_volume=%lu io_time_ns=%lu mru_accuracy=%.4f mfu_accuracy=%.4f mru_volume_accuracy=%.4f mfu_volume_accuracy=%.4f "
+                "model_ns_per_io=%.1f model_memory_footprint=%lu max_model_memory_footprint=%lu\n",
+                group->key.hostname, group->key.process_name, group->key.granularity, group->key.call_stack_depth, group->key.context_size,
+                group->trace_count,
+                results->io_count,
+                results->io_volume,
+                results->io_time,
+                results->io_count==0 ? 0.0 : (double)results->mru_correct_prediction_count/results->io_count,
+                results->io_count==0 ? 0.0 : (double)results->mfu_correct_prediction_count/results->io_count,
+                results->io_volume==0 ? 0.0 : (double)results->mru_correct_prediction_volume/results->io_volume,
+                results->io_volume==0 ? 0.0 : (double)results->mfu_correct_prediction_volume/results->io_volume,
+                results->io_count==0 ? 0.0 : (double)results->model_prediction_time/results->io_count,
+                results->model_memory_footprint,
+                group->max_model_memory_footprint);
+    }
+    iolib_safe_fprintf(output, "batch_traces=%u\nbatch_logs=%u\nbatch_failed_replays=%u\nbatch_jobs=%u\nbatch_time_ns=%lu\n",
+            griot_replay_batch_state.trace_count,
+            griot_replay_batch_state.path_count,
+            griot_replay_batch_state.failed_count,
+            griot_replay.jobs,
+            batch_time);
+    fflush(output);
+
+    free(groups);
+    hashmap_free(griot_replay_batch_state.groups);
+    for(i = 0; i<griot_replay_batch_state.path_count; i++) free(griot_replay_batch_state.paths[i]);
+    free(griot_replay_batch_state.paths);
+    free(griot_replay_batch_state.traces);
+    free(griot_replay_batch_state.order);
+    return rc;
+}
+
+/**
+ * Parse a comma separated list of positive integers
+ *
+ * @return the number of integers, or 0 if the list is invalid or too long
+ */
+static uint32_t griot_replay_parse_list(const char *str, uint32_t *values, uint32_t max_count)
+{
+    uint32_t count = 0;
+    while(*str){
+        char *end;
+        long value = strtol(str, &end, 10);
+        if(end==str || value<=0 || count==max_count) return 0;
+        values[count++] = (uint32_t)value;
+        if(*end!=',' && *end!='\0') return 0;
+        str = *end ? end+1 : end;
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    // (1) Options, the same as the environment variables of the tracer
+    FILE *output = stdout;
+    const char *batch_folder = NULL;
+    int option;
+    while((option = getopt(argc, argv, "g:c:s:d:j:m:po:a:h"))!=-1){
+        switch(option){
+        case 'a':
+            batch_folder = optarg;
+            break;
+        case 'g':
+            griot_replay.granularities = optarg;
+            break;
+        case 'c':
+            griot_replay.context_size = strtoul(optarg, NULL, 10);
+            if(griot_replay.context_size==0 || griot_replay.context_size>1024){
+                fprintf(stderr, "griot-replay: invalid context size \"%s\"\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            griot_replay.context_size_count = griot_replay_parse_list(optarg, griot_replay.context_sizes, GRIOT_MAX_CONTEXT_SIZES);
+            if(griot_replay.context_size_count==0){
+                fprintf(stderr, "griot-replay: invalid or too long list of context sizes \"%s\"\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            griot_replay.depth_count = griot_replay_parse_list(optarg, griot_replay.depths, GRIOT_REPLAY_MAX_DEPTHS);
+            if(griot_replay.depth_count==0){
+                fprintf(stderr, "griot-replay: invalid or too long list of call stack depths \"%s\"\n", optarg);
+                return 1;
+            }
+            break;
+        case 'j':
+            griot_replay.jobs = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            griot_replay.max_model_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'p':
+            griot_replay.per_thread_context = true;
+            break;
+        case 'o':
+            output = fopen(optarg, "w");
+            if(output==NULL){
+                fprintf(stderr, "griot-replay: cannot open \"%s\"\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fputs(usage, option=='h' ? stdout : stderr);
+            return option=='h' ? 0 : 1;
+        }
+    }
+    if((optind==argc)==(batch_folder==NULL)){
+        fputs(usage, stderr);
+        return 1;
+    }
+    if(griot_replay.granularities && griot_select_granularities(griot_replay.granularities)<0){
+        fprintf(stderr, "griot-replay: unknown granularity in \"%s\"\n", griot_replay.granularities);
+        return 1;
+    }
+    if(griot_replay.jobs==0){
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        griot_replay.jobs = cores>0 ? cores : 1;
+    }
+    if(batch_folder){
+        int rc = griot_replay_batch(batch_folder, output);
+        if(output!=stdout) fclose(output);
+        return rc;
+    }
+
+    // (2) Mapping the logs, once for every depth
+    uint32_t log_count = argc-optind;
+    griot_replay_log *logs = calloc(log_count, sizeof(griot_replay_log));
+    heap = calloc(log_count, sizeof(griot_replay_log *));
+    if(!logs || !heap) FATAL("Out of memory");
+    uint32_t record_depth = UINT32_MAX;
+    uint32_t call_stack_depth = 0;
+    for(uint32_t i = 0; i<log_count; i++){
+        if(griot_record_reader_open(&logs[i].reader, argv[optind+i])<0){
+            fprintf(stderr, "griot-replay: \"%s\" is not a readable record log\n", argv[optind+i]);
+            return 1;
+        }
+        logs[i].index = i;
+        if(logs[i].reader.header.record_depth<record_depth) record_depth = logs[i].reader.header.record_depth;
+        call_stack_depth = logs[i].reader.header.call_stack_depth;
+    }
+
+    // (3) Deeper call stacks than recorded cannot be hashed
+    for(uint32_t i = 0; i<griot_replay.depth_count; i++){
+        if(griot_replay.depths[i]>record_depth){
+            fprintf(stderr, "griot-replay: call stack depth %u is deeper than the record depth %u\n", griot_replay.depths[i], record_depth);
+            return 1;
+        }
+    }
+
+    // (4) A single depth is replayed in place, several by workers
+    int rc = 0;
+    if(griot_replay.depth_count<=1) griot_replay_run(logs, log_count, griot_replay.depth_count==1 ? griot_replay.depths[0] : call_stack_depth, NULL, output);
+    else rc = griot_replay_sweep(logs, log_count, output);
+
+    for(uint32_t i = 0; i<log_count; i++) griot_record_reader_close(&logs[i].reader);
+    free(logs);
+    free(heap);
+    if(output!=stdout) fclose(output);
+    return rc;
+}
@@ -6,106 +6,175 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <link.h>
+#include <sys/syscall.h>
 
 #include "backtrace.h"
 #include "griot_config.h"
 #include "log.h"
 //#include "iolib_locks.h"
 
+#ifndef IOTRACER_NO_LIBUNWIND
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
+#endif
 
-/** Utility for hash function */
-#define BIG_CONSTANT(x) (x##LLU)
-
-/** The path to the maps file for relative backtrace extraction */
-#ifndef MAPS_FILE /* this macro happens to  be defined when in unit tests */
-  #define MAPS_FILE "/proc/self/maps"
+/** Number of entries of the per-thread address translation cache. Must be a power of two. */
+#ifndef LIB_ADDR_CACHE_SIZE
+  #define LIB_ADDR_CACHE_SIZE 256
 #endif
 
 /**
- * This struct represents the address range of an executable mapping in the current address space
- * These structs are stored in a simple linked list. That list should be short, but in the future
- * it might be a good idea to switch to a binary tree instead.
+ * The address ranges of the executable mappings in the current address space, sorted by start address.
+ * Starts and ends are kept in separate arrays so that the binary search only touches the starts.
+ * A table is never modified once published: a rebuild publishes a whole new one.
  */
-struct lib_addr_range {
-        unsigned long lr_start;
-        unsigned long lr_end;
-        struct lib_addr_range *lr_next;
+struct lib_addr_table {
+        unsigned long lt_count;
+        unsigned long lt_generation;
+        unsigned long *lt_starts;
+        unsigned long *lt_ends;
+
+        /* Once replaced: the epoch it was retired in, and the next table waiting to be freed */
+        unsigned long lt_retired_epoch;
+        struct lib_addr_table *lt_retired_next;
 };
 
 /**
- * The linked list of memory ranges.
- * Updated atomically on library load and on dlopen()s
+ * The current table of memory ranges.
+ * Swapped atomically on library load and on dlopen()s
  */
-static struct lib_addr_range *lib_addr_ranges;
+static struct lib_addr_table lib_addr_table_empty;
+static _Atomic(struct lib_addr_table *) lib_addr_table = &lib_addr_table_empty;
 
 /**
- * Protection for lib_addr_ranges
- * dlopen() takes it as a writer
- * backtrace users take it as a reader
+ * Generation of the last table built, so that the translation caches can tell stale entries apart. Starts at 1, an
+ * empty cache entry having generation 0.
  */
-//pthread_mutex_t addr_ranges_lock;
+static unsigned long lib_addr_table_generation;
 
 /**
- * MurmurHash2, 64-bit versions, by Austin Appleby
- * The same caveats as 32-bit MurmurHash2 apply here - beware of alignment
- * and endian-ness issues if used across multiple platforms.
- *
- * @return 64-bit hash for 64-bit platforms
+ * Serializes the rebuilds and the reclaims. The readers never take it.
  */
-u_int64_t MurmurHash64A(const void *key, int len, u_int64_t seed)
-{ 
-        const u_int64_t m = BIG_CONSTANT(0xc6a4a7935bd1e995);
-        const int r = 47;
+static pthread_mutex_t lib_addr_table_rebuild_lock = PTHREAD_MUTEX_INITIALIZER;
 
-        u_int64_t h = seed ^ (len * m);
+/**
+ * Grace period tracking for the retired tables, in the spirit of RCU.
+ * Each thread that reads the table owns a reader record, where it announces the epoch it entered its read-side
+ * critical section in, or 0 when it is not reading. Once a new table is published and the epoch is bumped, the old
+ * table can be freed as soon as no reader record holds an older epoch.
+ * Nobody waits for that: retired tables are kept in a list, and freed by a later rebuild or unwind.
+ */
+struct lib_addr_reader {
+        _Atomic unsigned long lar_epoch;
+        struct lib_addr_reader *lar_next;
+};
+static _Atomic unsigned long lib_addr_epoch = 1;
+static _Atomic(struct lib_addr_reader *) lib_addr_readers;
+static __thread struct lib_addr_reader *lib_addr_thread_reader;
+static _Atomic(struct lib_addr_table *) lib_addr_retired_tables;
 
-        const u_int64_t *data = (const u_int64_t *) key;
-        const u_int64_t *end = data + (len / 8);
+/**
+ * Direct-mapped cache of the last address to offset translations of the current thread.
+ * The same few call sites tend to do all the I/Os, so most frames hit it.
+ */
+struct lib_addr_cache_entry {
+        unsigned long lc_addr;
+        unsigned long lc_offset;
+        unsigned long lc_generation;
+};
+static __thread struct lib_addr_cache_entry lib_addr_cache[LIB_ADDR_CACHE_SIZE];
 
-        while (data != end) {
-                u_int64_t k = *data++;
-                k *= m; k ^= k >> r; k *= m; h ^= k; h *= m;
-        }
+/**
+ * The unwinder used by fast_backtrace(). See iotracer_backtrace_set_unwinder().
+ */
+typedef enum {IOTRACER_UNWINDER_LIBUNWIND, IOTRACER_UNWINDER_FRAMEPOINTER, IOTRACER_UNWINDER_GLIBC} iotracer_unwinder;
+#ifdef IOTRACER_NO_LIBUNWIND
+static iotracer_unwinder unwinder = IOTRACER_UNWINDER_FRAMEPOINTER;
+#else
+static iotracer_unwinder unwinder = IOTRACER_UNWINDER_LIBUNWIND;
+#endif
+static const char *unwinder_names[] = {"libunwind", "framepointer", "glibc"};
 
-        const unsigned char *data2 = (const unsigned char *) data;
+/**
+ * Number of frame pointer walks that looked broken and were redone with libunwind
+ */
+static _Atomic unsigned long long framepointer_fallback_count;
 
-        switch (len & 7) {
-        case 7: h ^= (u_int64_t)(data2[6]) << 48;
-        case 6: h ^= (u_int64_t)(data2[5]) << 40;
-        case 5: h ^= (u_int64_t)(data2[4]) << 32;
-        case 4: h ^= (u_int64_t)(data2[3]) << 24;
-        case 3: h ^= (u_int64_t)(data2[2]) << 16;
-        case 2: h ^= (u_int64_t)(data2[1]) << 8;
-        case 1: h ^= (u_int64_t)(data2[0]); h *= m;
-        };
+/**
+ * Return addresses into the entry code of the threads (e.g. __libc_start_call_main), whose callers never keep a frame
+ * pointer: a walk that cannot go further than one of these still reached the outermost frame. Learned from the
+ * fallbacks, see fast_backtrace().
+ */
+#define FRAMEPOINTER_MAX_ENTRY_POINTS 8
+#define FRAMEPOINTER_MAX_ENTRY_FRAMES 3
+static _Atomic unsigned long framepointer_entry_points[FRAMEPOINTER_MAX_ENTRY_POINTS];
 
-        h ^= h >> r; h *= m; h ^= h >> r;
-        return h;
-}
+/**
+ * Top of the current thread's stack, used to bound the frame pointer walk. Lazily initialized.
+ */
+static __thread unsigned long framepointer_stack_top;
+extern void *__libc_stack_end;
 
 /**
- * Return the offset of an address relative to the library it belongs to.
- * For this, find the address range where this address fits and return the offset relative to the start.
- * Return 0 if not found.
+ * Binary search for the range containing addr. The loop has a fixed trip count for a given table and its only
+ * branch is turned into a conditional move, so it does not suffer from mispredictions.
  *
- * @note addr_ranges_lock must be read-locked
+ * @return the offset relative to the start of the range, 0 if not found
  */
-static unsigned long get_lib_offset_for_addr(unsigned long addr)
+static unsigned long lib_addr_table_lookup(const struct lib_addr_table *t, unsigned long addr)
 {
-        const struct lib_addr_range *r = lib_addr_ranges;
-        while (r) {
-                if ((r->lr_start <= addr) && (r->lr_end > addr))
-                        return addr - r->lr_start;
-                r = r->lr_next;
+        unsigned long n = t->lt_count;
+        if (n == 0)
+                return 0;
+
+        /* Find the last range starting at or before addr */
+        const unsigned long *base = t->lt_starts;
+        while (n > 1) {
+                unsigned long half = n / 2;
+                base = (base[half] <= addr) ? base + half : base;
+                n -= half;
         }
+
+        unsigned long i = base - t->lt_starts;
+        if ((t->lt_starts[i] <= addr) && (t->lt_ends[i] > addr))
+                return addr - t->lt_starts[i];
         //iolib_safe_fprintf(stderr, "[GrIOt] Warning, address %lx not found\n", addr);
         return 0;
 }
 
-int fast_backtrace (void **array, int size)
+/**
+ * Return the offset of an address relative to the library it belongs to.
+ * For this, find the address range where this address fits and return the offset relative to the start.
+ * Return 0 if not found.
+ */
+static unsigned long get_lib_offset_for_addr(const struct lib_addr_table *t, unsigned long addr)
 {
+        /* Return addresses are at least 1-byte apart and mostly 16-byte aligned functions, so mix in the upper bits */
+        struct lib_addr_cache_entry *e = &lib_addr_cache[(addr ^ (addr >> 12)) & (LIB_ADDR_CACHE_SIZE-1)];
+        if (e->lc_addr == addr && e->lc_generation == t->lt_generation)
+                return e->lc_offset;
+
+        unsigned long offset = lib_addr_table_lookup(t, addr);
+        e->lc_addr = addr;
+        e->lc_offset = offset;
+        e->lc_generation = t->lt_generation;
+        return offset;
+}
+
+/**
+ * Unwind with libunwind. Slow, but it relies on the unwind tables and does not need frame pointers.
+ * Always inlined, so that the first frame is within fast_backtrace() whatever the unwinder.
+ */
+static inline __attribute__((always_inline)) int libunwind_backtrace(void **array, int size)
+{
+#ifdef IOTRACER_NO_LIBUNWIND
+        /* Built without libunwind (e.g. the LD_PRELOAD backend): glibc relies on the same unwind tables */
+        return backtrace(array, size);
+#else
         //iolib_mutex_unlock(&iotracer_lock);
         unw_cursor_t cursor;
         unw_context_t context;
@@ -140,6 +209,238 @@ int fast_backtrace (void **array, int size)
         }
     //iolib_mutex_lock(&iotracer_lock);
     return i;
+#endif
+}
+
+/**
+ * @return the top of the current thread stack, or 0 if unknown
+ */
+static unsigned long get_stack_top(void)
+{
+        if (framepointer_stack_top == 0) {
+                /* pthread_getattr_np() reads /proc/self/maps for the main thread. Better not to do I/O from a hook. */
+                if (syscall(SYS_gettid) == getpid()) {
+                        framepointer_stack_top = (unsigned long)__libc_stack_end;
+                } else {
+                        pthread_attr_t attr;
+                        void *stack_addr;
+                        size_t stack_size;
+                        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+                                if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0)
+                                        framepointer_stack_top = (unsigned long)stack_addr + stack_size;
+                                pthread_attr_destroy(&attr);
+                        }
+                }
+        }
+        return framepointer_stack_top;
+}
+
+static int framepointer_is_entry_point(void *return_address)
+{
+        for (int i = 0; i < FRAMEPOINTER_MAX_ENTRY_POINTS; i++) {
+                unsigned long entry_point = atomic_load_explicit(&framepointer_entry_points[i], memory_order_relaxed);
+                if (entry_point == 0)
+                        return 0;
+                if (entry_point == (unsigned long)return_address)
+                        return 1;
+        }
+        return 0;
+}
+
+static void framepointer_add_entry_point(void *return_address)
+{
+        for (int i = 0; i < FRAMEPOINTER_MAX_ENTRY_POINTS; i++) {
+                unsigned long expected = 0;
+                if (atomic_compare_exchange_strong(&framepointer_entry_points[i], &expected, (unsigned long)return_address)
+                                || expected == (unsigned long)return_address)
+                        return;
+        }
+}
+
+/**
+ * Unwind by walking the frame pointer chain. Every frame record is {previous frame pointer, return address}.
+ * The first frame is the return address into the caller of fast_backtrace(). The walk ends at the outermost frame: a
+ * null frame pointer, or a return address into the entry code of the thread. Any other frame pointer that cannot be a
+ * caller frame (misaligned, not going up the stack, or out of it) means that code built without frame pointers left
+ * anything in that register.
+ *
+ * @param[out] last_return_address the last return address found when the chain is broken
+ * @return the number of frames, or -1 if the chain is broken before size frames were found
+ */
+static inline __attribute__((always_inline)) int framepointer_backtrace(void **array, int size, void **last_return_address)
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+        struct frame_record {
+                struct frame_record *next;
+                void *return_address;
+        };
+
+        unsigned long stack_top = get_stack_top();
+        if (stack_top == 0)
+                return -1;
+
+        struct frame_record *fp = (struct frame_record *)__builtin_frame_address(0);
+        if (((unsigned long)fp & (sizeof(void *)-1)) || (unsigned long)fp + sizeof(*fp) > stack_top)
+                return -1;
+
+        int i = 0;
+        while (i < size) {
+                array[i++] = fp->return_address;
+
+                struct frame_record *next = fp->next;
+                if (i == size || next == NULL)
+                        break;
+                if (next <= fp || ((unsigned long)next & (sizeof(void *)-1)) || (unsigned long)next + sizeof(*next) > stack_top) {
+                        if (framepointer_is_entry_point(fp->return_address))
+                                break;
+                        *last_return_address = fp->return_address;
+                        return -1;
+                }
+                fp = next;
+        }
+        return i;
+#else
+        return -1;
+#endif
+}
+
+int fast_backtrace (void **array, int size)
+{
+        switch (unwinder) {
+        case IOTRACER_UNWINDER_FRAMEPOINTER: {
+                void *last_return_address = NULL;
+                int n = framepointer_backtrace(array, size, &last_return_address);
+                if (n >= 0)
+                        return n;
+                atomic_fetch_add_explicit(&framepointer_fallback_count, 1, memory_order_relaxed);
+
+                /* The first frame of the fallback is within fast_backtrace() itself: drop it, so that the call
+                 * stacks of a site hash the same whichever way they were captured. One frame is lost at full depth. */
+                n = libunwind_backtrace(array, size);
+                if (n <= 0)
+                        return 0;
+                memmove(array, array + 1, (n - 1) * sizeof(void *));
+
+                /* If the fallback went all the way up, and only found the entry code of the thread past the frame
+                 * where the chain broke, the next walks that break there are complete. The entry frames are dropped,
+                 * like they will be by these walks. */
+                if (last_return_address && n < size) {
+                        for (int i = n - 2; i >= 0 && i >= n - 2 - FRAMEPOINTER_MAX_ENTRY_FRAMES; i--) {
+                                if (array[i] == last_return_address) {
+                                        framepointer_add_entry_point(last_return_address);
+                                        return i + 1;
+                                }
+                        }
+                }
+                return n - 1;
+        }
+        case IOTRACER_UNWINDER_GLIBC:
+                return backtrace(array, size);
+        default:
+                return libunwind_backtrace(array, size);
+        }
+}
+
+int iotracer_backtrace_set_unwinder(const char *name)
+{
+        for (int i = 0; i < (int)(sizeof(unwinder_names)/sizeof(unwinder_names[0])); i++) {
+                if (strcmp(name, unwinder_names[i]) == 0) {
+#ifdef IOTRACER_NO_LIBUNWIND
+                        if (i == IOTRACER_UNWINDER_LIBUNWIND)
+                                return -1;
+#endif
+                        unwinder = (iotracer_unwinder)i;
+
+                        /* The first backtrace() call loads libgcc_s. Better do it now than from an I/O hook. */
+                        if (unwinder == IOTRACER_UNWINDER_GLIBC) {
+                                void *frame;
+                                backtrace(&frame, 1);
+                        }
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+void iotracer_backtrace_stats_dump(FILE *file)
+{
+        iolib_safe_fprintf(file, "unwinder=%s\nunwinder_fallback_count=%llu\n", unwinder_names[unwinder],
+                        atomic_load(&framepointer_fallback_count));
+        fflush(file);
+}
+
+/**
+ * Enter a read-side critical section on lib_addr_table. Lock-free: the cost is a store to a thread-local record.
+ *
+ * @return the reader record of the calling thread, to be given to lib_addr_read_unlock()
+ */
+static struct lib_addr_reader *lib_addr_read_lock(void)
+{
+        struct lib_addr_reader *reader = lib_addr_thread_reader;
+        if (!reader) {
+                reader = (struct lib_addr_reader*)calloc(1, sizeof(*reader));
+                if (!reader) {
+                        iolib_safe_fprintf(stderr, "*** Fatal: lib_addr_read_lock: out of memory\n");
+                        exit(1);
+                }
+                /* Records are never freed: a record of a dead thread just stays quiescent */
+                struct lib_addr_reader *head = atomic_load(&lib_addr_readers);
+                do {
+                        reader->lar_next = head;
+                } while (!atomic_compare_exchange_weak(&lib_addr_readers, &head, reader));
+                lib_addr_thread_reader = reader;
+        }
+
+        /* Must be visible before the table is loaded, hence the sequentially consistent store */
+        atomic_store(&reader->lar_epoch, atomic_load_explicit(&lib_addr_epoch, memory_order_relaxed));
+        return reader;
+}
+
+static void lib_addr_read_unlock(struct lib_addr_reader *reader)
+{
+        atomic_store_explicit(&reader->lar_epoch, 0, memory_order_release);
+}
+
+/**
+ * @return the oldest epoch a reader is in, or ULONG_MAX if none is reading
+ */
+static unsigned long lib_addr_oldest_reader_epoch(void)
+{
+        unsigned long oldest = ULONG_MAX;
+        for (struct lib_addr_reader *r = atomic_load(&lib_addr_readers); r; r = r->lar_next) {
+                unsigned long e = atomic_load(&r->lar_epoch);
+                if (e != 0 && e < oldest)
+                        oldest = e;
+        }
+        return oldest;
+}
+
+static void lib_addr_table_free(struct lib_addr_table *t)
+{
+        free(t->lt_starts);
+        free(t->lt_ends);
+        free(t);
+}
+
+/**
+ * Free the retired tables no reader can still hold. Must be called with lib_addr_table_rebuild_lock held.
+ */
+static void lib_addr_reclaim(void)
+{
+        unsigned long oldest = lib_addr_oldest_reader_epoch();
+        struct lib_addr_table *kept = NULL;
+        struct lib_addr_table *t = atomic_exchange(&lib_addr_retired_tables, NULL);
+        while (t) {
+                struct lib_addr_table *next = t->lt_retired_next;
+                if (oldest >= t->lt_retired_epoch) {
+                        lib_addr_table_free(t);
+                } else {
+                        t->lt_retired_next = kept;
+                        kept = t;
+                }
+                t = next;
+        }
+        atomic_store(&lib_addr_retired_tables, kept);
 }
 
 /**
@@ -149,97 +450,150 @@ unsigned long long get_hash_for_current_backtrace(unsigned int call_stack_depth)
 {
         unsigned long addrs[call_stack_depth];
         int n = fast_backtrace((void **)addrs, call_stack_depth);
+        return get_hash_for_backtrace(addrs, n);
+}
+
+/**
+ * Get a hash for an already captured backtrace.
+ */
+unsigned long long get_hash_for_backtrace(unsigned long *addrs, int n)
+{
+        make_backtrace_relative(addrs, n);
+        return MurmurHash64A(addrs, n * sizeof(unsigned long), GRIOT_SEED);
+}
+
+/**
+ * Make all addresses relative to the start of their lib.
+ */
+void make_backtrace_relative(unsigned long *addrs, int n)
+{
         int i;
 
-        /* Make all addresses relative to the start of their lib */
-        //pthread_mutex_lock(&addr_ranges_lock);
+        struct lib_addr_reader *reader = lib_addr_read_lock();
+        const struct lib_addr_table *t = atomic_load(&lib_addr_table);
         for (i = 0; i < n; i++)
-                addrs[i] = get_lib_offset_for_addr(addrs[i]);
-        //pthread_mutex_unlock(&addr_ranges_lock);
-
-        return MurmurHash64A(addrs, n * sizeof(unsigned long), GRIOT_SEED);
+                addrs[i] = get_lib_offset_for_addr(t, addrs[i]);
+        lib_addr_read_unlock(reader);
+
+        /* Tables retired by a dlclose() are freed here, unless a rebuild is already running */
+        if (atomic_load_explicit(&lib_addr_retired_tables, memory_order_relaxed)
+                        && pthread_mutex_trylock(&lib_addr_table_rebuild_lock) == 0) {
+                lib_addr_reclaim();
+                pthread_mutex_unlock(&lib_addr_table_rebuild_lock);
+        }
 }
 
 
 
 /**
- * Add a single address range to the list
+ * Add a single address range to a table being built
  *
+ * @param[in] t the table to add the range to
+ * @param[in] capacity pointer to the number of ranges the table arrays can hold
  * @param[in] start start address of the range
  * @param[in] end end address of the range. (Does not actually belong to the range)
- * @param[in] list_head pointer to the head of the list where to add the new ranges
  */
-static void add_lib_addr_range(struct lib_addr_range **list_head, unsigned long start, unsigned long end)
+static void add_lib_addr_range(struct lib_addr_table *t, unsigned long *capacity, unsigned long start, unsigned long end)
 {
-        struct lib_addr_range *r = (struct lib_addr_range*)malloc(sizeof(*r));
-        if (!r) {
-                iolib_safe_fprintf(stderr, "*** Fatal: add_lib_addr_range: out of memory\n");
-                exit(1);
+        if (t->lt_count == *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 64;
+                t->lt_starts = (unsigned long*)realloc(t->lt_starts, *capacity * sizeof(unsigned long));
+                t->lt_ends = (unsigned long*)realloc(t->lt_ends, *capacity * sizeof(unsigned long));
+                if (!t->lt_starts || !t->lt_ends) {
+                        iolib_safe_fprintf(stderr, "*** Fatal: add_lib_addr_range: out of memory\n");
+                        exit(1);
+                }
+        }
+
+        /* Objects are not reported in address order, keep the table sorted as it is filled */
+        unsigned long i = t->lt_count++;
+        while (i > 0 && t->lt_starts[i-1] > start) {
+                t->lt_starts[i] = t->lt_starts[i-1];
+                t->lt_ends[i] = t->lt_ends[i-1];
+                i--;
         }
-        r->lr_start = start;
-        r->lr_end = end;
-        r->lr_next = *list_head;
-        *list_head = r;
+        t->lt_starts[i] = start;
+        t->lt_ends[i] = end;
 }
 
+struct lib_addr_table_builder {
+        struct lib_addr_table *b_table;
+        unsigned long b_capacity;
+        unsigned long b_page_size;
+};
+
 /**
- * Build the lib address range list for the current process.
- * Question: WHEN should this be done ? Should we handle dlclose() ?
+ * dl_iterate_phdr() callback. Adds the executable segments of a loaded object to the table.
+ * Segments are rounded to pages, so that the offsets are relative to the start of the mapping like they were with
+ * the maps file.
+ */
+static int add_lib_addr_ranges_of_object(struct dl_phdr_info *info, size_t size, void *data)
+{
+        struct lib_addr_table_builder *b = (struct lib_addr_table_builder*)data;
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+                const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+                if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X) || phdr->p_memsz == 0)
+                        continue;
+                unsigned long start = info->dlpi_addr + phdr->p_vaddr;
+                unsigned long end = start + phdr->p_memsz;
+                start &= ~(b->b_page_size - 1);
+                end = (end + b->b_page_size - 1) & ~(b->b_page_size - 1);
+                add_lib_addr_range(b->b_table, &b->b_capacity, start, end);
+        }
+        return 0;
+}
+
+/**
+ * Build the lib address range table for the current process, from the program headers of the loaded objects.
+ * Unlike parsing /proc/self/maps, this does no I/O and no parsing.
  *
- * @param[in] list_head pointer to the head of the list where to add the new ranges
+ * @param[in] t the empty table where to add the new ranges
  */
-static void build_lib_addr_range_list(struct lib_addr_range **list_head)
+static void build_lib_addr_range_table(struct lib_addr_table *t)
 {
-        const int LINE = 1000;
-        char line[LINE];
+        struct lib_addr_table_builder b = {.b_table = t, .b_capacity = 0, .b_page_size = sysconf(_SC_PAGESIZE)};
+        dl_iterate_phdr(add_lib_addr_ranges_of_object, &b);
+}
 
-#ifdef IOTRACER_STDIO_HOOKS
-        FILE *f = iotracer_safe_fopen(MAPS_FILE, "r");
-#else
-        FILE *f = fopen(MAPS_FILE, "r");
-#endif
-        char perms[5];
-        unsigned long start, end;
-        if(!f){
-                iolib_safe_fprintf(stderr, "[fastio-iotracer] could not open %s\n", MAPS_FILE);
+/* Rebuild the table of address ranges. Called at init, and after dlopen() and dlclose().
+ * Neither the readers nor the rebuild are blocked: the new table is published with an atomic swap, and the old one is
+ * retired, to be freed once every reader that could still be using it is done.
+ */
+void rebuild_lib_addr_range_list(void)
+{
+        struct lib_addr_table *new_table = (struct lib_addr_table*)calloc(1, sizeof(*new_table));
+        if (!new_table) {
+                iolib_safe_fprintf(stderr, "*** Fatal: rebuild_lib_addr_range_list: out of memory\n");
                 exit(1);
         }
-        for (;;) {
-                #ifdef IOTRACER_STDIO_HOOKS
-                if (!iotracer_safe_fgets(line, LINE, f))
-                #else
-                if (!fgets(line, LINE, f))
-                #endif
-                        break;
-                if (3 != sscanf(line, "%lx-%lx %4s", &start, &end, perms))
-                        break;
-                if ('x' == perms[2])
-                        add_lib_addr_range(list_head, start, end);
+
+        pthread_mutex_lock(&lib_addr_table_rebuild_lock);
+        build_lib_addr_range_table(new_table);
+        new_table->lt_generation = ++lib_addr_table_generation;
+
+        /* switch to new table */
+        struct lib_addr_table *old_table = atomic_exchange(&lib_addr_table, new_table);
+
+        /* Readers entering from now on cannot get the old table */
+        if (old_table != &lib_addr_table_empty) {
+                old_table->lt_retired_epoch = atomic_fetch_add(&lib_addr_epoch, 1) + 1;
+                old_table->lt_retired_next = atomic_load(&lib_addr_retired_tables);
+                atomic_store(&lib_addr_retired_tables, old_table);
         }
-#ifdef IOTRACER_STDIO_HOOKS
-        iotracer_safe_fclose(f);
-#else
-        fclose(f);
-#endif
+        lib_addr_reclaim();
+        pthread_mutex_unlock(&lib_addr_table_rebuild_lock);
 }
 
-/* Rebuild the list of address ranges.
- * May be called after dlopen(), and possibly dlclose(), but I don't see the point of that.
+/**
+ * pthread_atfork() child handler. Only the forking thread survives: the rebuild lock may have been held by another
+ * thread, and so may reader records, that would never be released.
  */
-void rebuild_lib_addr_range_list(void)
+static void lib_addr_table_atfork_child(void)
 {
-        struct lib_addr_range *new_head = NULL;
-        struct lib_addr_range *oldlist = lib_addr_ranges;
-        build_lib_addr_range_list(&new_head);
-        /* switch to new list */
-        lib_addr_ranges = new_head;
-
-        /* Free old list */
-        while (oldlist) {
-                struct lib_addr_range *next = oldlist->lr_next;
-                free(oldlist);
-                oldlist = next;
-        }
+        pthread_mutex_init(&lib_addr_table_rebuild_lock, NULL);
+        for (struct lib_addr_reader *r = atomic_load(&lib_addr_readers); r; r = r->lar_next)
+                atomic_store(&r->lar_epoch, 0);
+        lib_addr_reclaim();
 }
 
 void export_backtrace_table(){
@@ -259,24 +613,162 @@ void export_backtrace_table(){
 }
 
 #ifdef IOTRACER_DLOPEN_SUPPORT
+/**
+ * In order to keep the lib loading table up to date, we create wrappers around dlopen and dlclose. The original pointers are kept here.
+ */
+static void *(*iotracer_safe_dlopen)(const char *filename, int flag);
+static int (*iotracer_safe_dlclose)(void *handle);
+
+static void iotracer_dlopen_symbols_init(void)
+{
+        if (!iotracer_safe_dlopen) iotracer_safe_dlopen = dlsym(RTLD_NEXT, "dlopen");
+        if (!iotracer_safe_dlclose) iotracer_safe_dlclose = dlsym(RTLD_NEXT, "dlclose");
+        if (!iotracer_safe_dlopen || !iotracer_safe_dlclose) {
+                iolib_safe_fprintf(stderr, "fastio-iotracer failed to map dlopen/dlclose symbols\n");
+                exit(1);
+        }
+}
+
 void *dlopen(const char *filename, int flag){
+        /* dlopen() may be called by a constructor before iotracer_backtrace_table_init() */
+        if (!iotracer_safe_dlopen) iotracer_dlopen_symbols_init();
         void *return_value = iotracer_safe_dlopen(filename, flag);
-		
-        pthread_mutex_lock(&addr_ranges_lock);
-        rebuild_lib_addr_range_list();
-        pthread_mutex_unlock(&addr_ranges_lock);
+        if (return_value)
+                rebuild_lib_addr_range_list();
+        return return_value;
+}
 
+int dlclose(void *handle){
+        if (!iotracer_safe_dlclose) iotracer_dlopen_symbols_init();
+        int return_value = iotracer_safe_dlclose(handle);
+        if (return_value == 0)
+                rebuild_lib_addr_range_list();
         return return_value;
 }
 #endif
 
 void iotracer_backtrace_table_init(void){
-	rebuild_lib_addr_range_list();
 #ifdef IOTRACER_DLOPEN_SUPPORT
-	if(iotracer_safe_dlopen==0) iotracer_safe_dlopen = dlsym(RTLD_NEXT, "dlopen");
-    if(!iotracer_safe_dlopen){
-        iolib_safe_fprintf(stderr, "fastio-iotracer failed to map dlopen symbol\n");
-        exit(1);
-    }
+	iotracer_dlopen_symbols_init();
+#endif
+	pthread_atfork(NULL, NULL, lib_addr_table_atfork_child);
+#ifdef IOTRACER_NO_LIBUNWIND
+	/* The frame pointer walk falls back to glibc, whose first backtrace() call loads libgcc_s. Better do it now than
+	 * from an I/O hook. */
+	void *frame;
+	backtrace(&frame, 1);
+#endif
+	rebuild_lib_addr_range_list();
+}
+
+//==============================================================================
+// TESTS AND BENCHMARKS
+// $ cc -DBACKTRACE_TEST -D_GNU_SOURCE -fno-omit-frame-pointer -I../preload backtrace.c griot_hash.c log.c -lunwind && ./a.out
+// $ cc -DBACKTRACE_TEST -D_GNU_SOURCE -O3 -fno-omit-frame-pointer -I../preload backtrace.c griot_hash.c log.c -lunwind && BENCH=1 ./a.out
+// Add -DIOTRACER_NO_LIBUNWIND, and drop -lunwind, to build without libunwind.
+//==============================================================================
+#ifdef BACKTRACE_TEST
+
+#include <assert.h>
+#include <time.h>
+
+#define BACKTRACE_TEST_MAX_DEPTH 64
+
+typedef void (*backtrace_test_fn)(int depth);
+
+/* Called through a pointer, so that it is not inlined into the tests: the hooks call it from other files */
+static int (*volatile unwind)(void **array, int size) = fast_backtrace;
+
+/* Recurses so that the stack is at least depth frames deep below the call to fn. The barrier keeps the calls from
+ * being turned into jumps. */
+static __attribute__((noinline)) void recurse(int depth, backtrace_test_fn fn, int fn_depth)
+{
+        if (depth > 0)
+                recurse(depth - 1, fn, fn_depth);
+        else
+                fn(fn_depth);
+        __asm__ volatile("" ::: "memory");
+}
+
+static __attribute__((noinline)) void test_framepointer(int depth)
+{
+        void *fp_frames[BACKTRACE_TEST_MAX_DEPTH], *glibc_frames[BACKTRACE_TEST_MAX_DEPTH+1];
+        assert(iotracer_backtrace_set_unwinder("glibc") == 0);
+        int glibc_n = unwind(glibc_frames, depth+1);
+        assert(iotracer_backtrace_set_unwinder("framepointer") == 0);
+        unsigned long long fallbacks = atomic_load(&framepointer_fallback_count);
+        int fp_n = unwind(fp_frames, depth);
+
+        /* The frame pointer walk starts at the caller of fast_backtrace(). glibc starts within it, unless backtrace()
+         * was tail called. The two calls are on different lines, so only the frames above this function are compared. */
+        assert(fp_n == depth && glibc_n == depth+1);
+        assert(atomic_load(&framepointer_fallback_count) == fallbacks);
+        int shift = (depth > 1 && fp_frames[1] == glibc_frames[1]) ? 0 : 1;
+        for (int i = 1; i < depth; i++)
+                assert(fp_frames[i] == glibc_frames[i+shift]);
+        __asm__ volatile("" ::: "memory");
+}
+
+static void all(void)
+{
+        int depths[] = {1, 4, 16, BACKTRACE_TEST_MAX_DEPTH};
+        for (int i = 0; i < (int)(sizeof(depths)/sizeof(depths[0])); i++)
+                recurse(BACKTRACE_TEST_MAX_DEPTH, test_framepointer, depths[i]);
+
+        /* The walk ends at the outermost frame. The libc startup code may leave garbage in the frame pointer of
+         * main(): the first walk then falls back, and the next ones know where the chain ends. */
+        void *frames[4096], *frames_again[4096];
+        assert(iotracer_backtrace_set_unwinder("framepointer") == 0);
+        int n = unwind(frames, 4096);
+        unsigned long long fallbacks = atomic_load(&framepointer_fallback_count);
+        int n_again = unwind(frames_again, 4096);
+        assert(n > 0 && n < 4096 && n_again == n);
+        assert(atomic_load(&framepointer_fallback_count) == fallbacks);
+        for (int i = 1; i < n; i++)
+                assert(frames_again[i] == frames[i]);
+}
+
+static int bench_count;
+
+static __attribute__((noinline)) void bench_unwind(int depth)
+{
+        void *frames[BACKTRACE_TEST_MAX_DEPTH];
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int i = 0; i < bench_count; i++) {
+                unwind(frames, depth);
+                __asm__ volatile("" :: "r"(frames) : "memory");
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        printf("%-12s depth=%-3d %8.1f ns/op\n", unwinder_names[unwinder], depth, ns / bench_count);
+}
+
+static void benchmarks(void)
+{
+        bench_count = getenv("N") ? atoi(getenv("N")) : 100000;
+        printf("count=%d\n", bench_count);
+
+        int depths[] = {4, 16, 64};
+        for (int u = 0; u < (int)(sizeof(unwinder_names)/sizeof(unwinder_names[0])); u++) {
+                if (iotracer_backtrace_set_unwinder(unwinder_names[u]) < 0)
+                        continue;
+                for (int i = 0; i < (int)(sizeof(depths)/sizeof(depths[0])); i++)
+                        recurse(BACKTRACE_TEST_MAX_DEPTH, bench_unwind, depths[i]);
+        }
+        printf("unwinder_fallback_count=%llu\n", atomic_load(&framepointer_fallback_count));
+}
+
+int main(void)
+{
+        if (getenv("BENCH")) {
+                printf("Running backtrace.c benchmarks...\n");
+                benchmarks();
+        } else {
+                printf("Running backtrace.c tests...\n");
+                all();
+                printf("PASSED\n");
+        }
+}
+
 #endif
-}
\ No newline at end of file
@@ -1,28 +1,54 @@
 #ifndef IOTRACER_BACKTRACE_H
 #define IOTRACER_BACKTRACE_H
 
+#include <stdio.h>
+
+#include "griot_hash.h"
+
 /**
- * Called at the library loading time.
+ * Called at the library loading time. When built with IOTRACER_DLOPEN_SUPPORT, the table is kept up to date across
+ * dlopen() and dlclose().
  */
 void iotracer_backtrace_table_init(void);
 
+/**
+ * Select the unwinder used to capture call stacks: "libunwind" (default), "framepointer" or "glibc".
+ * The frame pointer walk falls back to libunwind when the chain looks broken.
+ * When built with IOTRACER_NO_LIBUNWIND, "framepointer" is the default, and falls back to glibc.
+ *
+ * @return 0 upon success, -1 if the unwinder is unknown
+ */
+int iotracer_backtrace_set_unwinder(const char *name);
+
+/**
+ * Print the unwinder in use, and how many times it had to fall back to libunwind
+ */
+void iotracer_backtrace_stats_dump(FILE *file);
+
 /**
  * Get a hash for the current backtrace, and register it into the internal hash map.
  */
 unsigned long long get_hash_for_current_backtrace(unsigned int call_stack_depth);
 
 /**
- * Write the backtrace hash map to the disk. Currently not implemented
+ * Capture the raw return addresses of the current backtrace. Returns the number of frames written in array.
  */
-void export_backtrace_table(void);
+int fast_backtrace(void **array, int size);
 
-u_int64_t MurmurHash64A(const void *key, int len, u_int64_t seed);
+/**
+ * Get a hash for a backtrace captured earlier with fast_backtrace. Addresses are made relative in place.
+ */
+unsigned long long get_hash_for_backtrace(unsigned long *addrs, int n);
 
-#ifdef IOTRACER_DLOPEN_SUPPORT
 /**
- * In order to keep the lib loading table up to date, we create a wrapper around the dlopen function. The original pointer is kept here.
- * dlclose could also be monitored, but it's not really necessary
+ * Make the addresses of a backtrace captured earlier with fast_backtrace relative to the start of their lib, in place.
+ * The hash of the first n relative addresses is MurmurHash64A(addrs, n * sizeof(unsigned long), GRIOT_SEED).
  */
-void *(*iotracer_safe_dlopen)(const char *filename, int flag); 
+void make_backtrace_relative(unsigned long *addrs, int n);
+
+/**
+ * Write the backtrace hash map to the disk. Currently not implemented
+ */
+void export_backtrace_table(void);
+
 #endif
-#endif
\ No newline at end of file
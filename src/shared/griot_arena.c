@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "griot_arena.h"
+#include "log.h"
+
+/** Blocks sizes, header included, are powers of two from 32 bytes to 64 KiB */
+#define GRIOT_ARENA_MIN_BLOCK_SHIFT 5
+#define GRIOT_ARENA_CLASS_COUNT 12
+
+/** Chunks start small, as most per-fd arenas only hold a few nodes, and double up to 1 MiB */
+#define GRIOT_ARENA_FIRST_CHUNK_SIZE 4096
+#define GRIOT_ARENA_MAX_CHUNK_SIZE (1024*1024)
+
+typedef struct
+{
+    // NULL for blocks allocated straight from the heap
+    griot_arena *arena;
+
+    // Usable size of the block
+    size_t size;
+} griot_arena_block_header;
+
+typedef struct griot_arena_chunk
+{
+    struct griot_arena_chunk *next;
+    size_t size;
+} griot_arena_chunk;
+
+typedef struct griot_arena_large_block
+{
+    struct griot_arena_large_block *prev;
+    struct griot_arena_large_block *next;
+} griot_arena_large_block;
+
+struct griot_arena
+{
+    // Blocks are carved at the end of the most recent chunk
+    griot_arena_chunk *chunks;
+    char *bump;
+    char *bump_end;
+    size_t next_chunk_size;
+
+    // Freed blocks of each size class, linked through their first bytes
+    void *free_lists[GRIOT_ARENA_CLASS_COUNT];
+
+    // Blocks too large for the size classes
+    griot_arena_large_block *large_blocks;
+
+    // Bytes obtained from malloc by this arena
+    size_t reserved_bytes;
+    size_t high_water_bytes;
+
+    // Bytes of the blocks handed out, and where they are reported
+    size_t used_bytes;
+    griot_arena_usage *usage;
+};
+
+static struct
+{
+    _Atomic uint64_t arena_count;
+    _Atomic uint64_t allocation_count;
+    _Atomic uint64_t large_allocation_count;
+    _Atomic uint64_t reserved_bytes;
+    _Atomic uint64_t reserved_bytes_high_water;
+    _Atomic uint64_t max_arena_high_water;
+} griot_arena_stats;
+
+static __thread griot_arena *griot_arena_current;
+
+static void griot_arena_atomic_max(_Atomic uint64_t *max, uint64_t value)
+{
+    uint64_t current = atomic_load_explicit(max, memory_order_relaxed);
+    while(value>current && !atomic_compare_exchange_weak_explicit(max, &current, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+/**
+ * Account for memory obtained from (or given back to) malloc. Only called once per chunk or large block.
+ */
+static void griot_arena_reserve(griot_arena *arena, int64_t bytes)
+{
+    arena->reserved_bytes += bytes;
+    if(arena->reserved_bytes>arena->high_water_bytes){
+        arena->high_water_bytes = arena->reserved_bytes;
+        griot_arena_atomic_max(&griot_arena_stats.max_arena_high_water, arena->high_water_bytes);
+    }
+    uint64_t total = atomic_fetch_add_explicit(&griot_arena_stats.reserved_bytes, bytes, memory_order_relaxed) + bytes;
+    griot_arena_atomic_max(&griot_arena_stats.reserved_bytes_high_water, total);
+}
+
+/**
+ * Account for a block handed out (or given back, if negative), header included
+ */
+static void griot_arena_use(griot_arena *arena, int64_t bytes)
+{
+    arena->used_bytes += bytes;
+    griot_arena_usage *usage = arena->usage;
+    if(usage){
+        usage->used_bytes += bytes;
+        if(usage->used_bytes>usage->used_bytes_high_water) usage->used_bytes_high_water = usage->used_bytes;
+    }
+}
+
+static void griot_arena_grow(griot_arena *arena, size_t block_size)
+{
+    size_t chunk_size = arena->next_chunk_size;
+    if(chunk_size<sizeof(griot_arena_chunk)+block_size) chunk_size = sizeof(griot_arena_chunk)+block_size;
+    griot_arena_chunk *chunk = (griot_arena_chunk *)malloc(chunk_size);
+    if(!chunk) FATAL("Out of memory");
+    chunk->size = chunk_size;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->bump = (char *)(chunk+1);
+    arena->bump_end = (char *)chunk + chunk_size;
+    if(arena->next_chunk_size<GRIOT_ARENA_MAX_CHUNK_SIZE) arena->next_chunk_size *= 2;
+    griot_arena_reserve(arena, chunk_size);
+}
+
+griot_arena *griot_arena_new()
+{
+    // The arena lives at the start of its own first chunk
+    griot_arena_chunk *chunk = (griot_arena_chunk *)malloc(GRIOT_ARENA_FIRST_CHUNK_SIZE);
+    if(!chunk) FATAL("Out of memory");
+    chunk->size = GRIOT_ARENA_FIRST_CHUNK_SIZE;
+    chunk->next = NULL;
+
+    griot_arena *arena = (griot_arena *)(chunk+1);
+    memset(arena, 0, sizeof(griot_arena));
+    arena->chunks = chunk;
+    arena->bump = (char *)arena + ((sizeof(griot_arena)+15) & ~(size_t)15);
+    arena->bump_end = (char *)chunk + GRIOT_ARENA_FIRST_CHUNK_SIZE;
+    arena->next_chunk_size = GRIOT_ARENA_FIRST_CHUNK_SIZE*2;
+
+    atomic_fetch_add_explicit(&griot_arena_stats.arena_count, 1, memory_order_relaxed);
+    griot_arena_reserve(arena, GRIOT_ARENA_FIRST_CHUNK_SIZE);
+    return arena;
+}
+
+void griot_arena_set_usage(griot_arena *arena, griot_arena_usage *usage)
+{
+    size_t used_bytes = arena->used_bytes;
+    arena->used_bytes = 0;
+    arena->usage = usage;
+    griot_arena_use(arena, used_bytes);
+}
+
+void griot_arena_usage_reset_high_water(griot_arena_usage *usage)
+{
+    usage->used_bytes_high_water = usage->used_bytes;
+}
+
+size_t griot_arena_used_bytes(const griot_arena *arena)
+{
+    return arena->used_bytes;
+}
+
+void griot_arena_destroy(griot_arena *arena)
+{
+    if(arena==NULL) return;
+    if(arena->usage) arena->usage->used_bytes -= arena->used_bytes;
+    atomic_fetch_sub_explicit(&griot_arena_stats.reserved_bytes, arena->reserved_bytes, memory_order_relaxed);
+
+    griot_arena_large_block *large_block = arena->large_blocks;
+    while(large_block){
+        griot_arena_large_block *next = large_block->next;
+        free(large_block);
+        large_block = next;
+    }
+
+    // The first chunk, that holds the arena itself, is the last of the list
+    griot_arena_chunk *chunk = arena->chunks;
+    while(chunk){
+        griot_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+void *griot_arena_malloc(griot_arena *arena, size_t size)
+{
+    atomic_fetch_add_explicit(&griot_arena_stats.allocation_count, 1, memory_order_relaxed);
+    griot_arena_block_header *header;
+
+    if(arena==NULL){
+        header = (griot_arena_block_header *)malloc(sizeof(griot_arena_block_header)+size);
+        if(!header) FATAL("Out of memory");
+        header->arena = NULL;
+        header->size = size;
+        return header+1;
+    }
+
+    // Smallest size class that fits the block and its header
+    size_t needed = sizeof(griot_arena_block_header)+size;
+    unsigned int size_class = needed<=(1<<GRIOT_ARENA_MIN_BLOCK_SHIFT) ? 0 : 64-__builtin_clzl(needed-1)-GRIOT_ARENA_MIN_BLOCK_SHIFT;
+
+    if(size_class>=GRIOT_ARENA_CLASS_COUNT){
+        atomic_fetch_add_explicit(&griot_arena_stats.large_allocation_count, 1, memory_order_relaxed);
+        griot_arena_large_block *large_block = (griot_arena_large_block *)malloc(sizeof(griot_arena_large_block)+needed);
+        if(!large_block) FATAL("Out of memory");
+        large_block->prev = NULL;
+        large_block->next = arena->large_blocks;
+        if(arena->large_blocks) arena->large_blocks->prev = large_block;
+        arena->large_blocks = large_block;
+        griot_arena_reserve(arena, sizeof(griot_arena_large_block)+needed);
+        griot_arena_use(arena, sizeof(griot_arena_large_block)+needed);
+
+        header = (griot_arena_block_header *)(large_block+1);
+        header->arena = arena;
+        header->size = size;
+        return header+1;
+    }
+
+    // Reuse a freed block if possible, else carve a new one
+    size_t block_size = (size_t)1<<(size_class+GRIOT_ARENA_MIN_BLOCK_SHIFT);
+    griot_arena_use(arena, block_size);
+    header = arena->free_lists[size_class];
+    if(header){
+        arena->free_lists[size_class] = *(void **)(header+1);
+        return header+1;
+    }
+    if((size_t)(arena->bump_end-arena->bump)<block_size) griot_arena_grow(arena, block_size);
+    header = (griot_arena_block_header *)arena->bump;
+    arena->bump += block_size;
+    header->arena = arena;
+    header->size = block_size-sizeof(griot_arena_block_header);
+    return header+1;
+}
+
+void griot_arena_free(void *ptr)
+{
+    if(ptr==NULL) return;
+    griot_arena_block_header *header = (griot_arena_block_header *)ptr - 1;
+    griot_arena *arena = header->arena;
+
+    if(arena==NULL){
+        free(header);
+    }else if(header->size+sizeof(griot_arena_block_header)>((size_t)1<<(GRIOT_ARENA_CLASS_COUNT-1+GRIOT_ARENA_MIN_BLOCK_SHIFT))){
+        griot_arena_large_block *large_block = (griot_arena_large_block *)header - 1;
+        if(large_block->prev) large_block->prev->next = large_block->next;
+        else arena->large_blocks = large_block->next;
+        if(large_block->next) large_block->next->prev = large_block->prev;
+        griot_arena_reserve(arena, -(int64_t)(sizeof(griot_arena_large_block)+sizeof(griot_arena_block_header)+header->size));
+        griot_arena_use(arena, -(int64_t)(sizeof(griot_arena_large_block)+sizeof(griot_arena_block_header)+header->size));
+        free(large_block);
+    }else{
+        griot_arena_use(arena, -(int64_t)(header->size+sizeof(griot_arena_block_header)));
+        unsigned int size_class = __builtin_ctzl(header->size+sizeof(griot_arena_block_header))-GRIOT_ARENA_MIN_BLOCK_SHIFT;
+        *(void **)ptr = arena->free_lists[size_class];
+        arena->free_lists[size_class] = header;
+    }
+}
+
+void *griot_arena_realloc(void *ptr, size_t size)
+{
+    if(ptr==NULL) return griot_arena_malloc(griot_arena_current, size);
+    griot_arena_block_header *header = (griot_arena_block_header *)ptr - 1;
+
+    if(header->arena==NULL){
+        header = (griot_arena_block_header *)realloc(header, sizeof(griot_arena_block_header)+size);
+        if(!header) FATAL("Out of memory");
+        header->size = size;
+        return header+1;
+    }
+
+    // Blocks are rounded up to their size class, so growing often fits in place
+    if(size<=header->size) return ptr;
+    void *new_ptr = griot_arena_malloc(header->arena, size);
+    memcpy(new_ptr, ptr, header->size);
+    griot_arena_free(ptr);
+    return new_ptr;
+}
+
+griot_arena *griot_arena_set_current(griot_arena *arena)
+{
+    griot_arena *previous = griot_arena_current;
+    griot_arena_current = arena;
+    return previous;
+}
+
+static void *griot_arena_current_malloc(size_t size)
+{
+    return griot_arena_malloc(griot_arena_current, size);
+}
+
+hashmap *griot_arena_hashmap_new(griot_arena *arena, size_t elsize,
+    uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1),
+    int (*compare)(const void *a, const void *b, void *udata),
+    void (*elfree)(void *item))
+{
+    griot_arena *previous = griot_arena_set_current(arena);
+    hashmap *map = hashmap_new_with_allocator(griot_arena_current_malloc, griot_arena_realloc, griot_arena_free, elsize, 0, 0, 0,
+        hash, compare, elfree, NULL);
+    griot_arena_set_current(previous);
+    if(!map) FATAL("Out of memory");
+    return map;
+}
+
+const void *griot_arena_hashmap_set(griot_arena *arena, hashmap *map, const void *item)
+{
+    griot_arena *previous = griot_arena_set_current(arena);
+    const void *replaced = hashmap_set(map, item);
+    griot_arena_set_current(previous);
+    if(hashmap_oom(map)) FATAL("Out of memory");
+    return replaced;
+}
+
+const void *griot_arena_hashmap_delete(griot_arena *arena, hashmap *map, const void *item)
+{
+    griot_arena *previous = griot_arena_set_current(arena);
+    const void *deleted = hashmap_delete(map, item);
+    griot_arena_set_current(previous);
+    return deleted;
+}
+
+void griot_arena_results_dump(FILE *file)
+{
+    iolib_safe_fprintf(file, "arena_count=%lu\narena_allocation_count=%lu\narena_large_allocation_count=%lu\narena_reserved_bytes=%lu\n"
+            "arena_reserved_bytes_high_water=%lu\narena_max_single_arena_high_water=%lu\n",
+            atomic_load(&griot_arena_stats.arena_count),
+            atomic_load(&griot_arena_stats.allocation_count),
+            atomic_load(&griot_arena_stats.large_allocation_count),
+            atomic_load(&griot_arena_stats.reserved_bytes),
+            atomic_load(&griot_arena_stats.reserved_bytes_high_water),
+            atomic_load(&griot_arena_stats.max_arena_high_water));
+    fflush(file);
+}
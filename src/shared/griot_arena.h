@@ -0,0 +1,96 @@
+#ifndef GRIOT_ARENA_H
+#define GRIOT_ARENA_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "hashmap.h"
+
+/**
+ * GrIOt-owned arena allocator.
+ *
+ * Blocks are carved out of chunks obtained from malloc, with one free list per power of two size class, and blocks
+ * larger than the biggest class get their own allocation. Every block starts with a small header holding its owning
+ * arena, so griot_arena_free and griot_arena_realloc do not need to be told which arena to use.
+ *
+ * Destroying an arena releases every block allocated from it at once, without walking the data structures that
+ * live in it. The model state of a file descriptor, or of a whole shard, gets its own arena for that reason.
+ *
+ * Arenas are not thread-safe: like the shards, an arena must only be used by one thread at a time.
+ */
+typedef struct griot_arena griot_arena;
+
+/**
+ * Exact count of the bytes of the blocks handed out by a group of arenas, headers and size class rounding included,
+ * and its high-water mark. Updated on every allocation and free, so reading it is O(1).
+ * Like the arenas reporting to it, it must only be used by one thread at a time.
+ */
+typedef struct
+{
+    uint64_t used_bytes;
+    uint64_t used_bytes_high_water;
+} griot_arena_usage;
+
+griot_arena *griot_arena_new();
+
+/**
+ * Make the arena report its blocks to usage, those already allocated included. usage may live in the arena itself.
+ */
+void griot_arena_set_usage(griot_arena *arena, griot_arena_usage *usage);
+
+/**
+ * Forget the high-water mark of usage, e.g. when the results are reset
+ */
+void griot_arena_usage_reset_high_water(griot_arena_usage *usage);
+
+/**
+ * Release every block of the arena, and the arena itself. Its blocks are subtracted from its usage.
+ */
+void griot_arena_destroy(griot_arena *arena);
+
+/**
+ * @return the bytes of the blocks currently handed out by the arena, headers included
+ */
+size_t griot_arena_used_bytes(const griot_arena *arena);
+
+/**
+ * Allocate size bytes from the arena. With a NULL arena, the block comes straight from the heap.
+ * Never returns NULL.
+ */
+void *griot_arena_malloc(griot_arena *arena, size_t size);
+
+/**
+ * Resize a block within the arena it was allocated from
+ */
+void *griot_arena_realloc(void *ptr, size_t size);
+
+/**
+ * Give a block back to the arena it was allocated from. Optional, as destroying the arena frees every block.
+ */
+void griot_arena_free(void *ptr);
+
+/**
+ * Allocator callbacks cannot be given a context, so hashmaps allocate from the current arena of the calling thread.
+ *
+ * @return the previous current arena, to be restored afterwards
+ */
+griot_arena *griot_arena_set_current(griot_arena *arena);
+
+/**
+ * Create a hashmap whose buckets live in the arena.
+ * Operations that may grow or shrink the hashmap must go through griot_arena_hashmap_set and griot_arena_hashmap_delete.
+ */
+hashmap *griot_arena_hashmap_new(griot_arena *arena, size_t elsize,
+    uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1),
+    int (*compare)(const void *a, const void *b, void *udata),
+    void (*elfree)(void *item));
+
+const void *griot_arena_hashmap_set(griot_arena *arena, hashmap *map, const void *item);
+const void *griot_arena_hashmap_delete(griot_arena *arena, hashmap *map, const void *item);
+
+/**
+ * Print the allocation counts and the memory high-water marks of the arenas
+ */
+void griot_arena_results_dump(FILE *file);
+
+#endif
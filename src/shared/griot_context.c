@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "griot_context.h"
+#include "griot_config.h"
+#include "log.h"
+
+/** Multiplier of the polynomial hash. Must be odd. */
+#define GRIOT_CONTEXT_HASH_BASE 0x9E3779B97F4A7C15LLU
+
+/**
+ * MurmurHash3 finalizer. Call stacks are mixed before entering the polynomial hash, and so is the final hash,
+ * so that contexts differing by a single call stack do not get close hashes.
+ */
+static uint64_t griot_context_mix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdLLU;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53LLU;
+    k ^= k >> 33;
+    return k;
+}
+
+/**
+ * The window starts full of null call stacks: hash it once, in O(context_size)
+ */
+static void griot_context_hash_init(unsigned int context_size, uint64_t *rolling_hash, uint64_t *oldest_weight, uint64_t *context_hash)
+{
+    uint64_t null_call_stack = griot_context_mix(0 ^ GRIOT_SEED);
+    *rolling_hash = 0;
+    *oldest_weight = 1;
+    for(unsigned int i = 0; i<context_size; i++){
+        *rolling_hash = *rolling_hash*GRIOT_CONTEXT_HASH_BASE + null_call_stack;
+        if(i!=0) *oldest_weight *= GRIOT_CONTEXT_HASH_BASE;
+    }
+    *context_hash = griot_context_mix(*rolling_hash);
+}
+
+void griot_context_init(griot_context *context, unsigned int context_size, griot_arena *arena)
+{
+    context->context = (uint64_t *)griot_arena_malloc(arena, sizeof(uint64_t) * context_size);
+    context->context_size = context_size;
+    griot_context_reset(context);
+}
+
+void griot_context_reset(griot_context *context)
+{
+    uint64_t *ring = context->context;
+    unsigned int context_size = context->context_size;
+    memset(context, 0, sizeof(griot_context));
+    context->context = ring;
+    context->context_size = context_size;
+    memset(context->context, 0, sizeof(uint64_t) * context_size);
+
+    griot_context_hash_init(context_size, &context->rolling_hash, &context->oldest_weight, &context->context_hash);
+}
+
+void griot_context_free(griot_context *context)
+{
+    griot_arena_free(context->context);
+    context->context = NULL;
+}
+
+uint64_t griot_context_push(griot_context *context, uint64_t call_stack)
+{
+    // The oldest call stack is the one about to be overwritten
+    uint64_t oldest = griot_context_mix(context->context[context->index] ^ GRIOT_SEED);
+    uint64_t newest = griot_context_mix(call_stack ^ GRIOT_SEED);
+    context->rolling_hash = (context->rolling_hash - oldest*context->oldest_weight)*GRIOT_CONTEXT_HASH_BASE + newest;
+
+    context->context[context->index] = call_stack;
+    context->index += 1;
+    if(context->index>=context->context_size) context->index = 0;
+
+    context->context_hash = griot_context_mix(context->rolling_hash);
+    return context->context_hash;
+}
+
+void griot_context_window_init(griot_context_window *window, unsigned int context_size)
+{
+    window->context_size = context_size;
+    griot_context_hash_init(context_size, &window->rolling_hash, &window->oldest_weight, &window->context_hash);
+}
+
+uint64_t griot_context_window_push(griot_context_window *window, const griot_context *history, uint64_t call_stack)
+{
+    // The oldest call stack of the window was pushed into the history context_size call stacks ago
+    int index = history->index - (int)window->context_size;
+    if(index<0) index += history->context_size;
+    uint64_t oldest = griot_context_mix(history->context[index] ^ GRIOT_SEED);
+    uint64_t newest = griot_context_mix(call_stack ^ GRIOT_SEED);
+    window->rolling_hash = (window->rolling_hash - oldest*window->oldest_weight)*GRIOT_CONTEXT_HASH_BASE + newest;
+
+    window->context_hash = griot_context_mix(window->rolling_hash);
+    return window->context_hash;
+}
+
+//==============================================================================
+// TESTS AND BENCHMARKS
+// $ cc -DGRIOT_CONTEXT_TEST -D_GNU_SOURCE -DGRIOT_REPLAY -I../preload griot_context.c griot_arena.c hashmap.c log.c && ./a.out
+// $ cc -DGRIOT_CONTEXT_TEST -D_GNU_SOURCE -DGRIOT_REPLAY -O3 -I../preload griot_context.c griot_arena.c hashmap.c log.c && BENCH=1 ./a.out
+//==============================================================================
+#ifdef GRIOT_CONTEXT_TEST
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+static uint64_t next_call_stack(uint64_t *state)
+{
+    *state = *state*6364136223846793005LLU + 1442695040888963407LLU;
+    return *state>>32;
+}
+
+static void all(void)
+{
+    unsigned int sizes[] = {1, 2, 3, 16, 1024};
+    for(unsigned int s = 0; s<sizeof(sizes)/sizeof(sizes[0]); s++){
+        unsigned int context_size = sizes[s];
+        griot_context history, context, fresh;
+        griot_context_init(&history, 1024, NULL);
+        griot_context_init(&context, context_size, NULL);
+        griot_context_init(&fresh, context_size, NULL);
+        griot_context_window window;
+        griot_context_window_init(&window, context_size);
+        assert(window.context_hash==context.context_hash);
+
+        // (1) A window of the history hashes like a context of the same size
+        uint64_t state = context_size;
+        uint64_t call_stacks[4096];
+        for(int i = 0; i<4096; i++){
+            call_stacks[i] = next_call_stack(&state)%8;
+            uint64_t hash = griot_context_push(&context, call_stacks[i]);
+            assert(griot_context_window_push(&window, &history, call_stacks[i])==hash);
+            griot_context_push(&history, call_stacks[i]);
+        }
+
+        // (2) Only the last context_size call stacks matter, whatever came before them
+        uint64_t hash = 0;
+        for(unsigned int i = 4096-context_size; i<4096; i++) hash = griot_context_push(&fresh, call_stacks[i]);
+        assert(hash==context.context_hash);
+
+        // (3) Reset goes back to the initial window
+        griot_context_reset(&fresh);
+        griot_context_window_init(&window, context_size);
+        assert(fresh.context_hash==window.context_hash);
+
+        griot_context_free(&history);
+        griot_context_free(&context);
+        griot_context_free(&fresh);
+    }
+}
+
+// Keeps the hashes from being optimized out
+static volatile uint64_t bench_sink;
+
+static void benchmarks(void)
+{
+    int count = getenv("N") ? atoi(getenv("N")) : 10000000;
+    printf("count=%d\n", count);
+
+    // Call stacks are drawn from a small set, like the few call sites doing the I/Os of an application
+    uint64_t call_stacks[4096];
+    uint64_t state = 1;
+    for(int i = 0; i<4096; i++) call_stacks[i] = next_call_stack(&state)%64;
+
+    for(unsigned int context_size = 1; context_size<=1024; context_size *= 2){
+        griot_context history, context;
+        griot_context_init(&history, 1024, NULL);
+        griot_context_init(&context, context_size, NULL);
+        griot_context_window window;
+        griot_context_window_init(&window, context_size);
+
+        uint64_t hash = 0;
+        struct timespec t0, t1, t2;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for(int i = 0; i<count; i++) hash ^= griot_context_push(&context, call_stacks[i&4095]);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        for(int i = 0; i<count; i++){
+            hash ^= griot_context_window_push(&window, &history, call_stacks[i&4095]);
+            griot_context_push(&history, call_stacks[i&4095]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        double push_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        double window_ns = (double)(t2.tv_sec - t1.tv_sec) * 1.0e9 + (double)(t2.tv_nsec - t1.tv_nsec);
+        bench_sink = hash;
+        printf("context_size=%-4u push %6.2f ns/op, window push (history included) %6.2f ns/op\n",
+            context_size, push_ns/count, window_ns/count);
+
+        griot_context_free(&history);
+        griot_context_free(&context);
+    }
+}
+
+int main(void)
+{
+    if(getenv("BENCH")){
+        printf("Running griot_context.c benchmarks...\n");
+        benchmarks();
+    }else{
+        printf("Running griot_context.c tests...\n");
+        all();
+        printf("PASSED\n");
+    }
+}
+
+#endif
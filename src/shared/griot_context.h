@@ -0,0 +1,64 @@
+#ifndef GRIOT_CONTEXT_H
+#define GRIOT_CONTEXT_H
+
+#include <stdint.h>
+
+#include "griot_arena.h"
+
+/**
+ * A context is the sequence of the last context_size call stacks.
+ *
+ * Its hash is a polynomial rolling hash over the window, oldest call stack first, so pushing a new call stack
+ * (and forgetting the oldest one) is O(1) whatever the context size. Two contexts holding the same call stacks
+ * in the same order have the same hash.
+ */
+typedef struct{
+    // Ring buffer of the call stacks in the window
+    uint64_t *context;
+    uint64_t context_hash;
+
+    // Rolling hash state, and base^(context_size-1) used to remove the oldest call stack
+    uint64_t rolling_hash;
+    uint64_t oldest_weight;
+
+    unsigned int context_size;
+    int index;
+} griot_context;
+
+/**
+ * Allocate the ring buffer from arena (or the heap if NULL). The initial window is made of context_size null call stacks.
+ * griot_context_free is not needed when the arena is destroyed.
+ */
+void griot_context_init(griot_context *context, unsigned int context_size, griot_arena *arena);
+
+/**
+ * Go back to the initial window, reusing the ring buffer
+ */
+void griot_context_reset(griot_context *context);
+void griot_context_free(griot_context *context);
+
+/**
+ * Push a new call stack into the context, and return the new context hash
+ */
+uint64_t griot_context_push(griot_context *context, uint64_t call_stack);
+
+/**
+ * The last context_size call stacks of a larger context, the history, whose ring buffer is shared with the windows of
+ * other sizes. Its hash is the one a griot_context of the same size would have, and pushing a call stack is O(1) too.
+ */
+typedef struct{
+    uint64_t context_hash;
+    uint64_t rolling_hash;
+    uint64_t oldest_weight;
+    unsigned int context_size;
+} griot_context_window;
+
+void griot_context_window_init(griot_context_window *window, unsigned int context_size);
+
+/**
+ * Push a new call stack into the window, and return the new window hash. Must be called before the call stack is
+ * pushed into history, whose context size must be at least the one of the window.
+ */
+uint64_t griot_context_window_push(griot_context_window *window, const griot_context *history, uint64_t call_stack);
+
+#endif
@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "griot_fd_table.h"
+
+/** Enough for the standard streams and a few files, most processes never grow it */
+#define GRIOT_FD_TABLE_INITIAL_CAPACITY 64
+
+void griot_fd_table_init(griot_fd_table *table, griot_arena *arena)
+{
+    table->arena = arena;
+    table->capacity = GRIOT_FD_TABLE_INITIAL_CAPACITY;
+    table->count = 0;
+    table->slots = (void **)griot_arena_malloc(arena, sizeof(void *)*table->capacity);
+    memset(table->slots, 0, sizeof(void *)*table->capacity);
+}
+
+void *griot_fd_table_set(griot_fd_table *table, int fd, void *data)
+{
+    if((size_t)fd>=table->capacity){
+        size_t capacity = table->capacity;
+        while(capacity<=(size_t)fd) capacity *= 2;
+        table->slots = (void **)griot_arena_realloc(table->slots, sizeof(void *)*capacity);
+        memset(table->slots+table->capacity, 0, sizeof(void *)*(capacity-table->capacity));
+        table->capacity = capacity;
+    }
+
+    void *previous = table->slots[fd];
+    table->slots[fd] = data;
+    table->count += (previous==NULL) - (data==NULL);
+    return previous;
+}
+
+void *griot_fd_table_remove(griot_fd_table *table, int fd)
+{
+    if((size_t)fd>=table->capacity) return NULL;
+    void *previous = table->slots[fd];
+    table->slots[fd] = NULL;
+    if(previous!=NULL) table->count -= 1;
+    return previous;
+}
+
+bool griot_fd_table_iter(const griot_fd_table *table, size_t *i, void **data)
+{
+    while(*i<table->capacity){
+        void *candidate = table->slots[*i];
+        (*i)++;
+        if(candidate!=NULL){
+            *data = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+//==============================================================================
+// TESTS AND BENCHMARKS
+// $ cc -DGRIOT_FD_TABLE_TEST -D_GNU_SOURCE -DGRIOT_REPLAY griot_fd_table.c griot_arena.c hashmap.c log.c && ./a.out
+// $ cc -DGRIOT_FD_TABLE_TEST -D_GNU_SOURCE -DGRIOT_REPLAY -O3 griot_fd_table.c griot_arena.c hashmap.c log.c && BENCH=1 ./a.out
+//==============================================================================
+#ifdef GRIOT_FD_TABLE_TEST
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "hashmap.h"
+
+/** Concurrently open files, e.g. a server or a parallel file system client */
+#define GRIOT_FD_TABLE_TEST_FD_COUNT 10000
+
+static void all(void)
+{
+    griot_arena *arena = griot_arena_new();
+    griot_fd_table table;
+    griot_fd_table_init(&table, arena);
+    static int data[GRIOT_FD_TABLE_TEST_FD_COUNT];
+
+    // (1) Growing well past the initial capacity
+    for(int fd = 0; fd<GRIOT_FD_TABLE_TEST_FD_COUNT; fd += 3) assert(griot_fd_table_set(&table, fd, &data[fd])==NULL);
+    assert(table.count==(GRIOT_FD_TABLE_TEST_FD_COUNT+2)/3);
+    for(int fd = 0; fd<GRIOT_FD_TABLE_TEST_FD_COUNT; fd++) assert(griot_fd_table_get(&table, fd)==(fd%3==0 ? &data[fd] : NULL));
+    assert(griot_fd_table_get(&table, GRIOT_FD_TABLE_TEST_FD_COUNT*4)==NULL);
+
+    // (2) A missed close hands back the previous data
+    assert(griot_fd_table_set(&table, 3, &data[4])==&data[3]);
+    assert(table.count==(GRIOT_FD_TABLE_TEST_FD_COUNT+2)/3);
+
+    // (3) Every data is iterated once
+    size_t i = 0, iterated = 0;
+    void *item;
+    while(griot_fd_table_iter(&table, &i, &item)) iterated += 1;
+    assert(iterated==table.count);
+
+    // (4) Removing
+    assert(griot_fd_table_remove(&table, 3)==&data[4]);
+    assert(griot_fd_table_remove(&table, 3)==NULL);
+    assert(griot_fd_table_remove(&table, GRIOT_FD_TABLE_TEST_FD_COUNT*4)==NULL);
+    for(int fd = 0; fd<GRIOT_FD_TABLE_TEST_FD_COUNT; fd += 3) griot_fd_table_remove(&table, fd);
+    assert(table.count==0);
+
+    griot_arena_destroy(arena);
+}
+
+typedef struct
+{
+    int fd;
+    void *data;
+} bench_map_entry;
+
+static uint64_t bench_map_hash(const void *item, uint64_t seed0, uint64_t seed1)
+{
+    return hashmap_murmur(&((const bench_map_entry *)item)->fd, sizeof(int), seed0, seed1);
+}
+
+static int bench_map_compare(const void *a, const void *b, void *udata)
+{
+    return ((const bench_map_entry *)a)->fd - ((const bench_map_entry *)b)->fd;
+}
+
+static double bench_elapsed_ns(struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (double)(t1.tv_sec - t0->tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0->tv_nsec);
+    *t0 = t1;
+    return ns;
+}
+
+// Keeps the lookups from being optimized out
+static void *volatile bench_sink;
+
+static void benchmarks(void)
+{
+    int count = getenv("N") ? atoi(getenv("N")) : 10000000;
+    printf("count=%d, open_fds=%d\n", count, GRIOT_FD_TABLE_TEST_FD_COUNT);
+
+    // The I/Os go to random open files, the standard streams being taken
+    static int data[GRIOT_FD_TABLE_TEST_FD_COUNT+3];
+    int *fds = malloc(sizeof(int)*count);
+    srand(1);
+    for(int i = 0; i<count; i++) fds[i] = 3 + rand()%GRIOT_FD_TABLE_TEST_FD_COUNT;
+
+    griot_arena *arena = griot_arena_new();
+    griot_fd_table table;
+    griot_fd_table_init(&table, arena);
+    hashmap *map = hashmap_new(sizeof(bench_map_entry), 0, 0, 0, bench_map_hash, bench_map_compare, NULL, NULL);
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(int fd = 3; fd<GRIOT_FD_TABLE_TEST_FD_COUNT+3; fd++) griot_fd_table_set(&table, fd, &data[fd]);
+    printf("fd_table open  %6.2f ns/op\n", bench_elapsed_ns(&t0)/GRIOT_FD_TABLE_TEST_FD_COUNT);
+    for(int fd = 3; fd<GRIOT_FD_TABLE_TEST_FD_COUNT+3; fd++) hashmap_set(map, &(bench_map_entry){.fd=fd, .data=&data[fd]});
+    printf("hashmap  open  %6.2f ns/op\n", bench_elapsed_ns(&t0)/GRIOT_FD_TABLE_TEST_FD_COUNT);
+
+    for(int i = 0; i<count; i++) bench_sink = griot_fd_table_get(&table, fds[i]);
+    printf("fd_table get   %6.2f ns/op\n", bench_elapsed_ns(&t0)/count);
+    for(int i = 0; i<count; i++) bench_sink = ((const bench_map_entry *)hashmap_get(map, &(bench_map_entry){.fd=fds[i]}))->data;
+    printf("hashmap  get   %6.2f ns/op\n", bench_elapsed_ns(&t0)/count);
+
+    // Closing and reopening files, the kernel handing out the lowest free fd again
+    for(int i = 0; i<count; i++){
+        bench_sink = griot_fd_table_remove(&table, fds[i]);
+        griot_fd_table_set(&table, fds[i], &data[fds[i]]);
+    }
+    printf("fd_table close+open %6.2f ns/op\n", bench_elapsed_ns(&t0)/count);
+    for(int i = 0; i<count; i++){
+        bench_sink = (void *)hashmap_delete(map, &(bench_map_entry){.fd=fds[i]});
+        hashmap_set(map, &(bench_map_entry){.fd=fds[i], .data=&data[fds[i]]});
+    }
+    printf("hashmap  close+open %6.2f ns/op\n", bench_elapsed_ns(&t0)/count);
+
+    hashmap_free(map);
+    griot_arena_destroy(arena);
+    free(fds);
+}
+
+int main(void)
+{
+    if(getenv("BENCH")){
+        printf("Running griot_fd_table.c benchmarks...\n");
+        benchmarks();
+    }else{
+        printf("Running griot_fd_table.c tests...\n");
+        all();
+        printf("PASSED\n");
+    }
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef GRIOT_FD_TABLE_H
+#define GRIOT_FD_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "griot_arena.h"
+
+/**
+ * Per file descriptor data, directly indexed by fd.
+ *
+ * File descriptors are small dense integers, so a flat array grown on demand replaces a hashmap<fd, data>: looking
+ * a file up is a bound check and a single load. Slots are populated lazily, on open or on the first I/O of a fd
+ * that was opened out of the scope of GrIOt.
+ *
+ * Like the shards it belongs to, a table must only be used by one thread at a time.
+ */
+typedef struct
+{
+    void **slots;
+    size_t capacity;
+    size_t count;
+    griot_arena *arena;
+} griot_fd_table;
+
+/**
+ * The array is allocated from arena (or the heap if NULL), and released with it
+ */
+void griot_fd_table_init(griot_fd_table *table, griot_arena *arena);
+
+/**
+ * @return the data of fd, or NULL if there is none
+ */
+static inline void *griot_fd_table_get(const griot_fd_table *table, int fd)
+{
+    return (size_t)fd<table->capacity ? table->slots[fd] : NULL;
+}
+
+/**
+ * Set the data of fd, growing the table if needed. fd must not be negative.
+ *
+ * @return the data that was previously set for fd, e.g. because its close was missed, or NULL
+ */
+void *griot_fd_table_set(griot_fd_table *table, int fd, void *data);
+
+/**
+ * @return the data that was set for fd, or NULL
+ */
+void *griot_fd_table_remove(griot_fd_table *table, int fd);
+
+/**
+ * Iterate over the data of every fd, hashmap_iter() style
+ */
+bool griot_fd_table_iter(const griot_fd_table *table, size_t *i, void **data);
+
+#endif
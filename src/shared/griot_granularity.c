@@ -0,0 +1,162 @@
+#include <string.h>
+#include <stdbool.h>
+#include <time.h> // clock_gettime and CLOCK_MONOTONIC
+
+#include "griot_granularity.h"
+#ifndef GRIOT_REPLAY
+#include "backtrace.h"
+#endif
+
+/**
+ * Every known granularity. A library only links some of them, the others are NULL.
+ */
+extern const griot_granularity griot_per_process_granularity __attribute__((weak));
+extern const griot_granularity griot_per_open_granularity __attribute__((weak));
+extern const griot_granularity griot_per_open_hash_granularity __attribute__((weak));
+extern const griot_granularity griot_per_path_granularity __attribute__((weak));
+
+#define GRIOT_GRANULARITY_COUNT 4
+
+static const griot_granularity *const griot_granularities[GRIOT_GRANULARITY_COUNT] = {
+    &griot_per_process_granularity,
+    &griot_per_open_granularity,
+    &griot_per_open_hash_granularity,
+    &griot_per_path_granularity,
+};
+
+/** Granularities fed by the model API, in the order of griot_granularities */
+static const griot_granularity *griot_selected[GRIOT_GRANULARITY_COUNT];
+static int griot_selected_count = 0;
+
+static uint32_t call_stack_depth;
+
+/**
+ * Select the first linked granularity if none was selected yet
+ */
+static void griot_select_default()
+{
+    if(griot_selected_count>0) return;
+    for(int i = 0; i<GRIOT_GRANULARITY_COUNT; i++){
+        if(griot_granularities[i]==NULL) continue;
+        griot_selected[griot_selected_count++] = griot_granularities[i];
+        return;
+    }
+}
+
+int griot_select_granularities(const char *names)
+{
+    // Parsing the whole list before changing the selection, so that an invalid list changes nothing
+    bool selected[GRIOT_GRANULARITY_COUNT] = {false};
+    bool any = false;
+    const char *name = names;
+    while(*name){
+        const char *end = name;
+        while(*end && *end!=',') end++;
+        size_t name_length = end-name;
+
+        bool found = false;
+        for(int i = 0; i<GRIOT_GRANULARITY_COUNT; i++){
+            if(griot_granularities[i]==NULL) continue;
+            bool all = name_length==3 && strncmp(name, "all", 3)==0;
+            if(all || (strlen(griot_granularities[i]->name)==name_length && strncmp(griot_granularities[i]->name, name, name_length)==0)){
+                selected[i] = true;
+                found = true;
+            }
+        }
+        if(!found) return -1;
+        any = true;
+        name = *end ? end+1 : end;
+    }
+    if(!any) return -1;
+
+    griot_selected_count = 0;
+    for(int i = 0; i<GRIOT_GRANULARITY_COUNT; i++){
+        if(selected[i]) griot_selected[griot_selected_count++] = griot_granularities[i];
+    }
+    return 0;
+}
+
+void griot_enable_thread_sharding()
+{
+    griot_select_default();
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->enable_thread_sharding();
+}
+
+void griot_enable_per_thread_context()
+{
+    griot_select_default();
+    for(int i = 0; i<griot_selected_count; i++){
+        if(griot_selected[i]->enable_per_thread_context) griot_selected[i]->enable_per_thread_context();
+    }
+}
+
+void griot_set_max_model_bytes(uint64_t bytes)
+{
+    griot_select_default();
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->set_max_model_bytes(bytes);
+}
+
+void griot_set_context_sizes(const uint32_t *context_sizes, uint32_t count)
+{
+    griot_select_default();
+    for(int i = 0; i<griot_selected_count; i++){
+        if(griot_selected[i]->set_context_sizes) griot_selected[i]->set_context_sizes(context_sizes, count);
+    }
+}
+
+void griot_init(uint32_t context_size, uint32_t griot_call_stack_depth)
+{
+    griot_select_default();
+    call_stack_depth = griot_call_stack_depth;
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->init(context_size, griot_call_stack_depth);
+}
+
+void griot_finalize()
+{
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->finalize();
+}
+
+bool griot_needs_path_hash()
+{
+    for(int i = 0; i<griot_selected_count; i++){
+        if(griot_selected[i]->needs_path_hash) return true;
+    }
+    return false;
+}
+
+void on_io_event(const griot_io_event *event, FILE *optional_debug_file)
+{
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->on_io_event(event, optional_debug_file);
+}
+
+#ifndef GRIOT_REPLAY
+void on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash, FILE *optional_debug_file)
+{
+    // Get the call stack once, and let every granularity do the rest
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t call_stack = get_hash_for_current_backtrace(call_stack_depth);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+
+    griot_io_event event = {.timestamp=timestamp, .thread_id=thread_id, .fd=fd, .offset=offset, .length=length,
+        .duration_ns=duration_ns, .op_type=op_type, .call_stack=call_stack, .call_stack_time_ns=dt_ns, .path_hash=path_hash};
+    on_io_event(&event, optional_debug_file);
+}
+#endif
+
+void griot_results_reset()
+{
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->results_reset();
+}
+
+void griot_results_dump(FILE *file)
+{
+    // One section per granularity, each starting with its context_size and telling its granularity
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->results_dump(file);
+}
+
+void griot_results_summarize(void (*on_summary)(const griot_results_summary *summary, void *arg), void *arg)
+{
+    for(int i = 0; i<griot_selected_count; i++) griot_selected[i]->results_summarize(on_summary, arg);
+}
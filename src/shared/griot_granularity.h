@@ -0,0 +1,48 @@
+#ifndef GRIOT_GRANULARITY_H
+#define GRIOT_GRANULARITY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "griot_model.h"
+
+/**
+ * A model granularity (per-process, per-open...), i.e. one implementation of the model API of griot_model.h.
+ *
+ * Each granularity only exports its table, and griot_granularity.c implements griot_model.h by dispatching every call
+ * to the selected granularities. A library may link any number of them: the call stack of an I/O is then computed
+ * once, and fed to every selected granularity.
+ */
+typedef struct
+{
+    // Name used by GRIOT_GRANULARITY, e.g. "per-open"
+    const char *name;
+
+    // Whether GRIOT_OPEN events must carry the hash of the opened path
+    bool needs_path_hash;
+
+    void (*enable_thread_sharding)(void);
+
+    // NULL when contexts are already per file
+    void (*enable_per_thread_context)(void);
+
+    void (*set_max_model_bytes)(uint64_t bytes);
+
+    // NULL when context size sweeps are not supported
+    void (*set_context_sizes)(const uint32_t *context_sizes, uint32_t count);
+
+    void (*init)(uint32_t context_size, uint32_t call_stack_depth);
+    void (*finalize)(void);
+    void (*on_io_event)(const griot_io_event *event, FILE *optional_debug_file);
+    void (*results_reset)(void);
+    void (*results_dump)(FILE *file);
+    void (*results_summarize)(void (*on_summary)(const griot_results_summary *summary, void *arg), void *arg);
+} griot_granularity;
+
+extern const griot_granularity griot_per_process_granularity;
+extern const griot_granularity griot_per_open_granularity;
+extern const griot_granularity griot_per_open_hash_granularity;
+extern const griot_granularity griot_per_path_granularity;
+
+#endif
@@ -0,0 +1,42 @@
+#include "griot_hash.h"
+
+/** Utility for hash function */
+#define BIG_CONSTANT(x) (x##LLU)
+
+/**
+ * MurmurHash2, 64-bit versions, by Austin Appleby
+ * The same caveats as 32-bit MurmurHash2 apply here - beware of alignment
+ * and endian-ness issues if used across multiple platforms.
+ *
+ * @return 64-bit hash for 64-bit platforms
+ */
+u_int64_t MurmurHash64A(const void *key, int len, u_int64_t seed)
+{ 
+        const u_int64_t m = BIG_CONSTANT(0xc6a4a7935bd1e995);
+        const int r = 47;
+
+        u_int64_t h = seed ^ (len * m);
+
+        const u_int64_t *data = (const u_int64_t *) key;
+        const u_int64_t *end = data + (len / 8);
+
+        while (data != end) {
+                u_int64_t k = *data++;
+                k *= m; k ^= k >> r; k *= m; h ^= k; h *= m;
+        }
+
+        const unsigned char *data2 = (const unsigned char *) data;
+
+        switch (len & 7) {
+        case 7: h ^= (u_int64_t)(data2[6]) << 48;
+        case 6: h ^= (u_int64_t)(data2[5]) << 40;
+        case 5: h ^= (u_int64_t)(data2[4]) << 32;
+        case 4: h ^= (u_int64_t)(data2[3]) << 24;
+        case 3: h ^= (u_int64_t)(data2[2]) << 16;
+        case 2: h ^= (u_int64_t)(data2[1]) << 8;
+        case 1: h ^= (u_int64_t)(data2[0]); h *= m;
+        };
+
+        h ^= h >> r; h *= m; h ^= h >> r;
+        return h;
+}
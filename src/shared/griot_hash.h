@@ -0,0 +1,11 @@
+#ifndef GRIOT_HASH_H
+#define GRIOT_HASH_H
+
+#include <sys/types.h>
+
+/**
+ * The hash of call stacks and paths. Kept apart from backtrace.c so that it can be linked without the unwinder.
+ */
+u_int64_t MurmurHash64A(const void *key, int len, u_int64_t seed);
+
+#endif
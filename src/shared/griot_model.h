@@ -4,9 +4,76 @@
 #include <sys/types.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef enum {GRIOT_READ, GRIOT_WRITE, GRIOT_OPEN, GRIOT_CLOSE} op_type;
 
+/**
+ * An intercepted I/O, along with the hash of the call stack that issued it
+ */
+typedef struct
+{
+    uint64_t timestamp;
+    int32_t thread_id;
+    int fd;
+    off_t offset;
+    size_t length;
+    uint64_t duration_ns;
+    op_type op_type;
+
+    // Call stack hash, and the time it took to get it
+    uint64_t call_stack;
+    uint64_t call_stack_time_ns;
+
+    // Hash of the canonicalized path of the opened file, for GRIOT_OPEN. 0 if unknown.
+    uint64_t path_hash;
+
+    // Capture order of the I/O within the process, when the I/Os of several threads have to be put back in order
+    // (recording, asynchronous pipeline). 0 otherwise.
+    uint64_t sequence;
+} griot_io_event;
+
+/**
+ * Called by GrIOt tracer before anything else to select the granularities fed with the I/Os, as a comma separated
+ * list of names (e.g. "per-process,per-open"), or "all". Each one dumps its own results. Without it, the first
+ * granularity linked in the library is used.
+ *
+ * @return 0 upon success, -1 if a granularity is unknown or not linked in the library
+ */
+int griot_select_granularities(const char *names);
+
+/**
+ * Called by GrIOt tracer before griot_init when thread sharding is requested. Each thread then owns its own context,
+ * prediction table and results, on_io may be called concurrently without any lock, and results are merged on dump.
+ * The state of a file stays with the thread that opened it, so files are assumed to be used by a single thread: the
+ * closes done by another thread are missed, and counted in cross_shard_close_count.
+ */
+void griot_enable_thread_sharding();
+
+/**
+ * Called by GrIOt tracer before griot_init when a memory budget is requested. Past bytes used by the nodes of the
+ * model, cold nodes are evicted. 0 means unlimited.
+ *
+ * The budget covers the nodes only, i.e. their buckets and spilled edges (see griot_node_bytes), dumped as
+ * model_node_bytes. The empty buckets of the hashmaps, the contexts and the state of the files are not part of it, so
+ * model_memory_footprint, the memory actually used by the model, is usually 3 to 5 times the budget.
+ */
+void griot_set_max_model_bytes(uint64_t bytes);
+
+/**
+ * Called by GrIOt tracer before griot_init when per-thread contexts are requested. Each thread then pushes its call
+ * stacks into its own context window, and every thread feeds the same graph. Granularities whose contexts are already
+ * per file ignore it.
+ */
+void griot_enable_per_thread_context();
+
+/**
+ * Called by GrIOt tracer before griot_init when a context size sweep is requested. Every context size is then
+ * evaluated in the same run, from a single history of call stacks, and dumps its own results. The context size passed
+ * to griot_init is ignored. Granularities that do not support sweeps ignore it.
+ */
+void griot_set_context_sizes(const uint32_t *context_sizes, uint32_t count);
+
 /**
  * Called by GrIOt tracer when a process is created
  */
@@ -18,9 +85,22 @@ void griot_init(uint32_t context_size, uint32_t griot_call_stack_depth);
 void griot_finalize();
 
 /**
- * Called by GrIOt tracer when an I/O is intercepted
+ * Called by GrIOt tracer after griot_init, so that the path of an open is only hashed when it is used
+ *
+ * @return true if a selected granularity needs the path_hash of GRIOT_OPEN events
+ */
+bool griot_needs_path_hash();
+
+/**
+ * Called by GrIOt tracer when an I/O is intercepted. path_hash is only meaningful for GRIOT_OPEN, and 0 otherwise.
+ */
+void on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash, FILE *optional_debug_file);
+
+/**
+ * Same as on_io, but the call stack hash was already computed by the caller (e.g. the asynchronous pipeline).
+ * Events of a given thread must be passed in order, and calls must be serialized unless the model is thread sharded.
  */
-void on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, FILE *optional_debug_file);
+void on_io_event(const griot_io_event *event, FILE *optional_debug_file);
 
 /**
  * Called by GrIOt tracer in child processes in order to avoid counting any I/O more than once
@@ -32,4 +112,31 @@ void griot_results_reset();
  */
 void griot_results_dump(FILE *file);
 
+/**
+ * The main figures of a set of results of griot_results_dump. Fixed size, so that it can be passed around as is, e.g.
+ * from a replay worker to its parent.
+ */
+typedef struct
+{
+    // As dumped, e.g. "griot-per-open"
+    char granularity[64];
+    uint32_t context_size;
+    uint32_t call_stack_depth;
+    uint64_t io_count;
+    uint64_t io_volume;
+    uint64_t io_time;
+    uint64_t mru_correct_prediction_count;
+    uint64_t mru_correct_prediction_volume;
+    uint64_t mfu_correct_prediction_count;
+    uint64_t mfu_correct_prediction_volume;
+    uint64_t model_prediction_time;
+    uint64_t model_memory_footprint;
+} griot_results_summary;
+
+/**
+ * Same as griot_results_dump, but on_summary is called with the main figures of every set of results, in the order of
+ * the dump
+ */
+void griot_results_summarize(void (*on_summary)(const griot_results_summary *summary, void *arg), void *arg);
+
 #endif
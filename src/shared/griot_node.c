@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "griot_node.h"
+#include "log.h"
+
+/** Capacity of the heap array the first time the inline edges overflow */
+#define GRIOT_NODE_FIRST_SPILL_CAPACITY 8
+
+void griot_node_init(griot_prediction_data *node)
+{
+    memset(node, 0, sizeof(griot_prediction_data));
+}
+
+void griot_node_free(griot_prediction_data *node)
+{
+    if(node->edge_count>GRIOT_NODE_INLINE_EDGES) griot_arena_free(node->spilled_edges);
+    node->edge_count = 0;
+    node->spilled_edge_capacity = 0;
+}
+
+void griot_node_copy(griot_arena *arena, griot_prediction_data *dst, const griot_prediction_data *src)
+{
+    memcpy(dst, src, sizeof(griot_prediction_data));
+    if(src->edge_count>GRIOT_NODE_INLINE_EDGES){
+        dst->spilled_edges = (griot_edge *)griot_arena_malloc(arena, sizeof(griot_edge)*src->spilled_edge_capacity);
+        memcpy(dst->spilled_edges, src->spilled_edges, sizeof(griot_edge)*src->edge_count);
+    }
+
+    // The weights of the copy are all in src already
+    griot_edge *edges = griot_node_edges(dst);
+    for(uint32_t i = 0; i<dst->edge_count; i++) edges[i].merged_weight = edges[i].weight;
+}
+
+/**
+ * Append an edge of weight 1 towards context_hash. The inline edges are moved to the heap if they are full.
+ *
+ * @return the number of bytes the spilled edges grew by
+ */
+static uint64_t griot_node_append_edge(griot_arena *arena, griot_prediction_data *node, uint64_t context_hash)
+{
+    uint64_t grown_bytes = 0;
+    if(node->edge_count==GRIOT_NODE_INLINE_EDGES){
+        griot_edge *spilled_edges = (griot_edge *)griot_arena_malloc(arena, sizeof(griot_edge)*GRIOT_NODE_FIRST_SPILL_CAPACITY);
+        memcpy(spilled_edges, node->inline_edges, sizeof(griot_edge)*GRIOT_NODE_INLINE_EDGES);
+        node->spilled_edges = spilled_edges;
+        node->spilled_edge_capacity = GRIOT_NODE_FIRST_SPILL_CAPACITY;
+        grown_bytes = sizeof(griot_edge)*GRIOT_NODE_FIRST_SPILL_CAPACITY;
+    }else if(node->edge_count>GRIOT_NODE_INLINE_EDGES && node->edge_count==node->spilled_edge_capacity){
+        grown_bytes = sizeof(griot_edge)*node->spilled_edge_capacity;
+        node->spilled_edge_capacity *= 2;
+        node->spilled_edges = (griot_edge *)griot_arena_realloc(node->spilled_edges, sizeof(griot_edge)*node->spilled_edge_capacity);
+    }
+    node->edge_count+=1;
+    griot_node_edges(node)[node->edge_count-1] = (griot_edge){.context_hash=context_hash, .weight=1};
+    return grown_bytes;
+}
+
+uint64_t griot_node_add_successor(griot_arena *arena, griot_prediction_data *node, uint64_t context_hash)
+{
+    // For MRU, it's easy
+    node->mru_context_hash = context_hash;
+
+    // For MFU, it's harder. Either the node already has an edge to the new context and it's just an increment...
+    griot_edge *edges = griot_node_edges(node);
+    for(uint32_t i = 0; i<node->edge_count; i++){
+        if(edges[i].context_hash==context_hash){
+            if(edges[i].weight==UINT32_MAX) return 0;
+            uint32_t weight = edges[i].weight+=1;
+
+            // Keep the edges sorted by weight. The edges between the first lighter one and i all weighed the old
+            // weight of i, so swapping i with the first lighter edge is enough.
+            uint32_t j = i;
+            while(j>0 && edges[j-1].weight<weight) j--;
+            if(j!=i){
+                griot_edge edge = edges[j];
+                edges[j] = edges[i];
+                edges[i] = edge;
+            }
+            return 0;
+        }
+    }
+
+    // ... or it doesn't and we must append it. Its weight being 1, it goes last.
+    return griot_node_append_edge(arena, node, context_hash);
+}
+
+uint64_t griot_node_merge(griot_arena *arena, griot_prediction_data *into, const griot_prediction_data *from)
+{
+    // Add the weight the edges of from gained since the copy to the edges of into, creating the missing ones
+    uint64_t grown_bytes = 0;
+    bool merged = false;
+    const griot_edge *from_edges = from->edge_count>GRIOT_NODE_INLINE_EDGES ? from->spilled_edges : from->inline_edges;
+    for(uint32_t i = 0; i<from->edge_count; i++){
+        uint32_t weight = from_edges[i].weight-from_edges[i].merged_weight;
+        if(weight==0) continue;
+
+        griot_edge *edges = griot_node_edges(into);
+        uint32_t j = 0;
+        while(j<into->edge_count && edges[j].context_hash!=from_edges[i].context_hash) j++;
+        if(j==into->edge_count){
+            grown_bytes += griot_node_append_edge(arena, into, from_edges[i].context_hash);
+            edges = griot_node_edges(into);
+            edges[j].weight = 0;
+        }
+        edges[j].weight = edges[j].weight>UINT32_MAX-weight ? UINT32_MAX : edges[j].weight+weight;
+        merged = true;
+    }
+    if(!merged) return grown_bytes;
+
+    // from saw a successor since the copy, its MRU successor is the most recent one
+    into->mru_context_hash = from->mru_context_hash;
+
+    // Sort the edges by weight again. Insertion sort, as only a few of them moved, and ties keep their order.
+    griot_edge *edges = griot_node_edges(into);
+    for(uint32_t i = 1; i<into->edge_count; i++){
+        griot_edge edge = edges[i];
+        uint32_t j = i;
+        while(j>0 && edges[j-1].weight<edge.weight){
+            edges[j] = edges[j-1];
+            j--;
+        }
+        edges[j] = edge;
+    }
+    return grown_bytes;
+}
+
+/**
+ * Drop the spilled edges of weight 1, but keep enough of them to fill the inline edges. The spilled edges are moved
+ * to a smaller array when possible, or back inline.
+ *
+ * @return the number of bytes released
+ */
+static uint64_t griot_node_trim_cold_edges(griot_arena *arena, griot_prediction_data *node, uint64_t *evicted_edge_count)
+{
+    if(node->edge_count<=GRIOT_NODE_INLINE_EDGES) return 0;
+
+    // Edges are sorted by weight, so the edges seen only once are the last ones
+    uint32_t edge_count = node->edge_count;
+    while(edge_count>GRIOT_NODE_INLINE_EDGES && node->spilled_edges[edge_count-1].weight==1) edge_count--;
+    if(edge_count==node->edge_count) return 0;
+    *evicted_edge_count += node->edge_count-edge_count;
+
+    uint64_t old_bytes = griot_node_bytes(node);
+    griot_edge *spilled_edges = node->spilled_edges;
+    if(edge_count==GRIOT_NODE_INLINE_EDGES){
+        memcpy(node->inline_edges, spilled_edges, sizeof(griot_edge)*GRIOT_NODE_INLINE_EDGES);
+        node->spilled_edge_capacity = 0;
+        griot_arena_free(spilled_edges);
+    }else{
+        // Smallest capacity add_successor could have grown to, so that it grows the array again once full
+        uint32_t capacity = GRIOT_NODE_FIRST_SPILL_CAPACITY;
+        while(capacity<edge_count) capacity *= 2;
+        if(capacity<node->spilled_edge_capacity){
+            node->spilled_edges = (griot_edge *)griot_arena_malloc(arena, sizeof(griot_edge)*capacity);
+            memcpy(node->spilled_edges, spilled_edges, sizeof(griot_edge)*edge_count);
+            node->spilled_edge_capacity = capacity;
+            griot_arena_free(spilled_edges);
+        }
+    }
+    node->edge_count = edge_count;
+    return old_bytes-griot_node_bytes(node);
+}
+
+uint64_t griot_node_evict(griot_arena *arena, hashmap *table, uint64_t *clock_hand, uint64_t bytes_to_free,
+    uint64_t *evicted_node_count, uint64_t *evicted_edge_count)
+{
+    uint64_t released_bytes = 0;
+    while(released_bytes<bytes_to_free && hashmap_count(table)>0){
+        griot_prediction_table_map_entry *map_entry = (griot_prediction_table_map_entry *)hashmap_probe(table, *clock_hand);
+        if(map_entry==NULL){
+            *clock_hand += 1;
+        }else if(map_entry->data.referenced){
+            map_entry->data.referenced = 0;
+            released_bytes += griot_node_trim_cold_edges(arena, &map_entry->data, evicted_edge_count);
+            *clock_hand += 1;
+        }else{
+            // The hashmap shifts the next entries back into the bucket, so the hand stays where it is
+            released_bytes += griot_node_bytes(&map_entry->data);
+            *evicted_edge_count += map_entry->data.edge_count;
+            *evicted_node_count += 1;
+            griot_node_free(&map_entry->data);
+            griot_arena_hashmap_delete(arena, table, &(griot_prediction_table_map_entry){.call_stack_hash=map_entry->call_stack_hash});
+        }
+    }
+    return released_bytes;
+}
+
+uint64_t griot_node_evict_tables(bool (*next_table)(void *arg, size_t *hand, griot_node_table_ref *table), void *arg,
+    size_t *table_hand, uint64_t table_count, uint64_t model_bytes, uint64_t bytes_to_free,
+    uint64_t *evicted_node_count, uint64_t *evicted_edge_count)
+{
+    uint64_t share = table_count>0 ? model_bytes/table_count : 0;
+    uint64_t released_bytes = 0;
+
+    // Starting from the hand, two passes over the tables skip the ones below their share (the first one may start
+    // half way), and two more take from any table
+    uint32_t wraps = 0;
+    while(released_bytes<bytes_to_free && wraps<4){
+        griot_node_table_ref table;
+        if(!next_table(arg, table_hand, &table)){
+            *table_hand = 0;
+            wraps += 1;
+            continue;
+        }
+        if(*table.model_bytes==0 || (wraps<2 && *table.model_bytes<share)) continue;
+
+        uint64_t table_released_bytes = griot_node_evict(table.arena, table.table, table.clock_hand, bytes_to_free-released_bytes,
+            evicted_node_count, evicted_edge_count);
+        *table.model_bytes -= table_released_bytes;
+        released_bytes += table_released_bytes;
+    }
+    return released_bytes;
+}
+
+void griot_node_table_clear(hashmap *table)
+{
+    size_t iter = 0;
+    void *item;
+    while(hashmap_iter(table, &iter, &item)) griot_node_free(&((griot_prediction_table_map_entry *)item)->data);
+    hashmap_clear(table, true);
+}
@@ -0,0 +1,202 @@
+#ifndef GRIOT_NODE_H
+#define GRIOT_NODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hashmap.h"
+#include "griot_arena.h"
+
+/** Number of outgoing edges stored inside the node itself. Most nodes never have more. */
+#define GRIOT_NODE_INLINE_EDGES 3
+
+/**
+ * An outgoing edge of a node, used for MFU. Hash and weight are interleaved so that the MFU update and the
+ * argmax only touch one array. Weights saturate at UINT32_MAX.
+ */
+typedef struct
+{
+    uint64_t context_hash;
+    uint32_t weight;
+
+    // Part of the weight that is already in the graph the node was copied from, see griot_node_merge
+    uint32_t merged_weight;
+} griot_edge;
+
+/**
+ * A node of the GrIOt graph, i.e. the prediction data of a context.
+ *
+ * The first GRIOT_NODE_INLINE_EDGES edges live inline, and the whole node fits in a 64 bytes cache line. Past that,
+ * every edge is moved to a heap array, grown geometrically.
+ *
+ * Edges are kept sorted by decreasing weight, so the MFU prediction is always the first edge, and the search for an
+ * existing edge mostly ends on the first few ones.
+ *
+ * The referenced bit is set every time the node is used, and cleared by the hand of griot_node_evict.
+ */
+typedef struct
+{
+    // The context hash of the most recent next I/O
+    uint64_t mru_context_hash;
+
+    // one weight per outgoing edge, heaviest first. Used for MFU.
+    uint32_t edge_count:31;
+    uint32_t referenced:1;
+    uint32_t spilled_edge_capacity;
+    union {
+        griot_edge inline_edges[GRIOT_NODE_INLINE_EDGES];
+        griot_edge *spilled_edges;
+    };
+} griot_prediction_data;
+
+void griot_node_init(griot_prediction_data *node);
+
+/**
+ * Free the spilled edges, if any. The node itself belongs to the caller.
+ * Not needed when the arena of the node is destroyed.
+ */
+void griot_node_free(griot_prediction_data *node);
+
+/**
+ * Deep copy of src into the uninitialized node dst. Spilled edges are allocated from arena.
+ * The whole weight of the edges of dst counts as merged.
+ */
+void griot_node_copy(griot_arena *arena, griot_prediction_data *dst, const griot_prediction_data *src);
+
+/**
+ * Record that the context context_hash followed the node: updates the MRU successor, and the MFU edge weights.
+ * Spilled edges are allocated from arena, which must be the arena of the node.
+ *
+ * @return the number of bytes the spilled edges grew by
+ */
+uint64_t griot_node_add_successor(griot_arena *arena, griot_prediction_data *node, uint64_t context_hash);
+
+/**
+ * Merge a copy back into the node it was copied from: the weight the edges of from gained since the copy is added to
+ * the edges of into, that gets the edges it misses, and the MRU successor of from if from gained any weight. Spilled edges are allocated from
+ * arena, which must be the arena of into.
+ *
+ * @return the number of bytes the spilled edges of into grew by
+ */
+uint64_t griot_node_merge(griot_arena *arena, griot_prediction_data *into, const griot_prediction_data *from);
+
+/**
+ * Entry of a prediction table, i.e. a hashmap<context hash, node>. Nodes are stored inline in the buckets, so looking
+ * a node up costs a single dependent access. Like every GrIOt map entry, the key comes first.
+ */
+typedef struct
+{
+    uint64_t call_stack_hash;
+    griot_prediction_data data;
+} griot_prediction_table_map_entry;
+
+/**
+ * Bytes of the bucket of a node in a prediction table: the entry, behind the hash and the probe distance the hashmap
+ * keeps in a 64 bits header
+ */
+#define GRIOT_NODE_BUCKET_BYTES (sizeof(uint64_t)+sizeof(griot_prediction_table_map_entry))
+
+/**
+ * @return the bytes used by a node in a prediction table, its bucket and spilled edges included. This is what the
+ * memory budget counts: the empty buckets a hashmap keeps to stay under its load factor, between 40% and 70% of its
+ * bucket array, are not part of it.
+ */
+static inline uint64_t griot_node_bytes(const griot_prediction_data *node)
+{
+    uint64_t size = GRIOT_NODE_BUCKET_BYTES;
+    if(node->edge_count>GRIOT_NODE_INLINE_EDGES) size += sizeof(griot_edge)*node->spilled_edge_capacity;
+    return size;
+}
+
+/**
+ * Evict nodes of a prediction table with the CLOCK policy, until at least bytes_to_free bytes were released or the
+ * table is empty. arena must be the arena of the table.
+ *
+ * The hand sweeps the buckets, starting where it stopped the previous time. A node used since the hand last went by
+ * gets a second chance, but loses its spilled edges of weight 1. Any other node is evicted. Successors are only known
+ * by their context hash, so the edges towards an evicted node stay valid predictions, and the node is simply created
+ * again the next time its context shows up.
+ *
+ * @return the number of bytes released, as counted by griot_node_bytes
+ */
+uint64_t griot_node_evict(griot_arena *arena, hashmap *table, uint64_t *clock_hand, uint64_t bytes_to_free,
+    uint64_t *evicted_node_count, uint64_t *evicted_edge_count);
+
+/**
+ * A prediction table, as enumerated by the next_table callback of griot_node_evict_tables
+ */
+typedef struct
+{
+    griot_arena *arena;
+    hashmap *table;
+
+    // Bytes used by the nodes of the table, and its own eviction hand
+    uint64_t *model_bytes;
+    uint64_t *clock_hand;
+} griot_node_table_ref;
+
+/**
+ * Evict nodes from the prediction tables of a shard (see griot_node_evict) until at least bytes_to_free bytes were
+ * released, or every table is empty.
+ *
+ * next_table enumerates the tables hashmap_iter() style, and returns false at the end of them. The enumeration resumes
+ * from *table_hand, so that the tables take turns from one call to the next. Only the tables holding more than their
+ * share of model_bytes, the bytes of all the table_count tables, are evicted from in the first round: a small graph
+ * keeps its nodes as long as a larger one, busy or idle, has some to give back.
+ *
+ * @return the number of bytes released. The model_bytes of the tables are already updated.
+ */
+uint64_t griot_node_evict_tables(bool (*next_table)(void *arg, size_t *hand, griot_node_table_ref *table), void *arg,
+    size_t *table_hand, uint64_t table_count, uint64_t model_bytes, uint64_t bytes_to_free,
+    uint64_t *evicted_node_count, uint64_t *evicted_edge_count);
+
+/**
+ * Remove every node of a prediction table, keeping its capacity. The spilled edges go back to their arena.
+ */
+void griot_node_table_clear(hashmap *table);
+
+/**
+ * A reference to a node of a prediction table that survives the node being moved around by the hashmap.
+ * The pointer is used as is as long as the table did not move any item, else the node is looked up again by context hash.
+ */
+typedef struct
+{
+    griot_prediction_data *node;
+    uint64_t context_hash;
+    uint64_t table_moves;
+} griot_node_handle;
+
+static inline griot_node_handle griot_node_handle_new(hashmap *table, uint64_t context_hash, griot_prediction_data *node)
+{
+    return (griot_node_handle){.node=node, .context_hash=context_hash, .table_moves=hashmap_moves(table)};
+}
+
+/**
+ * @return the node, or NULL for an empty handle or if the node is not in the table anymore
+ */
+static inline griot_prediction_data *griot_node_handle_get(hashmap *table, griot_node_handle *handle)
+{
+    if(handle->node==NULL || hashmap_moves(table)==handle->table_moves) return handle->node;
+    const griot_prediction_table_map_entry *map_entry = hashmap_get(table, &(griot_prediction_table_map_entry){.call_stack_hash=handle->context_hash});
+    handle->node = map_entry==NULL ? NULL : (griot_prediction_data *)&map_entry->data;
+    handle->table_moves = hashmap_moves(table);
+    return handle->node;
+}
+
+static inline griot_edge *griot_node_edges(griot_prediction_data *node)
+{
+    return node->edge_count>GRIOT_NODE_INLINE_EDGES ? node->spilled_edges : node->inline_edges;
+}
+
+/**
+ * @return the most frequent successor of the node, falling back to the most recent one if there is no edge.
+ * On a tie, the successor that reached the highest weight first wins.
+ */
+static inline uint64_t griot_node_mfu_prediction(const griot_prediction_data *node)
+{
+    if(node->edge_count==0) return node->mru_context_hash;
+    return node->edge_count>GRIOT_NODE_INLINE_EDGES ? node->spilled_edges[0].context_hash : node->inline_edges[0].context_hash;
+}
+
+#endif
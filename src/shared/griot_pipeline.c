@@ -0,0 +1,392 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "griot_pipeline.h"
+#include "griot_record.h"
+#include "backtrace.h"
+#include "griot_config.h"
+#include "log.h"
+
+/*
+ * Every producer thread owns a ring. The producer only ever writes head, the model thread only ever writes tail,
+ * so pushing and draining an I/O is a couple of loads and one release store on each side.
+ *
+ * Every record gets a capture sequence number right before it is published, and the model thread merges the heads of
+ * the rings on it, so that the model sees the I/Os of all threads in the order they were captured, like in sync mode.
+ * A record is only processed once every smaller sequence number has been: a producer may have drawn one and not
+ * published it yet.
+ *
+ * When a producer thread exits, its ring is retired, and the model thread frees it once drained.
+ */
+
+typedef struct
+{
+    griot_io_event event;
+
+    // Raw return addresses, made relative and hashed by the model thread
+    uint32_t frame_count;
+    unsigned long frames[];
+} griot_pipeline_record;
+
+typedef struct
+{
+    uint64_t pushed;
+    uint64_t dropped;
+    uint64_t backpressure_count;
+    uint64_t backpressure_time;
+    uint64_t capture_time;
+} griot_ring_stats;
+
+typedef struct griot_ring
+{
+    // Index of the next record to be pushed. Written by the producer.
+    _Atomic uint64_t head __attribute__((aligned(64)));
+
+    // Index of the next record to be drained. Written by the model thread.
+    _Atomic uint64_t tail __attribute__((aligned(64)));
+
+    // Records, the ring size being a power of two
+    unsigned char *records __attribute__((aligned(64)));
+    uint64_t mask;
+
+    // Set when the producer thread exits, see griot_ring_retire
+    atomic_bool retired;
+
+    // Producer side stats
+    griot_ring_stats stats;
+
+    // All the rings are chained so that the model thread can find them. Only the model thread unlinks them.
+    struct griot_ring *next;
+} griot_ring;
+
+static struct
+{
+    unsigned int call_stack_depth;
+
+    // Frames captured per I/O: the call stack depth, or more when recording
+    unsigned int capture_depth;
+    uint64_t queue_size;
+    size_t record_size;
+    FILE *debug_file;
+
+    // Rings of the live threads that did an I/O so far, and of the exited ones that still have records
+    _Atomic(griot_ring *) rings;
+    _Atomic unsigned int ring_count;
+
+    // Rings freed so far, and their stats
+    unsigned int retired_ring_count;
+    griot_ring_stats retired_stats;
+
+    // Retires the ring of a thread when it exits
+    pthread_key_t ring_key;
+
+    // Sequence number of the next record to be processed
+    uint64_t next_sequence;
+
+    // Model thread
+    pthread_t thread;
+    atomic_bool running;
+    bool started;
+
+    // Model thread side stats
+    uint64_t processed;
+    uint64_t queue_depth_sum;
+    uint64_t queue_depth_samples;
+    uint64_t max_queue_depth;
+} griot_pipeline;
+
+static __thread griot_ring *thread_ring;
+
+static void *griot_pipeline_main(void *arg);
+static uint64_t griot_pipeline_drain(bool final);
+
+static griot_pipeline_record *griot_ring_record(griot_ring *ring, uint64_t index)
+{
+    return (griot_pipeline_record *)(ring->records + (index & ring->mask)*griot_pipeline.record_size);
+}
+
+static griot_ring *griot_ring_new()
+{
+    griot_ring *ring;
+    if(posix_memalign((void **)&ring, 64, sizeof(griot_ring))) FATAL("Out of memory");
+    memset(ring, 0, sizeof(griot_ring));
+    ring->mask = griot_pipeline.queue_size-1;
+    ring->records = malloc(griot_pipeline.queue_size*griot_pipeline.record_size);
+    if(!ring->records) FATAL("Out of memory");
+
+    // Publishing the ring for the model thread
+    griot_ring *rings = atomic_load(&griot_pipeline.rings);
+    do {
+        ring->next = rings;
+    } while(!atomic_compare_exchange_weak(&griot_pipeline.rings, &rings, ring));
+    atomic_fetch_add(&griot_pipeline.ring_count, 1);
+    pthread_setspecific(griot_pipeline.ring_key, ring);
+    return ring;
+}
+
+/**
+ * Key destructor, called when a producer thread exits. The ring is left to the model thread, that may not have
+ * drained it yet.
+ */
+static void griot_ring_retire(void *arg)
+{
+    griot_ring *ring = arg;
+    if(thread_ring==ring) thread_ring = NULL;
+    atomic_store_explicit(&ring->retired, true, memory_order_release);
+}
+
+static void griot_ring_stats_add(griot_ring_stats *stats, const griot_ring_stats *added)
+{
+    stats->pushed += added->pushed;
+    stats->dropped += added->dropped;
+    stats->backpressure_count += added->backpressure_count;
+    stats->backpressure_time += added->backpressure_time;
+    stats->capture_time += added->capture_time;
+}
+
+/**
+ * Unlink a ring and free it, keeping its stats. Only the model thread (or the only thread left after a fork) removes
+ * rings, but producers may push new ones at the head of the list meanwhile.
+ */
+static void griot_ring_free(griot_ring *ring)
+{
+    griot_ring *head = ring;
+    if(!atomic_compare_exchange_strong(&griot_pipeline.rings, &head, ring->next)){
+        griot_ring *previous = head;
+        while(previous->next!=ring) previous = previous->next;
+        previous->next = ring->next;
+    }
+    atomic_fetch_sub(&griot_pipeline.ring_count, 1);
+
+    griot_ring_stats_add(&griot_pipeline.retired_stats, &ring->stats);
+    griot_pipeline.retired_ring_count += 1;
+    free(ring->records);
+    free(ring);
+}
+
+void griot_pipeline_start(unsigned int call_stack_depth, unsigned int queue_size, FILE *optional_debug_file)
+{
+    griot_pipeline.call_stack_depth = call_stack_depth;
+    griot_pipeline.capture_depth = griot_record_depth()>call_stack_depth ? griot_record_depth() : call_stack_depth;
+    griot_pipeline.debug_file = optional_debug_file;
+
+    // The ring size must be a power of two
+    griot_pipeline.queue_size = 1;
+    while(griot_pipeline.queue_size<queue_size) griot_pipeline.queue_size <<= 1;
+
+    // Records have a variable size, depending on the call stack depth. Keep them 8 bytes aligned.
+    griot_pipeline.record_size = sizeof(griot_pipeline_record) + sizeof(unsigned long)*griot_pipeline.capture_depth;
+    griot_pipeline.record_size = (griot_pipeline.record_size+7) & ~(size_t)7;
+
+    if(pthread_key_create(&griot_pipeline.ring_key, griot_ring_retire)) FATAL("Could not create the GrIOt ring key");
+    griot_pipeline.next_sequence = griot_record_sequence_next()+1;
+
+    atomic_store(&griot_pipeline.running, true);
+    if(pthread_create(&griot_pipeline.thread, NULL, griot_pipeline_main, NULL)) FATAL("Could not start the GrIOt model thread");
+    griot_pipeline.started = true;
+}
+
+void griot_pipeline_push(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash)
+{
+    if(!griot_pipeline.started) return;
+
+    griot_ring *ring = thread_ring;
+    if(ring==NULL) ring = thread_ring = griot_ring_new();
+
+    // Is there a free record? If not, give the model thread a chance to catch up before dropping the I/O
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if(head-tail>ring->mask){
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for(int spins = 0; head-tail>ring->mask && spins<GRIOT_ASYNC_MAX_BACKPRESSURE_SPINS; spins++){
+            sched_yield();
+            tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ring->stats.backpressure_count += 1;
+        ring->stats.backpressure_time += (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+        if(head-tail>ring->mask){
+            ring->stats.dropped += 1;
+            return;
+        }
+    }
+
+    // Capture the raw frames straight into the record. Hashing is left to the model thread.
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    griot_pipeline_record *record = griot_ring_record(ring, head);
+    record->frame_count = fast_backtrace((void **)record->frames, griot_pipeline.capture_depth);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+
+    // The sequence number is drawn last, so that the model thread waits as little as possible for the record. Dropped
+    // I/Os never get one.
+    record->event = (griot_io_event){.timestamp=timestamp, .thread_id=thread_id, .fd=fd, .offset=offset, .length=length,
+        .duration_ns=duration_ns, .op_type=op_type, .call_stack_time_ns=dt_ns, .path_hash=path_hash,
+        .sequence=griot_record_sequence_next()};
+    atomic_store_explicit(&ring->head, head+1, memory_order_release);
+
+    ring->stats.pushed += 1;
+    ring->stats.capture_time += dt_ns;
+}
+
+void griot_pipeline_stop()
+{
+    if(!griot_pipeline.started) return;
+    atomic_store(&griot_pipeline.running, false);
+    pthread_join(griot_pipeline.thread, NULL);
+    griot_pipeline.started = false;
+}
+
+void griot_pipeline_follow_fork(FILE *optional_debug_file)
+{
+    if(!griot_pipeline.started) return;
+
+    // The model thread did not survive the fork, and the pending I/Os belong to the parent. So do the other threads:
+    // only the ring of the calling one is kept.
+    griot_ring *ring = atomic_load(&griot_pipeline.rings);
+    while(ring){
+        griot_ring *next = ring->next;
+        if(ring!=thread_ring) griot_ring_free(ring);
+        ring = next;
+    }
+    if(thread_ring){
+        atomic_store(&thread_ring->head, 0);
+        atomic_store(&thread_ring->tail, 0);
+        memset(&thread_ring->stats, 0, sizeof(griot_ring_stats));
+    }
+    griot_pipeline.retired_ring_count = 0;
+    memset(&griot_pipeline.retired_stats, 0, sizeof(griot_ring_stats));
+    griot_pipeline.next_sequence = griot_record_sequence_next()+1;
+    griot_pipeline.processed = 0;
+    griot_pipeline.queue_depth_sum = 0;
+    griot_pipeline.queue_depth_samples = 0;
+    griot_pipeline.max_queue_depth = 0;
+
+    griot_pipeline.debug_file = optional_debug_file;
+    atomic_store(&griot_pipeline.running, true);
+    if(pthread_create(&griot_pipeline.thread, NULL, griot_pipeline_main, NULL)) FATAL("Could not start the GrIOt model thread");
+}
+
+void griot_pipeline_results_dump(FILE *file)
+{
+    griot_ring_stats stats = griot_pipeline.retired_stats;
+    for(griot_ring *ring = atomic_load(&griot_pipeline.rings); ring; ring = ring->next) griot_ring_stats_add(&stats, &ring->stats);
+
+    iolib_safe_fprintf(file, "async_queue_size=%lu\nasync_rings=%u\nasync_retired_rings=%u\nasync_pushed_count=%lu\nasync_processed_count=%lu\nasync_dropped_count=%lu\n"
+            "async_backpressure_count=%lu\nasync_backpressure_time_ns=%lu\nasync_capture_time_ns=%lu\nasync_max_queue_depth=%lu\nasync_mean_queue_depth=%.2f\n",
+            griot_pipeline.queue_size,
+            atomic_load(&griot_pipeline.ring_count),
+            griot_pipeline.retired_ring_count,
+            stats.pushed,
+            griot_pipeline.processed,
+            stats.dropped,
+            stats.backpressure_count,
+            stats.backpressure_time,
+            stats.capture_time,
+            griot_pipeline.max_queue_depth,
+            griot_pipeline.queue_depth_samples==0?0.0:(double)griot_pipeline.queue_depth_sum/griot_pipeline.queue_depth_samples);
+    fflush(file);
+}
+
+// ######################
+
+static void *griot_pipeline_main(void *arg)
+{
+    const struct timespec idle_sleep = {.tv_sec=0, .tv_nsec=GRIOT_ASYNC_IDLE_SLEEP_NS};
+    while(atomic_load(&griot_pipeline.running)){
+        if(griot_pipeline_drain(false)==0) nanosleep(&idle_sleep, NULL);
+    }
+
+    // Whatever was pushed before the stop request still has to reach the model
+    griot_pipeline_drain(true);
+    return NULL;
+}
+
+/**
+ * Hash the call stack of the record at the tail of a ring, and feed it to the model
+ */
+static void griot_pipeline_process(griot_ring *ring, uint64_t tail)
+{
+    griot_pipeline_record *record = griot_ring_record(ring, tail);
+    griot_io_event event = record->event;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    make_backtrace_relative(record->frames, record->frame_count);
+    uint32_t hashed_frame_count = record->frame_count<griot_pipeline.call_stack_depth ? record->frame_count : griot_pipeline.call_stack_depth;
+    event.call_stack = MurmurHash64A(record->frames, hashed_frame_count * sizeof(unsigned long), GRIOT_SEED);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    event.call_stack_time_ns += (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+    griot_record_event(&event, record->frames, record->frame_count);
+
+    // The record can be reused as soon as its content has been consumed
+    atomic_store_explicit(&ring->tail, tail+1, memory_order_release);
+    on_io_event(&event, griot_pipeline.debug_file);
+    griot_pipeline.next_sequence = event.sequence+1;
+}
+
+/**
+ * Process the records published so far, in capture sequence order. Stops at the first missing sequence number, i.e.
+ * a record still being published, unless final: then no producer is left to publish it.
+ *
+ * @return the number of I/Os processed
+ */
+static uint64_t griot_pipeline_drain(bool final)
+{
+    // (1) Queue depth stats, sampled on every non-empty ring, and retired rings freed once empty
+    griot_ring *ring = atomic_load_explicit(&griot_pipeline.rings, memory_order_acquire);
+    while(ring){
+        griot_ring *next = ring->next;
+        bool retired = atomic_load_explicit(&ring->retired, memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if(head!=tail){
+            uint64_t depth = head-tail;
+            griot_pipeline.queue_depth_sum += depth;
+            griot_pipeline.queue_depth_samples += 1;
+            if(depth>griot_pipeline.max_queue_depth) griot_pipeline.max_queue_depth = depth;
+        }else if(retired){
+            griot_ring_free(ring);
+        }
+        ring = next;
+    }
+
+    // (2) Merging the ring heads on the sequence numbers. A thread often does several I/Os in a row, so the ring of the
+    // last record processed is tried first, before looking for the smallest head of all.
+    uint64_t processed = 0;
+    griot_ring *last = NULL;
+    while(true){
+        griot_ring *first = NULL;
+        uint64_t first_sequence = UINT64_MAX;
+        if(last){
+            uint64_t tail = atomic_load_explicit(&last->tail, memory_order_relaxed);
+            if(tail!=atomic_load_explicit(&last->head, memory_order_acquire)
+                    && griot_ring_record(last, tail)->event.sequence==griot_pipeline.next_sequence){
+                first = last;
+                first_sequence = griot_pipeline.next_sequence;
+            }
+        }
+        for(ring = first ? NULL : atomic_load_explicit(&griot_pipeline.rings, memory_order_acquire); ring; ring = ring->next){
+            uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if(tail==atomic_load_explicit(&ring->head, memory_order_acquire)) continue;
+            uint64_t sequence = griot_ring_record(ring, tail)->event.sequence;
+            if(sequence<first_sequence){
+                first = ring;
+                first_sequence = sequence;
+            }
+        }
+        if(first==NULL || (!final && first_sequence!=griot_pipeline.next_sequence)) break;
+
+        griot_pipeline_process(first, atomic_load_explicit(&first->tail, memory_order_relaxed));
+        last = first;
+        processed += 1;
+    }
+    griot_pipeline.processed += processed;
+    return processed;
+}
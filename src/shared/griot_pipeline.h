@@ -0,0 +1,46 @@
+#ifndef GRIOT_PIPELINE_H
+#define GRIOT_PIPELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "griot_model.h"
+
+/**
+ * Asynchronous model update pipeline.
+ *
+ * The I/O hooks only capture the raw frames of the call stack and the I/O metadata, and push them into a per-thread
+ * lock-free single producer single consumer ring. A background model thread merges the rings in capture order, hashes
+ * the call stacks and runs on_io_event, taking the model cost off the critical path of the application.
+ */
+
+/**
+ * Start the model thread. Each producer thread lazily gets a ring of queue_size records on its first I/O, freed once
+ * the thread has exited and its records have been processed.
+ */
+void griot_pipeline_start(unsigned int call_stack_depth, unsigned int queue_size, FILE *optional_debug_file);
+
+/**
+ * Called by the I/O hooks. Captures the call stack of the calling thread and enqueues the I/O.
+ * If the ring stays full for too long, the I/O is dropped.
+ */
+void griot_pipeline_push(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash);
+
+/**
+ * Drain every ring and stop the model thread. Must be called before griot_results_dump.
+ */
+void griot_pipeline_stop();
+
+/**
+ * Called in the child process after a fork. Pending I/Os of the parent are discarded and a new model thread is started.
+ */
+void griot_pipeline_follow_fork(FILE *optional_debug_file);
+
+/**
+ * Print the pipeline stats (queue depth, drops and backpressure) after the model results
+ */
+void griot_pipeline_results_dump(FILE *file);
+
+#endif
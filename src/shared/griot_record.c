@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "griot_record.h"
+#include "backtrace.h"
+#include "griot_config.h"
+#include "log.h"
+
+/*
+ * Every thread that records owns a log. Only that thread ever writes to it, so appending a record takes no lock.
+ * Logs are opened, grown and closed with raw syscalls, so that they never go through the iolib hooks.
+ *
+ * A thread flags its log while appending a record, after checking that recording is still on. griot_record_stop turns
+ * recording off before waiting for the flags, so no log is unmapped while a record is being appended to it.
+ */
+
+typedef struct griot_record_log
+{
+    int fd;
+
+    // Set while the owner thread appends a record, see griot_record_stop
+    atomic_bool writing;
+
+    // The chunk of the file currently mapped, and where the next byte goes in it
+    unsigned char *chunk;
+    uint64_t chunk_offset;
+    uint64_t position;
+
+    // The previous record, that the next one is encoded against
+    uint64_t sequence;
+    uint64_t timestamp;
+    int32_t thread_id;
+    int record_fd;
+    uint64_t offset_end;
+    uint32_t frame_count;
+    unsigned long *frames;
+
+    // Stats
+    uint64_t record_count;
+    uint64_t record_bytes;
+    uint64_t record_time;
+
+    // All the logs are chained so that they can be closed and dumped
+    struct griot_record_log *next;
+} griot_record_log;
+
+static struct
+{
+    atomic_bool started;
+    char path_prefix[PATH_MAX];
+    unsigned int record_depth;
+    unsigned int call_stack_depth;
+
+    // Logs of every thread that recorded an I/O so far
+    _Atomic(griot_record_log *) logs;
+    _Atomic unsigned int log_count;
+
+    // Bumped after a fork, so that the forking thread does not write to the log of the parent anymore
+    uint64_t generation;
+
+    // Last capture sequence number drawn
+    _Atomic uint64_t sequence;
+} griot_record;
+
+static __thread griot_record_log *thread_log;
+static __thread uint64_t thread_log_generation;
+
+/**
+ * Map the chunk of the log starting at chunk_offset, growing the file to hold it
+ */
+static void griot_record_log_map(griot_record_log *log, uint64_t chunk_offset)
+{
+    if(log->chunk) munmap(log->chunk, GRIOT_RECORD_CHUNK_SIZE);
+    if(syscall(SYS_ftruncate, log->fd, chunk_offset+GRIOT_RECORD_CHUNK_SIZE)<0) FATAL("Could not grow a GrIOt record log");
+    log->chunk = mmap(NULL, GRIOT_RECORD_CHUNK_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, log->fd, chunk_offset);
+    if(log->chunk==MAP_FAILED) FATAL("Could not map a GrIOt record log");
+    log->chunk_offset = chunk_offset;
+    log->position = 0;
+}
+
+static void griot_record_log_write(griot_record_log *log, const unsigned char *bytes, size_t size)
+{
+    // A record may span two chunks
+    while(size>0){
+        if(log->position==GRIOT_RECORD_CHUNK_SIZE) griot_record_log_map(log, log->chunk_offset+GRIOT_RECORD_CHUNK_SIZE);
+        size_t written = GRIOT_RECORD_CHUNK_SIZE-log->position;
+        if(written>size) written = size;
+        memcpy(log->chunk+log->position, bytes, written);
+        log->position += written;
+        bytes += written;
+        size -= written;
+    }
+}
+
+static griot_record_log *griot_record_log_new()
+{
+    griot_record_log *log = malloc(sizeof(griot_record_log));
+    if(!log) FATAL("Out of memory");
+    memset(log, 0, sizeof(griot_record_log));
+    log->frames = calloc(griot_record.record_depth, sizeof(unsigned long));
+    if(!log->frames) FATAL("Out of memory");
+
+    char path[PATH_MAX];
+    unsigned int index = atomic_fetch_add(&griot_record.log_count, 1);
+    if(snprintf(path, PATH_MAX, "%s_%u.griotrec", griot_record.path_prefix, index)>=PATH_MAX) FATAL("GrIOt record log path is too long");
+    log->fd = syscall(SYS_openat, AT_FDCWD, path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(log->fd<0) FATAL("Could not create the GrIOt record log \"%s\"", path);
+    griot_record_log_map(log, 0);
+
+    griot_record_header header = {.magic=GRIOT_RECORD_MAGIC, .version=GRIOT_RECORD_VERSION, .record_depth=griot_record.record_depth,
+        .call_stack_depth=griot_record.call_stack_depth, .seed=GRIOT_SEED};
+    griot_record_log_write(log, (const unsigned char *)&header, sizeof(header));
+
+    // Publishing the log for griot_record_stop
+    griot_record_log *logs = atomic_load(&griot_record.logs);
+    do {
+        log->next = logs;
+    } while(!atomic_compare_exchange_weak(&griot_record.logs, &logs, log));
+    return log;
+}
+
+void griot_record_start(const char *path_prefix, unsigned int record_depth, unsigned int call_stack_depth)
+{
+    strncpy(griot_record.path_prefix, path_prefix, PATH_MAX-1);
+    griot_record.record_depth = record_depth<call_stack_depth ? call_stack_depth : record_depth;
+    griot_record.call_stack_depth = call_stack_depth;
+    atomic_store(&griot_record.started, true);
+}
+
+unsigned int griot_record_depth()
+{
+    return atomic_load_explicit(&griot_record.started, memory_order_relaxed) ? griot_record.record_depth : 0;
+}
+
+void griot_record_on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash, FILE *optional_debug_file)
+{
+    // Like on_io, but keeping the relative frames. Only the first call_stack_depth ones make the hash of the model.
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    unsigned long frames[griot_record.record_depth];
+    int frame_count = fast_backtrace((void **)frames, griot_record.record_depth);
+    make_backtrace_relative(frames, frame_count);
+    int hashed_frame_count = frame_count<(int)griot_record.call_stack_depth ? frame_count : (int)griot_record.call_stack_depth;
+    uint64_t call_stack = MurmurHash64A(frames, hashed_frame_count * sizeof(unsigned long), GRIOT_SEED);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long dt_ns = (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+
+    griot_io_event event = {.timestamp=timestamp, .thread_id=thread_id, .fd=fd, .offset=offset, .length=length,
+        .duration_ns=duration_ns, .op_type=op_type, .call_stack=call_stack, .call_stack_time_ns=dt_ns, .path_hash=path_hash,
+        .sequence=griot_record_sequence_next()};
+    griot_record_event(&event, frames, frame_count);
+    on_io_event(&event, optional_debug_file);
+}
+
+uint64_t griot_record_sequence_next()
+{
+    return atomic_fetch_add_explicit(&griot_record.sequence, 1, memory_order_relaxed)+1;
+}
+
+void griot_record_event(const griot_io_event *event, const unsigned long *frames, uint32_t frame_count)
+{
+    if(!atomic_load_explicit(&griot_record.started, memory_order_relaxed)) return;
+
+    griot_record_log *log = thread_log;
+    if(log==NULL || thread_log_generation!=griot_record.generation){
+        log = thread_log = griot_record_log_new();
+        thread_log_generation = griot_record.generation;
+    }
+
+    // Flag the log, then check that it is still mapped. Both are sequentially consistent, like in griot_record_stop.
+    atomic_store(&log->writing, true);
+    if(!atomic_load(&griot_record.started)){
+        atomic_store_explicit(&log->writing, false, memory_order_release);
+        return;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if(frame_count>griot_record.record_depth) frame_count = griot_record.record_depth;
+
+    // (1) Encode the record, against the previous one
+    unsigned char bytes[GRIOT_RECORD_MAX_FIXED_BYTES + 10*frame_count];
+    unsigned char *end = bytes;
+    end = griot_record_put_varint(end, 1 + ((uint64_t)event->op_type | (uint64_t)frame_count<<2));
+    end = griot_record_put_varint(end, griot_record_zigzag(event->sequence-log->sequence));
+    end = griot_record_put_varint(end, griot_record_zigzag(event->timestamp-log->timestamp));
+    end = griot_record_put_varint(end, griot_record_zigzag((int64_t)event->thread_id-log->thread_id));
+    end = griot_record_put_varint(end, griot_record_zigzag((int64_t)event->fd-log->record_fd));
+    end = griot_record_put_varint(end, griot_record_zigzag(event->offset-log->offset_end));
+    end = griot_record_put_varint(end, event->length);
+    end = griot_record_put_varint(end, event->duration_ns);
+    if(event->op_type==GRIOT_OPEN){
+        for(int i = 0; i<8; i++) *end++ = (unsigned char)(event->path_hash >> (8*i));
+    }
+    for(uint32_t i = 0; i<frame_count; i++){
+        unsigned long previous_frame = i<log->frame_count ? log->frames[i] : 0;
+        end = griot_record_put_varint(end, griot_record_zigzag(frames[i]-previous_frame));
+    }
+
+    // (2) Append it to the log
+    griot_record_log_write(log, bytes, end-bytes);
+
+    // (3) It becomes the previous record
+    log->sequence = event->sequence;
+    log->timestamp = event->timestamp;
+    log->thread_id = event->thread_id;
+    log->record_fd = event->fd;
+    log->offset_end = event->offset+event->length;
+    memcpy(log->frames, frames, frame_count*sizeof(unsigned long));
+    log->frame_count = frame_count;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    log->record_count += 1;
+    log->record_bytes += end-bytes;
+    log->record_time += (double)(t1.tv_sec - t0.tv_sec) * 1.0e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+    atomic_store_explicit(&log->writing, false, memory_order_release);
+}
+
+void griot_record_stop()
+{
+    if(!atomic_exchange(&griot_record.started, false)) return;
+    for(griot_record_log *log = atomic_load(&griot_record.logs); log; log = log->next){
+        if(log->fd<0) continue;
+
+        // A thread that saw recording on may still be appending a record
+        while(atomic_load(&log->writing)) sched_yield();
+        uint64_t size = log->chunk_offset+log->position;
+        munmap(log->chunk, GRIOT_RECORD_CHUNK_SIZE);
+        log->chunk = NULL;
+        syscall(SYS_ftruncate, log->fd, size);
+        syscall(SYS_close, log->fd);
+        log->fd = -1;
+    }
+}
+
+void griot_record_follow_fork(const char *path_prefix)
+{
+    if(!atomic_load(&griot_record.started)) return;
+
+    // The logs are shared with the parent: only unmap them, the parent still writes to them
+    griot_record_log *log = atomic_exchange(&griot_record.logs, NULL);
+    while(log){
+        griot_record_log *next = log->next;
+        munmap(log->chunk, GRIOT_RECORD_CHUNK_SIZE);
+        syscall(SYS_close, log->fd);
+        free(log->frames);
+        free(log);
+        log = next;
+    }
+    atomic_store(&griot_record.log_count, 0);
+    griot_record.generation += 1;
+    strncpy(griot_record.path_prefix, path_prefix, PATH_MAX-1);
+}
+
+void griot_record_results_dump(FILE *file)
+{
+    uint64_t record_count = 0, record_bytes = 0, record_time = 0;
+    for(griot_record_log *log = atomic_load(&griot_record.logs); log; log = log->next){
+        record_count += log->record_count;
+        record_bytes += log->record_bytes;
+        record_time += log->record_time;
+    }
+
+    iolib_safe_fprintf(file, "record_depth=%u\nrecord_logs=%u\nrecord_count=%lu\nrecord_bytes=%lu\nrecord_time_ns=%lu\n",
+            griot_record.record_depth,
+            atomic_load(&griot_record.log_count),
+            record_count,
+            record_bytes,
+            record_time);
+    fflush(file);
+}
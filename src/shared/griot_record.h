@@ -0,0 +1,138 @@
+#ifndef GRIOT_RECORD_H
+#define GRIOT_RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "griot_model.h"
+
+/**
+ * Recording mode: every I/O is appended to a compact binary log, along with the raw relative frames of its call stack,
+ * so that any model can be run again offline on the same I/Os.
+ *
+ * Each thread that feeds the model owns its own log file, mapped in memory by chunks of GRIOT_RECORD_CHUNK_SIZE bytes
+ * and grown as needed. Recording an I/O is a handful of varints written to memory: no formatting, no syscall and no
+ * lock, unlike the text debug file.
+ *
+ * A log is a griot_record_header followed by records. Most fields are deltas from the previous record of the same log,
+ * zigzag encoded when they may be negative, and written as LEB128 varints:
+ *  - 1 + (op_type | frame_count<<2). A 0 ends the log, e.g. when the process died before closing it.
+ *  - sequence, minus the one of the previous record (zigzag). Sequences are drawn from a counter of the process, so
+ *    that the records of every log can be merged back in capture order. Not in version 1 logs.
+ *  - timestamp, thread id and fd, each minus the one of the previous record (zigzag)
+ *  - offset, minus the end offset (offset+length) of the previous record (zigzag)
+ *  - length and duration_ns
+ *  - for GRIOT_OPEN only, the path hash, as 8 little endian bytes
+ *  - frame_count relative frames, each minus the frame at the same depth in the previous record, or 0 (zigzag)
+ *
+ * Frames are recorded up to the record depth, that may be larger than the call stack depth of the live model. The call
+ * stack hash at any depth n is the hash of the first n frames, see make_backtrace_relative.
+ */
+
+#define GRIOT_RECORD_MAGIC "GRIOTREC"
+#define GRIOT_RECORD_VERSION 2
+
+/** Largest number of bytes of a record, without its frames */
+#define GRIOT_RECORD_MAX_FIXED_BYTES (8*10 + 8)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+
+    // Frames recorded per I/O at most, and the call stack depth of the live model
+    uint32_t record_depth;
+    uint32_t call_stack_depth;
+    uint32_t reserved;
+
+    // Seed of the call stack hashes
+    uint64_t seed;
+} griot_record_header;
+
+/**
+ * Start recording. Logs are named <path_prefix>_<log index>.griotrec. Must be called before griot_pipeline_start.
+ */
+void griot_record_start(const char *path_prefix, unsigned int record_depth, unsigned int call_stack_depth);
+
+/**
+ * @return the number of frames recorded per I/O at most, or 0 when not recording
+ */
+unsigned int griot_record_depth();
+
+/**
+ * Same as on_io, but the call stack is captured down to the record depth, and the I/O is recorded before being fed to
+ * the model.
+ */
+void griot_record_on_io(uint64_t timestamp, int32_t thread_id, int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash, FILE *optional_debug_file);
+
+/**
+ * @return the next capture sequence number of the process, see griot_io_event.sequence
+ */
+uint64_t griot_record_sequence_next();
+
+/**
+ * Append an I/O to the log of the calling thread, creating the log on its first I/O. frames must be relative.
+ * Does nothing when not recording.
+ */
+void griot_record_event(const griot_io_event *event, const unsigned long *frames, uint32_t frame_count);
+
+/**
+ * Unmap every log and truncate it to the bytes recorded. Waits for the threads that are appending a record, and the
+ * records appended afterwards are dropped.
+ */
+void griot_record_stop();
+
+/**
+ * Called in the child process after a fork. The logs of the parent are left to the parent, and new ones are started
+ * with the new path prefix.
+ */
+void griot_record_follow_fork(const char *path_prefix);
+
+/**
+ * Print the recording stats (logs, records, bytes and time spent recording) after the model results
+ */
+void griot_record_results_dump(FILE *file);
+
+static inline uint64_t griot_record_zigzag(int64_t value)
+{
+    return ((uint64_t)value<<1) ^ (uint64_t)(value>>63);
+}
+
+static inline int64_t griot_record_unzigzag(uint64_t value)
+{
+    return (int64_t)(value>>1) ^ -(int64_t)(value&1);
+}
+
+/**
+ * @return the byte right after the varint
+ */
+static inline unsigned char *griot_record_put_varint(unsigned char *bytes, uint64_t value)
+{
+    while(value>=0x80){
+        *bytes++ = (unsigned char)value | 0x80;
+        value >>= 7;
+    }
+    *bytes++ = (unsigned char)value;
+    return bytes;
+}
+
+/**
+ * @return the byte right after the varint, or NULL if it does not end before end
+ */
+static inline const unsigned char *griot_record_get_varint(const unsigned char *bytes, const unsigned char *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    for(unsigned int shift = 0; bytes<end && shift<64; shift += 7){
+        unsigned char byte = *bytes++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            *value = result;
+            return bytes;
+        }
+    }
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "griot_record_reader.h"
+#include "log.h"
+
+int griot_record_reader_open(griot_record_reader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(griot_record_reader));
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if(fd<0) return -1;
+
+    struct stat st;
+    if(fstat(fd, &st)<0 || (size_t)st.st_size<sizeof(griot_record_header)){
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data==MAP_FAILED) return -1;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    reader->data = data;
+    reader->size = st.st_size;
+    reader->end = reader->data+reader->size;
+    memcpy(&reader->header, reader->data, sizeof(griot_record_header));
+    if(memcmp(reader->header.magic, GRIOT_RECORD_MAGIC, sizeof(reader->header.magic))!=0 || (reader->header.version!=1 && reader->header.version!=GRIOT_RECORD_VERSION)){
+        griot_record_reader_close(reader);
+        return -1;
+    }
+    reader->position = reader->data+sizeof(griot_record_header);
+
+    reader->frames = calloc(reader->header.record_depth, sizeof(unsigned long));
+    if(!reader->frames) FATAL("Out of memory");
+    return 0;
+}
+
+bool griot_record_reader_next(griot_record_reader *reader)
+{
+    const unsigned char *bytes = reader->position;
+    const unsigned char *end = reader->end;
+    griot_io_event *event = &reader->event;
+    uint64_t value;
+
+    // (1) Op type and frame count. 0 ends a log that was not truncated to its size.
+    if(bytes==end || (bytes = griot_record_get_varint(bytes, end, &value))==NULL || value==0) return false;
+    value -= 1;
+    op_type op = (op_type)(value & 3);
+    uint64_t frame_count = value>>2;
+    if(frame_count>reader->header.record_depth) return false;
+
+    // (2) The I/O, encoded against the previous record. Version 1 logs have no sequence.
+    uint64_t sequence = 0, timestamp, thread_id, fd, offset, length, duration_ns;
+    if(reader->header.version>=2 && (bytes = griot_record_get_varint(bytes, end, &sequence))==NULL) return false;
+    if((bytes = griot_record_get_varint(bytes, end, &timestamp))==NULL) return false;
+    if((bytes = griot_record_get_varint(bytes, end, &thread_id))==NULL) return false;
+    if((bytes = griot_record_get_varint(bytes, end, &fd))==NULL) return false;
+    if((bytes = griot_record_get_varint(bytes, end, &offset))==NULL) return false;
+    if((bytes = griot_record_get_varint(bytes, end, &length))==NULL) return false;
+    if((bytes = griot_record_get_varint(bytes, end, &duration_ns))==NULL) return false;
+    uint64_t path_hash = 0;
+    if(op==GRIOT_OPEN){
+        if(end-bytes<8) return false;
+        for(int i = 0; i<8; i++) path_hash |= (uint64_t)bytes[i] << (8*i);
+        bytes += 8;
+    }
+
+    // (3) The frames, each encoded against the frame at the same depth in the previous record
+    bool frames_changed = frame_count!=reader->frame_count;
+    for(uint32_t i = 0; i<frame_count; i++){
+        uint64_t delta;
+        if((bytes = griot_record_get_varint(bytes, end, &delta))==NULL) return false;
+        unsigned long previous_frame = i<reader->frame_count ? reader->frames[i] : 0;
+        if(delta!=0) frames_changed = true;
+        reader->frames[i] = previous_frame+griot_record_unzigzag(delta);
+    }
+
+    event->sequence += griot_record_unzigzag(sequence);
+    event->timestamp += griot_record_unzigzag(timestamp);
+    event->thread_id += griot_record_unzigzag(thread_id);
+    event->fd += griot_record_unzigzag(fd);
+    event->offset = reader->offset_end+griot_record_unzigzag(offset);
+    event->length = length;
+    event->duration_ns = duration_ns;
+    event->op_type = op;
+    event->path_hash = path_hash;
+    reader->offset_end = event->offset+event->length;
+    reader->frame_count = frame_count;
+    reader->frames_changed = frames_changed;
+    reader->position = bytes;
+    return true;
+}
+
+void griot_record_reader_close(griot_record_reader *reader)
+{
+    if(reader->data) munmap((void *)reader->data, reader->size);
+    free(reader->frames);
+    memset(reader, 0, sizeof(griot_record_reader));
+}
@@ -0,0 +1,47 @@
+#ifndef GRIOT_RECORD_READER_H
+#define GRIOT_RECORD_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "griot_record.h"
+
+/**
+ * Sequential reader of a record log, see griot_record.h. The log is mapped read only, and decoded in place.
+ * Only needs libc, so that logs can be replayed away from the traced application.
+ */
+typedef struct
+{
+    const unsigned char *data;
+    const unsigned char *end;
+    const unsigned char *position;
+    size_t size;
+    griot_record_header header;
+
+    // The last record read. Its call stack hash is left to the caller, at the depth of its choice.
+    griot_io_event event;
+    uint32_t frame_count;
+    unsigned long *frames;
+
+    // Whether the frames differ from the ones of the previous record, so that their hash can be reused if not
+    bool frames_changed;
+
+    // End offset of the last record, that the offset of the next one is encoded against
+    uint64_t offset_end;
+} griot_record_reader;
+
+/**
+ * @return 0 upon success, -1 if the log cannot be mapped or is not a record log
+ */
+int griot_record_reader_open(griot_record_reader *reader, const char *path);
+
+/**
+ * Read the next record into reader->event and reader->frames
+ *
+ * @return false at the end of the log, or if the last record is truncated
+ */
+bool griot_record_reader_next(griot_record_reader *reader);
+
+void griot_record_reader_close(griot_record_reader *reader);
+
+#endif
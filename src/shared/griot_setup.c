@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "griot_setup.h"
+#include "griot_model.h"
+#include "backtrace.h"
+#include "griot_config.h"
+#include "log.h"
+
+void griot_setup_from_env(griot_setup *setup)
+{
+    // Default params when env variables are not set
+    memset(setup, 0, sizeof(griot_setup));
+    setup->context_size = 16;
+    setup->call_stack_depth = 16;
+
+    /* Select the granularities from env */
+    char *granularity_str = getenv(GRIOT_ENV_GRANULARITY);
+    if(granularity_str && griot_select_granularities(granularity_str)<0){
+        #ifdef GRIOT_ENABLE_DEBUG_LOG
+        iolib_safe_fprintf(stderr, "[GrIOt] Unknown granularity \"%s\" was passed to GrIOt. The default one will be used instead.", granularity_str);
+        #endif
+    }
+
+    /* Select the unwinder from env */
+    char *unwinder_str = getenv(GRIOT_ENV_UNWINDER);
+    if(unwinder_str && iotracer_backtrace_set_unwinder(unwinder_str)<0){
+        #ifdef GRIOT_ENABLE_DEBUG_LOG
+        iolib_safe_fprintf(stderr, "[GrIOt] Unknown unwinder \"%s\" was passed to GrIOt. The default one will be used instead.", unwinder_str);
+        #endif
+    }
+
+    /* Reading the context size from environment variable */
+    char *context_size_str = getenv(GRIOT_ENV_CONTEXT_SIZE);
+    if(context_size_str){
+        long context_size = strtol(context_size_str, (char **)NULL, 10);
+        if(context_size<=0){
+            #ifdef GRIOT_ENABLE_DEBUG_LOG
+            iolib_safe_fprintf(stderr, "[GrIOt] A negative, zero or invalid context size was passed to GrIOt. Default value \"%u\" will be used instead.", setup->context_size);
+            #endif
+        }else{
+            setup->context_size = context_size>1024?1024:(unsigned int)context_size;
+        }
+    }
+
+    /* Optionally, sweep a list of context sizes, e.g. "1,2,4,8,16,32" */
+    char *context_sizes_str = getenv(GRIOT_ENV_CONTEXT_SIZES);
+    if(context_sizes_str){
+        uint32_t context_sizes[GRIOT_MAX_CONTEXT_SIZES];
+        uint32_t count = 0;
+        char *str = context_sizes_str;
+        while(*str && count<GRIOT_MAX_CONTEXT_SIZES){
+            char *end;
+            long context_size = strtol(str, &end, 10);
+            if(end==str || context_size<=0) break;
+            context_sizes[count++] = context_size>1024?1024:(uint32_t)context_size;
+            str = *end==',' ? end+1 : end;
+        }
+        if(count==0 || *str){
+            #ifdef GRIOT_ENABLE_DEBUG_LOG
+            iolib_safe_fprintf(stderr, "[GrIOt] An invalid or too long list of context sizes was passed to GrIOt. Only the first %u ones will be used.", count);
+            #endif
+        }
+        if(count>0) griot_set_context_sizes(context_sizes, count);
+    }
+
+    /* Get the call stack depth from env */
+    char *call_stack_depth_str = getenv(GRIOT_ENV_CALL_STACK_DEPTH);
+    if(call_stack_depth_str){
+        long call_stack_depth = strtol(call_stack_depth_str, (char **)NULL, 10);
+        if(call_stack_depth<=0){
+            #ifdef GRIOT_ENABLE_DEBUG_LOG
+            iolib_safe_fprintf(stderr, "[GrIOt] A negative, zero or invalid call stack depth was passed to GrIOt. Default value \"%u\" will be used instead.", setup->call_stack_depth);
+            #endif
+        }else{
+            setup->call_stack_depth = (unsigned int)call_stack_depth;
+        }
+    }
+
+    /* Optionally, give each thread its own model shard so that on_io does not need the global lock */
+    char *thread_sharded_str = getenv(GRIOT_ENV_THREAD_SHARDED);
+    if(thread_sharded_str && strcmp(thread_sharded_str, "0")!=0){
+        setup->thread_sharded = true;
+        griot_enable_thread_sharding();
+    }
+
+    /* Optionally, bound the memory used by the model nodes */
+    char *max_model_bytes_str = getenv(GRIOT_ENV_MAX_MODEL_BYTES);
+    if(max_model_bytes_str){
+        griot_set_max_model_bytes(strtoull(max_model_bytes_str, (char **)NULL, 10));
+    }
+
+    /* Optionally, give every thread its own context window */
+    char *per_thread_context_str = getenv(GRIOT_ENV_PER_THREAD_CONTEXT);
+    if(per_thread_context_str && strcmp(per_thread_context_str, "0")!=0){
+        griot_enable_per_thread_context();
+    }
+
+    griot_init(setup->context_size, setup->call_stack_depth);
+
+    /* Optionally, record every I/O for offline replay */
+    char *record_str = getenv(GRIOT_ENV_RECORD);
+    if(record_str && strcmp(record_str, "0")!=0){
+        setup->recording = true;
+        setup->record_depth = GRIOT_RECORD_DEFAULT_DEPTH;
+        char *record_depth_str = getenv(GRIOT_ENV_RECORD_DEPTH);
+        if(record_depth_str){
+            long depth = strtol(record_depth_str, (char **)NULL, 10);
+            if(depth>0) setup->record_depth = depth>GRIOT_RECORD_MAX_DEPTH?GRIOT_RECORD_MAX_DEPTH:(unsigned int)depth;
+        }
+    }
+
+    /* Optionally, take the model updates off the application threads */
+    char *async_str = getenv(GRIOT_ENV_ASYNC);
+    if(async_str && strcmp(async_str, "0")!=0){
+        setup->async = true;
+        setup->async_queue_size = GRIOT_ASYNC_DEFAULT_QUEUE_SIZE;
+        char *queue_size_str = getenv(GRIOT_ENV_ASYNC_QUEUE_SIZE);
+        if(queue_size_str){
+            long size = strtol(queue_size_str, (char **)NULL, 10);
+            if(size>0) setup->async_queue_size = size>(1<<20)?(1<<20):(unsigned int)size;
+        }
+    }
+}
+
+char *griot_process_name(){
+    #if defined(_GNU_SOURCE)
+    char *name =  program_invocation_name;
+    #else
+    char *name =  "?";
+    #endif
+
+    char *array = name;
+    char *start = name;
+    while(*array){
+        if(*array=='/')
+            start=array+1;
+        array++;
+    }
+    return start;
+}
+
+static void mkdir_recursive(const char *path){
+    char *subpath, *fullpath;
+
+    fullpath = strdup(path);
+    subpath = dirname(fullpath);
+    if (strlen(subpath) > 1)
+        mkdir_recursive(subpath);
+    mkdir(path, 0777);
+    free(fullpath);
+}
+
+void griot_dump_folder(char *base_dump_name, int array_size)
+{
+    char *griot_dump_folder_base = getenv(GRIOT_ENV_DUMP_FOLDER);
+    char *griot_experiment_name = getenv(GRIOT_ENV_EXPERIMENT_NAME);
+    if(griot_dump_folder_base!=NULL){
+        if(snprintf(base_dump_name, array_size-1, "%s/%s/%s/", griot_dump_folder_base, griot_experiment_name==NULL?"":griot_experiment_name, MODULE_NAME)<0){
+            iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled through GRIOT_ENV_ENABLE_DUMP and GRIOT_ENV_DUMP_FOLDER but the final path was too long. Giving up.\n");
+            return;
+        }
+    }else{
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) != NULL) {
+            if(snprintf(base_dump_name, array_size-1, "%s/%s/", cwd, MODULE_NAME)<0){
+                iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled through GRIOT_ENV_ENABLE_DUMP but the final path was too long. Giving up.\n");
+                return;
+            }
+        }
+    }
+    mkdir_recursive(base_dump_name); // fails silently if folder already exists
+}
+
+uint64_t griot_path_hash(const char *pathname){
+    if(pathname==NULL || pathname[0]=='\0') return 0;
+
+    // Relative paths are relative to the current working directory
+    char path[PATH_MAX];
+    size_t length = 0;
+    if(pathname[0]!='/'){
+        if(getcwd(path, PATH_MAX)==NULL) return 0;
+        length = strlen(path);
+        if(length==1) length = 0;
+    }
+
+    // Appending each component of pathname, "/" separated
+    const char *component = pathname;
+    while(*component){
+        const char *end = component;
+        while(*end && *end!='/') end++;
+        size_t component_length = end-component;
+
+        if(component_length==2 && component[0]=='.' && component[1]=='.'){
+            while(length>0 && path[length-1]!='/') length--;
+            if(length>0) length--;
+        }else if(component_length>0 && !(component_length==1 && component[0]=='.')){
+            if(length+1+component_length>=PATH_MAX) return 0;
+            path[length++] = '/';
+            memcpy(path+length, component, component_length);
+            length += component_length;
+        }
+        component = *end ? end+1 : end;
+    }
+    if(length==0) path[length++] = '/';
+
+    return MurmurHash64A(path, length, GRIOT_SEED);
+}
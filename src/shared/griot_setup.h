@@ -0,0 +1,57 @@
+#ifndef GRIOT_SETUP_H
+#define GRIOT_SETUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Setup shared by the capture backends: the iolib module (griot_tracer.c) and the LD_PRELOAD interposer
+ * (griot_preload.c). Both read the same environment variables, and dump to the same folders.
+ */
+
+/**
+ * What the backend still has to start once the model is initialized
+ */
+typedef struct
+{
+    unsigned int context_size;
+    unsigned int call_stack_depth;
+
+    // When the model is sharded per thread, on_io is thread safe and needs no lock around it
+    bool thread_sharded;
+
+    // See griot_record_start
+    bool recording;
+    unsigned int record_depth;
+
+    // See griot_pipeline_start
+    bool async;
+    unsigned int async_queue_size;
+} griot_setup;
+
+/**
+ * Read the GRIOT_* environment variables, select the granularities and the unwinder, and initialize the model.
+ * Invalid values are ignored and the defaults are used instead.
+ */
+void griot_setup_from_env(griot_setup *setup);
+
+/**
+ * @return the name of the current process, without its path
+ */
+char *griot_process_name();
+
+/**
+ * Write the folder the results go to into base_dump_name, and create it: $GRIOT_DUMP_FOLDER/<experiment>/<module>/,
+ * or <cwd>/<module>/
+ */
+void griot_dump_folder(char *base_dump_name, int array_size);
+
+/**
+ * Hash a path once made absolute and lexically canonicalized: empty and "." components are dropped, and ".." removes
+ * the previous component. Symbolic links are not resolved, so that no extra syscall is made on the open path.
+ *
+ * @return the hash of the path, or 0 if it is unknown
+ */
+uint64_t griot_path_hash(const char *pathname);
+
+#endif
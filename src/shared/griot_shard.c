@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "griot_shard.h"
+#include "griot_config.h"
+#include "log.h"
+
+/** Number of fds whose shard is tracked, see griot_shard_fd_open */
+#define GRIOT_SHARD_MAX_FDS 65536
+
+static size_t griot_shard_slot(griot_shard_registry *registry, int32_t thread_id)
+{
+    if(!registry->thread_sharded) return 0;
+    if(thread_id<0 || thread_id>=GRIOT_MAX_THREAD_SHARDS) return GRIOT_MAX_THREAD_SHARDS;
+    return (size_t)thread_id;
+}
+
+void griot_shard_registry_init(griot_shard_registry *registry, bool thread_sharded, void *(*shard_new)(void))
+{
+    registry->thread_sharded = thread_sharded;
+    registry->shard_new = shard_new;
+    atomic_flag_clear(&registry->overflow_lock);
+    atomic_init(&registry->shard_count, 0);
+
+    size_t slot_count = thread_sharded?GRIOT_MAX_THREAD_SHARDS+1:1;
+    registry->slots = (_Atomic(void *) *)malloc(sizeof(_Atomic(void *))*slot_count);
+    if(!registry->slots) FATAL("Out of memory");
+    for(size_t i = 0; i<slot_count; i++) atomic_init(&registry->slots[i], NULL);
+
+    registry->fd_owners = NULL;
+    if(thread_sharded){
+        registry->fd_owners = (_Atomic uint16_t *)calloc(GRIOT_SHARD_MAX_FDS, sizeof(_Atomic uint16_t));
+        if(!registry->fd_owners) FATAL("Out of memory");
+    }
+
+    // A single shard is used when not sharding. No need to wait for the first I/O to create it.
+    if(!thread_sharded){
+        atomic_store(&registry->slots[0], shard_new());
+        atomic_store(&registry->shard_count, 1);
+    }
+}
+
+void *griot_shard_acquire(griot_shard_registry *registry, int32_t thread_id)
+{
+    size_t slot = griot_shard_slot(registry, thread_id);
+    if(slot==GRIOT_MAX_THREAD_SHARDS){
+        while(atomic_flag_test_and_set_explicit(&registry->overflow_lock, memory_order_acquire));
+    }
+
+    void *shard = atomic_load_explicit(&registry->slots[slot], memory_order_acquire);
+    if(shard==NULL){
+        // Only the owning thread (or the overflow lock holder) ever creates a given shard, so a plain store is enough
+        shard = registry->shard_new();
+        atomic_store_explicit(&registry->slots[slot], shard, memory_order_release);
+        atomic_fetch_add_explicit(&registry->shard_count, 1, memory_order_relaxed);
+    }
+    return shard;
+}
+
+void griot_shard_release(griot_shard_registry *registry, int32_t thread_id)
+{
+    if(griot_shard_slot(registry, thread_id)==GRIOT_MAX_THREAD_SHARDS){
+        atomic_flag_clear_explicit(&registry->overflow_lock, memory_order_release);
+    }
+}
+
+void griot_shard_fd_open(griot_shard_registry *registry, int32_t thread_id, int fd)
+{
+    if(registry->fd_owners==NULL || fd<0 || fd>=GRIOT_SHARD_MAX_FDS) return;
+    atomic_store_explicit(&registry->fd_owners[fd], griot_shard_slot(registry, thread_id)+1, memory_order_relaxed);
+}
+
+bool griot_shard_fd_close(griot_shard_registry *registry, int32_t thread_id, int fd)
+{
+    if(registry->fd_owners==NULL || fd<0 || fd>=GRIOT_SHARD_MAX_FDS) return false;
+    uint16_t owner = atomic_exchange_explicit(&registry->fd_owners[fd], 0, memory_order_relaxed);
+    return owner!=0 && owner!=griot_shard_slot(registry, thread_id)+1;
+}
+
+uint64_t griot_shard_budget(griot_shard_registry *registry, uint64_t budget)
+{
+    unsigned int shard_count = atomic_load_explicit(&registry->shard_count, memory_order_relaxed);
+    return shard_count>1 ? budget/shard_count : budget;
+}
+
+bool griot_shard_iter(griot_shard_registry *registry, size_t *i, void **shard)
+{
+    size_t slot_count = registry->thread_sharded?GRIOT_MAX_THREAD_SHARDS+1:1;
+    while(*i<slot_count){
+        void *candidate = atomic_load_explicit(&registry->slots[*i], memory_order_acquire);
+        (*i)++;
+        if(candidate!=NULL){
+            *shard = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void griot_shard_registry_free(griot_shard_registry *registry, void (*shard_free)(void *shard))
+{
+    size_t iter = 0;
+    void *shard;
+    while(griot_shard_iter(registry, &iter, &shard)) shard_free(shard);
+    free(registry->slots);
+    registry->slots = NULL;
+    free(registry->fd_owners);
+    registry->fd_owners = NULL;
+}
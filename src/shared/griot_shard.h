@@ -0,0 +1,77 @@
+#ifndef GRIOT_SHARD_H
+#define GRIOT_SHARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Registry of model shards, indexed by the tracer thread id.
+ *
+ * Without thread sharding, every thread id maps to the same shard and the caller is expected to serialize the calls.
+ * With thread sharding, every thread id below GRIOT_MAX_THREAD_SHARDS owns its own shard, created lock-free by the
+ * owning thread on first use. Thread ids past that limit share an overflow shard protected by a spinlock.
+ */
+typedef struct
+{
+    bool thread_sharded;
+
+    // Creates a zero-initialized shard
+    void *(*shard_new)(void);
+
+    // GRIOT_MAX_THREAD_SHARDS+1 slots, the last one being the overflow shard
+    _Atomic(void *) *slots;
+    atomic_flag overflow_lock;
+
+    // Number of shards created so far
+    _Atomic unsigned int shard_count;
+
+    // With thread sharding, the slot of the shard each fd was opened in plus one, 0 if none. See griot_shard_fd_close.
+    _Atomic uint16_t *fd_owners;
+} griot_shard_registry;
+
+/**
+ * Called once at init. Without thread sharding, the single shard is created right away.
+ */
+void griot_shard_registry_init(griot_shard_registry *registry, bool thread_sharded, void *(*shard_new)(void));
+
+/**
+ * Get the shard owned by a thread, creating it if needed. Must be paired with griot_shard_release().
+ */
+void *griot_shard_acquire(griot_shard_registry *registry, int32_t thread_id);
+void griot_shard_release(griot_shard_registry *registry, int32_t thread_id);
+
+/**
+ * Per-fd state lives in the shard of the thread that opened the fd: fds are assumed to be used by a single thread.
+ * These keep track of which shard a fd was opened in, so that closes by another thread can at least be counted. The
+ * per-fd state of such a fd stays in its shard until the fd is reopened there. Only the first GRIOT_SHARD_MAX_FDS fds
+ * are tracked, and nothing is without thread sharding.
+ */
+void griot_shard_fd_open(griot_shard_registry *registry, int32_t thread_id, int fd);
+
+/**
+ * @return true if fd was opened in the shard of another thread
+ */
+bool griot_shard_fd_close(griot_shard_registry *registry, int32_t thread_id, int fd);
+
+/**
+ * Split a memory budget evenly between the shards created so far. A shard can only evict its own nodes, so each one
+ * keeps to its share: when a shard is created, the share of the others shrinks, and they evict down to it on their
+ * next reservation.
+ *
+ * @return the share of a single shard, or 0 if the budget is 0 (unlimited)
+ */
+uint64_t griot_shard_budget(griot_shard_registry *registry, uint64_t budget);
+
+/**
+ * Iterate over the existing shards, hashmap_iter() style. Only meant to be used while merging results.
+ */
+bool griot_shard_iter(griot_shard_registry *registry, size_t *i, void **shard);
+
+/**
+ * Free every shard with shard_free, then the registry itself.
+ */
+void griot_shard_registry_free(griot_shard_registry *registry, void (*shard_free)(void *shard));
+
+#endif
@@ -11,7 +11,6 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <ctype.h>
-#include <libgen.h>
 
 #include <iolib.h>
 #include <iolib_locks.h>
@@ -22,16 +21,19 @@
 #include <stdatomic.h>
 
 #include "backtrace.h"
+#include "griot_pipeline.h"
+#include "griot_record.h"
+#include "griot_arena.h"
 #include "griot_model.h"
+#include "griot_setup.h"
 #include "griot_config.h"
 #include "log.h"
 
-static char *get_process_name();
-static void get_dump_file_name(char *graph_dump_target, int array_size);
-static void mkdir_recursive(const char *path);
 static void initialize_trace_file();
+static void get_record_path_prefix(char *path_prefix, int array_size);
 static unsigned long iotracerNow();
 static int thread_id();
+static inline void griot_trace_io(int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash);
 
 /** Counters in order to produce a unique id for every thread and operation */
 static _Atomic int thread_counter;
@@ -46,9 +48,17 @@ static int debug_fd = -1;
 /** Mutex to safeguard fprintf output to trace*/
 static struct iolib_lock mut = IOLIB_LOCK_INITIALIZER;
 
-/** Default params when env variables are not set */
-static unsigned int griot_context_size = 16;
-static unsigned int griot_call_stack_depth = 16;
+/** When the model is sharded per thread, on_io is thread safe and mut is not taken around it */
+static bool griot_thread_sharded = false;
+
+/** When the asynchronous pipeline is used, the hooks only capture the I/O, and on_io runs in a model thread */
+static bool griot_async = false;
+
+/** When recording, every I/O is also appended to a binary log, see griot_record.h */
+static bool griot_recording = false;
+
+/** Whether the paths of the opened files are hashed: only when a selected granularity or the record uses them */
+static bool griot_path_hashing = false;
 
 /** Variable used to store the target trace file path*/
 static char base_dump_name[PATH_MAX];
@@ -123,34 +133,26 @@ int griotInitializeTracer(int argc, char **argv, char **env)
 	initialize_trace_file();
 	iotracer_backtrace_table_init();
 
-	/* Reading the context size from environment variable */
-	char *context_size_str = getenv(GRIOT_ENV_CONTEXT_SIZE);
-	if(context_size_str){
-		long context_size = strtol(context_size_str, (char **)NULL, 10);
-		if(context_size<=0){
-			#ifdef GRIOT_ENABLE_DEBUG_LOG
-			iolib_safe_fprintf(stderr, "[GrIOt] A negative, zero or invalid context size was passed to GrIOt. Default value \"%u\" will be used instead.", griot_context_size);
-			#endif
-		}else{
-			griot_context_size = context_size>1024?1024:(unsigned int)context_size;
-		}
+	/* The model, configured from env */
+	griot_setup setup;
+	griot_setup_from_env(&setup);
+	griot_thread_sharded = setup.thread_sharded;
+	griot_path_hashing = setup.recording || griot_needs_path_hash();
+
+	/* Optionally, record every I/O for offline replay. Must be started before the pipeline, that captures more frames then. */
+	if(setup.recording){
+		char record_path_prefix[PATH_MAX];
+		get_record_path_prefix(record_path_prefix, PATH_MAX);
+		griot_recording = true;
+		griot_record_start(record_path_prefix, setup.record_depth, setup.call_stack_depth);
 	}
 
-	/* Get the call stack depth from env */
-	char *call_stack_depth_str = getenv(GRIOT_ENV_CALL_STACK_DEPTH);
-	if(call_stack_depth_str){
-		long call_stack_depth = strtol(call_stack_depth_str, (char **)NULL, 10);
-		if(call_stack_depth<=0){
-			#ifdef GRIOT_ENABLE_DEBUG_LOG
-			iolib_safe_fprintf(stderr, "[GrIOt] A negative, zero or invalid call stack depth was passed to GrIOt. Default value \"%u\" will be used instead.", call_stack_depth);
-			#endif
-		}else{
-			griot_call_stack_depth = (unsigned int)call_stack_depth;
-		}
+	/* Optionally, take the model updates off the application threads */
+	if(setup.async){
+		griot_async = true;
+		griot_pipeline_start(setup.call_stack_depth, setup.async_queue_size, debug_trace_file);
 	}
 
-	griot_init(griot_context_size, griot_call_stack_depth);
-
 	iolib_module_set_label(MODULE_NAME, MODULE_NAME);
 	iolib_module_set_as_accelerator(MODULE_NAME);
 
@@ -166,7 +168,13 @@ int griotInitializeTracer(int argc, char **argv, char **env)
  */
 void griotTerminateTracer(void)
 {
+	if(griot_async) griot_pipeline_stop();
+	if(griot_recording) griot_record_stop();
 	griot_results_dump(target_trace_file);
+	if(griot_async) griot_pipeline_results_dump(target_trace_file);
+	if(griot_recording) griot_record_results_dump(target_trace_file);
+	griot_arena_results_dump(target_trace_file);
+	iotracer_backtrace_stats_dump(target_trace_file);
 
 	if(debug_trace_file != 0){
 		iolib_safe_close(fileno(debug_trace_file));
@@ -230,9 +238,7 @@ static void griotReadHook(void *_data, struct pomd *pomd, int fd, off_t offset,
 	struct griot_file_metadata *data = (struct griot_file_metadata *) _data;
 	if(data->srMustIgnore || fd==target_fd || (debug_fd!=-1 && fd==debug_fd)) return;
 
-	iolib_mutex_lock(&mut);
-	on_io(iotracerNow(), thread_id(), fd, offset, length, iolib_etime_elapsed_ns(elapsed), GRIOT_READ, debug_trace_file);
-	iolib_mutex_unlock(&mut);
+	griot_trace_io(fd, offset, length, iolib_etime_elapsed_ns(elapsed), GRIOT_READ, 0);
 }
 
 /**
@@ -244,9 +250,7 @@ static void griotWriteHook(void *_data, struct pomd *pomd, int fd, off_t offset,
 	struct griot_file_metadata *data = (struct griot_file_metadata *) _data;
 	if(data->srMustIgnore || fd==target_fd || (debug_fd!=-1 && fd==debug_fd)) return;
 
-	iolib_mutex_lock(&mut);
-	on_io(iotracerNow(), thread_id(), fd, offset, length, iolib_etime_elapsed_ns(elapsed), GRIOT_WRITE, debug_trace_file);
-	iolib_mutex_unlock(&mut);
+	griot_trace_io(fd, offset, length, iolib_etime_elapsed_ns(elapsed), GRIOT_WRITE, 0);
 
 }
 
@@ -254,18 +258,17 @@ void griot_record_open_file(void *_data, const char *pathname, int fd, int flags
 	struct griot_file_metadata *data = _data;
 	if(data->srMustIgnore) return;
 
-	iolib_mutex_lock(&mut);
-	on_io(iotracerNow(), thread_id(), data->fd, 0ul, 0ul, 0ul, GRIOT_OPEN, debug_trace_file);
-	iolib_mutex_unlock(&mut);
+	// iolib does not pass the dirfd of openat, so relative paths cannot be told from the dirfd-relative ones: like
+	// the latter in the LD_PRELOAD backend, they are left unknown
+	uint64_t path_hash = griot_path_hashing && pathname && pathname[0]=='/' ? griot_path_hash(pathname) : 0;
+	griot_trace_io(data->fd, 0ul, 0ul, 0ul, GRIOT_OPEN, path_hash);
 }
 
 void griot_record_close_file(void * _data, int fd, struct iolib_etime *elapsed){
 	struct griot_file_metadata *data = _data;
 	if(data->srMustIgnore) return;
 
-	iolib_mutex_lock(&mut);
-	on_io(iotracerNow(), thread_id(), fd, 0ul, 0ul, 0ul, GRIOT_CLOSE, debug_trace_file);
-	iolib_mutex_unlock(&mut);
+	griot_trace_io(fd, 0ul, 0ul, 0ul, GRIOT_CLOSE, 0);
 }
 
 /**
@@ -286,6 +289,12 @@ void iotracerFollowFork(){
 	}
 	initialize_trace_file();
 	griot_results_reset();
+	if(griot_recording){
+		char record_path_prefix[PATH_MAX];
+		get_record_path_prefix(record_path_prefix, PATH_MAX);
+		griot_record_follow_fork(record_path_prefix);
+	}
+	if(griot_async) griot_pipeline_follow_fork(debug_trace_file);
 }
 
 struct iolib_module_ops module_operations = {
@@ -305,57 +314,6 @@ struct iolib_module_ops module_operations = {
 
 //###############################
 
-static char *get_process_name(){
-	#if defined(_GNU_SOURCE)
-	char *name =  program_invocation_name;
-	#else
-	char *name =  "?";
-	#endif
-
-	char *array = name;
-	char *start = name;
-	while(*array){
-		if(*array=='/')
-			start=array+1;
-		//if(!isalpha(*array))
-		//	*array = '#';
-		array++;
-	}
-	return start;
-}
-
-static void mkdir_recursive(const char *path){
-    char *subpath, *fullpath;
-    
-    fullpath = strdup(path);
-    subpath = dirname(fullpath);
-    if (strlen(subpath) > 1)
-        mkdir_recursive(subpath);
-    mkdir(path, 0777);
-    free(fullpath);
-}
-
-static void get_dump_file_name(char *graph_dump_target, int array_size)
-{
-	char *griot_dump_folder_base = getenv(GRIOT_ENV_DUMP_FOLDER);
-	char *griot_experiment_name = getenv(GRIOT_ENV_EXPERIMENT_NAME);
-	if(griot_dump_folder_base!=NULL){
-		if(snprintf(graph_dump_target, PATH_MAX-1, "%s/%s/%s/", griot_dump_folder_base, griot_experiment_name==NULL?"":griot_experiment_name, MODULE_NAME)<0){
-			iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled through GRIOT_ENV_ENABLE_DUMP and GRIOT_ENV_DUMP_FOLDER but the final path was too long. Giving up.\n");
-			return;
-		}
-	}else{
-		char cwd[PATH_MAX];
-		if (getcwd(cwd, sizeof(cwd)) != NULL) {
-			if(snprintf(graph_dump_target, array_size-1, "%s/%s/", cwd, MODULE_NAME)<0){
-				iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled through GRIOT_ENV_ENABLE_DUMP but the final path was too long. Giving up.\n");
-				return;
-			}
-		}
-	}
-	mkdir_recursive(graph_dump_target); // fails silently if folder already exists
-}
-
 static void initialize_trace_file()
 {
 	DISABLE_IOLIB();
@@ -365,10 +323,10 @@ static void initialize_trace_file()
 		return;
 	}
 
-	get_dump_file_name(base_dump_name, PATH_MAX);
+	griot_dump_folder(base_dump_name, PATH_MAX);
 
 	char griot_tracer_target_file[PATH_MAX];
-	if(snprintf(griot_tracer_target_file, PATH_MAX, "%s/%s_%s_pid%d.csv", base_dump_name, hostname, get_process_name(), getpid())<0){
+	if(snprintf(griot_tracer_target_file, PATH_MAX, "%s/%s_%s_pid%d.csv", base_dump_name, hostname, griot_process_name(), getpid())<0){
 		iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled but the dump path was too long. Giving up.\n");
 		exit(-1);
 	}
@@ -382,7 +340,7 @@ static void initialize_trace_file()
 
 	#ifdef GRIOT_DEBUG_MODEL
 	char griot_tracer_debug_file[PATH_MAX];
-	if(snprintf(griot_tracer_debug_file, PATH_MAX, "%s/%s_%s_pid%d.debug", base_dump_name, hostname, get_process_name(), getpid())<0){
+	if(snprintf(griot_tracer_debug_file, PATH_MAX, "%s/%s_%s_pid%d.debug", base_dump_name, hostname, griot_process_name(), getpid())<0){
 		iolib_safe_fprintf(stderr, "[GrIOt] Model dump was enabled but the dump path was too long. Giving up.\n");
 		exit(-1);
 	}
@@ -403,6 +361,35 @@ static void initialize_trace_file()
 	ENABLE_IOLIB();
 }
 
+/**
+ * Prefix of the record logs of the current process, next to its trace file
+ */
+static void get_record_path_prefix(char *path_prefix, int array_size)
+{
+	char hostname[HOST_NAME_MAX];
+	if(gethostname(hostname, HOST_NAME_MAX)<0) hostname[0] = '\0';
+	if(snprintf(path_prefix, array_size, "%s/%s_%s_pid%d", base_dump_name, hostname, griot_process_name(), getpid())>=array_size){
+		iolib_safe_fprintf(stderr, "[GrIOt] Recording was enabled but the record path was too long. Giving up.\n");
+		exit(-1);
+	}
+}
+
+/**
+ * Feed an intercepted I/O to the model, either directly or through the asynchronous pipeline.
+ * Always inlined so that the hooks keep the same number of GrIOt frames in the captured call stacks.
+ */
+static inline __attribute__((always_inline)) void griot_trace_io(int fd, off_t offset, size_t length, uint64_t duration_ns, op_type op_type, uint64_t path_hash){
+	if(griot_async){
+		griot_pipeline_push(iotracerNow(), thread_id(), fd, offset, length, duration_ns, op_type, path_hash);
+		return;
+	}
+
+	if(!griot_thread_sharded) iolib_mutex_lock(&mut);
+	if(griot_recording) griot_record_on_io(iotracerNow(), thread_id(), fd, offset, length, duration_ns, op_type, path_hash, debug_trace_file);
+	else on_io(iotracerNow(), thread_id(), fd, offset, length, duration_ns, op_type, path_hash, debug_trace_file);
+	if(!griot_thread_sharded) iolib_mutex_unlock(&mut);
+}
+
 static int thread_id(){
 	if(tid==0){
 		tid = ++thread_counter;
@@ -52,6 +52,7 @@ struct hashmap {
     size_t mask;
     size_t growat;
     size_t shrinkat;
+    uint64_t moves;
     uint8_t loadfactor;
     uint8_t growpower;
     bool oom;
@@ -206,6 +207,7 @@ static void free_elements(struct hashmap *map) {
 // that this operation does not perform any allocations.
 void hashmap_clear(struct hashmap *map, bool update_cap) {
     map->count = 0;
+    map->moves++;
     free_elements(map);
     if (update_cap) {
         map->cap = map->nbuckets;
@@ -256,6 +258,7 @@ static bool resize0(struct hashmap *map, size_t new_cap) {
     map->mask = map2->mask;
     map->growat = map2->growat;
     map->shrinkat = map2->shrinkat;
+    map->moves++;
     map->free(map2);
     return true;
 }
@@ -292,6 +295,7 @@ const void *hashmap_set_with_hash(struct hashmap *map, const void *item,
         if (bucket->dib == 0) {
             memcpy(bucket, entry, map->bucketsz);
             map->count++;
+            map->moves++;
             return NULL;
         }
         bitem = bucket_item(bucket);
@@ -392,6 +396,7 @@ const void *hashmap_delete_with_hash(struct hashmap *map, const void *key,
                 prev->dib--;
             }
             map->count--;
+            map->moves++;
             if (map->nbuckets > map->cap && map->count <= map->shrinkat) {
                 // Ignore the return value. It's ok for the resize operation to
                 // fail to allocate enough memory because a shrink operation
@@ -415,6 +420,13 @@ size_t hashmap_count(struct hashmap *map) {
     return map->count;
 }
 
+// hashmap_moves returns a counter that changes every time items may have
+// moved within the buckets, i.e. on insertions, deletions, resizes and clears.
+// Pointers returned by hashmap_get stay valid while the counter is unchanged.
+uint64_t hashmap_moves(struct hashmap *map) {
+    return map->moves;
+}
+
 // hashmap_free frees the hash map
 // Every item is called with the element-freeing function given in hashmap_new,
 // if present, to free any data referenced in the elements of the hashmap.